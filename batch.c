@@ -0,0 +1,64 @@
+/*** Batched search ***/
+// Scores many queries in one pass over the book: the store is cut into tiles
+// small enough to stay in L2, and every query in the batch is scored against a
+// tile before moving on to the next, so the book streams through memory once
+// per batch instead of once per query.
+#define BATCH_TILE_SIZE 4096
+#define MAX_BATCH_SIZE 1024
+
+typedef struct BatchSearch {
+  const SwapStore *store;
+  size_t n_queries;
+  const SwapTarget *targets;
+  uint64_t *const *selected;  // per query, NULL when nothing is pinned
+  TopK *worker_top_k;         // n_queries per worker
+} BatchSearch;
+
+void BatchSearchTask(void *job, size_t task_idx, size_t worker_idx) {
+  BatchSearch *search = job;
+  size_t begin = task_idx * BATCH_TILE_SIZE;
+  size_t end = min(begin + BATCH_TILE_SIZE, search->store->size);
+  TopK *worker_top_k = &search->worker_top_k[worker_idx * search->n_queries];
+  for (size_t query_idx = 0; query_idx < search->n_queries; query_idx++) {
+    TopKScanSelected(&search->targets[query_idx], search->store, begin, end,
+                     search->selected[query_idx], &worker_top_k[query_idx]);
+  }
+}
+
+// Fills top_k[i] (initialised by the caller with each query's k) with the
+// nearest swaps to targets[i], best first. Same matches as running
+// TopKScanSelected once per query.
+void BatchTopKScan(WorkerPool *pool, const SwapTarget *targets,
+                   uint64_t *const *selected, size_t n_queries,
+                   const SwapStore *store, TopK *top_k) {
+  BatchSearch search;
+  search.store = store;
+  search.n_queries = n_queries;
+  search.targets = targets;
+  search.selected = selected;
+  search.worker_top_k = malloc(pool->n_workers * n_queries * sizeof(TopK));
+  if (!search.worker_top_k) Die("BatchTopKScan - malloc");
+  for (size_t worker = 0; worker < pool->n_workers; worker++) {
+    for (size_t query_idx = 0; query_idx < n_queries; query_idx++) {
+      TopKInit(&search.worker_top_k[worker * n_queries + query_idx],
+               top_k[query_idx].k);
+    }
+  }
+  size_t n_tiles = (store->size + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE;
+  WorkerPoolRun(pool, BatchSearchTask, &search, n_tiles);
+  for (size_t worker = 0; worker < pool->n_workers; worker++) {
+    for (size_t query_idx = 0; query_idx < n_queries; query_idx++) {
+      TopK *worker_top_k =
+          &search.worker_top_k[worker * n_queries + query_idx];
+      for (size_t i = 0; i < worker_top_k->size; i++) {
+        TopKPush(&top_k[query_idx], worker_top_k->matches[i].row,
+                 worker_top_k->matches[i].distance);
+      }
+      TopKFree(worker_top_k);
+    }
+  }
+  free(search.worker_top_k);
+  for (size_t query_idx = 0; query_idx < n_queries; query_idx++) {
+    TopKSort(&top_k[query_idx]);
+  }
+}
@@ -0,0 +1,180 @@
+/*** Bitmap indexes on the categorical columns ***/
+// One bitmap per (column, value): bit r of bitmaps[field][value] is set when
+// row r has that value. A query that pins categorical values ANDs the
+// bitmaps once, and the scans then only score the surviving rows.
+typedef enum CategoryField {
+  CATEGORY_REF_RATE,
+  CATEGORY_FIXED_PAY_FREQ,
+  CATEGORY_FLOAT_PAY_FREQ,
+  CATEGORY_CURRENCY,
+  CATEGORY_VENUE,
+  CATEGORY_IS_BLOCK_TRADE,
+  CATEGORY_ACTION_TYPE,
+  N_CATEGORY_FIELDS
+} CategoryField;
+
+#define MAX_CATEGORY_VALUES 8
+#define BITMAP_WORDS(n_rows) (((n_rows) + 63) / 64)
+
+// Number of values of each enum, the _ERROR value included
+const uint8_t category_n_values[N_CATEGORY_FIELDS] = {
+    USCPI + 1, A + 1, A + 1, EUR + 1, OFF + 1, N + 1, CORRECT + 1};
+
+typedef struct CategoryIndex {
+  size_t n_rows;
+  uint64_t *bitmaps[N_CATEGORY_FIELDS][MAX_CATEGORY_VALUES];
+} CategoryIndex;
+
+// Values pinned by a query, 0 (the _ERROR value of every enum) if not pinned
+typedef struct CategoryFilter {
+  uint8_t values[N_CATEGORY_FIELDS];
+} CategoryFilter;
+
+const uint8_t *CategoryColumn(const SwapStore *store, int field) {
+  switch (field) {
+    case CATEGORY_REF_RATE:
+      return store->ref_rate;
+    case CATEGORY_FIXED_PAY_FREQ:
+      return store->fixed_pay_freq;
+    case CATEGORY_FLOAT_PAY_FREQ:
+      return store->float_pay_freq;
+    case CATEGORY_CURRENCY:
+      return store->currency;
+    case CATEGORY_VENUE:
+      return store->venue;
+    case CATEGORY_IS_BLOCK_TRADE:
+      return store->is_block_trade;
+    default:
+      return store->action_type;
+  }
+}
+
+void CategoryIndexBuild(CategoryIndex *index, const SwapStore *store) {
+  memset(index, 0, sizeof(CategoryIndex));
+  index->n_rows = store->size;
+  size_t n_words = BITMAP_WORDS(store->size);
+  for (int field = 0; field < N_CATEGORY_FIELDS; field++) {
+    for (int value = 0; value < category_n_values[field]; value++) {
+      index->bitmaps[field][value] = calloc(n_words + 1, sizeof(uint64_t));
+      if (!index->bitmaps[field][value]) Die("CategoryIndexBuild - calloc");
+    }
+    const uint8_t *column = CategoryColumn(store, field);
+    for (size_t row = 0; row < store->size; row++) {
+      uint8_t value = column[row];
+      if (value >= category_n_values[field]) value = 0;
+      index->bitmaps[field][value][row / 64] |= (uint64_t)1 << (row % 64);
+    }
+  }
+}
+
+void CategoryIndexFree(CategoryIndex *index) {
+  for (int field = 0; field < N_CATEGORY_FIELDS; field++) {
+    for (int value = 0; value < MAX_CATEGORY_VALUES; value++) {
+      free(index->bitmaps[field][value]);
+    }
+  }
+  memset(index, 0, sizeof(CategoryIndex));
+}
+
+// A selection of every row in [0, n_rows), for filters to clear rows out of
+uint64_t *BitmapAllRows(size_t n_rows) {
+  size_t n_words = BITMAP_WORDS(n_rows);
+  uint64_t *selected = malloc((n_words + 1) * sizeof(uint64_t));
+  if (!selected) Die("BitmapAllRows - malloc");
+  memset(selected, 0xff, n_words * sizeof(uint64_t));
+  if (n_rows % 64 != 0)
+    selected[n_words - 1] = ((uint64_t)1 << (n_rows % 64)) - 1;
+  selected[n_words] = 0;
+  return selected;
+}
+
+CategoryFilter CategoryFilterFromSwap(const Swap *swap_p) {
+  CategoryFilter filter;
+  filter.values[CATEGORY_REF_RATE] = swap_p->ref_rate;
+  filter.values[CATEGORY_FIXED_PAY_FREQ] = swap_p->fixed_pay_freq;
+  filter.values[CATEGORY_FLOAT_PAY_FREQ] = swap_p->float_pay_freq;
+  filter.values[CATEGORY_CURRENCY] = swap_p->currency;
+  filter.values[CATEGORY_VENUE] = swap_p->venue;
+  filter.values[CATEGORY_IS_BLOCK_TRADE] = swap_p->is_block_trade;
+  filter.values[CATEGORY_ACTION_TYPE] = swap_p->action_type;
+  return filter;
+}
+
+// AND of the bitmaps of every pinned value over the rows of store, NULL when
+// nothing is pinned (every row survives). Rows appended since the index was
+// built are checked against their columns. The caller frees the result.
+uint64_t *CategoryIndexSelect(const CategoryIndex *index,
+                              const CategoryFilter *filter,
+                              const SwapStore *store) {
+  const uint64_t *pinned[N_CATEGORY_FIELDS];
+  int pinned_fields[N_CATEGORY_FIELDS];
+  int n_pinned = 0;
+  for (int field = 0; field < N_CATEGORY_FIELDS; field++) {
+    uint8_t value = filter->values[field];
+    if (value != 0 && value < category_n_values[field]) {
+      pinned_fields[n_pinned] = field;
+      pinned[n_pinned++] = index->bitmaps[field][value];
+    }
+  }
+  if (n_pinned == 0) return NULL;
+  size_t n_words = BITMAP_WORDS(store->size);
+  size_t n_index_words = BITMAP_WORDS(index->n_rows);
+  uint64_t *selected = malloc((n_words + 1) * sizeof(uint64_t));
+  if (!selected) Die("CategoryIndexSelect - malloc");
+  memcpy(selected, pinned[0], (n_index_words + 1) * sizeof(uint64_t));
+  memset(selected + n_index_words + 1, 0,
+         (n_words - n_index_words) * sizeof(uint64_t));
+  for (int i = 1; i < n_pinned; i++) {
+    for (size_t word = 0; word < n_index_words; word++) {
+      selected[word] &= pinned[i][word];
+    }
+  }
+  for (size_t row = index->n_rows; row < store->size; row++) {
+    int matches = 1;
+    for (int i = 0; i < n_pinned && matches; i++) {
+      int field = pinned_fields[i];
+      matches = CategoryColumn(store, field)[row] == filter->values[field];
+    }
+    if (matches) selected[row / 64] |= (uint64_t)1 << (row % 64);
+  }
+  return selected;
+}
+
+// TopKScan restricted to the rows set in selected (all rows if NULL). Runs of
+// fully selected words still go through the block kernels, partially
+// selected words are scored one row at a time.
+void TopKScanSelected(const SwapTarget *target, const SwapStore *store,
+                      size_t begin, size_t end, const uint64_t *selected,
+                      TopK *top_k) {
+  if (selected == NULL) {
+    TopKScan(target, store, begin, end, top_k);
+    return;
+  }
+  size_t row = begin;
+  while (row < end) {
+    size_t word_end = min((row / 64 + 1) * 64, end);
+    uint64_t word = selected[row / 64] >> (row % 64);
+    if (word_end - row < 64)
+      word &= ((uint64_t)1 << (word_end - row)) - 1;
+    if (word == 0) {
+      row = word_end;
+    } else if (row % 64 == 0 && word_end - row == 64 && ~word == 0) {
+      // extend the run of full words as far as it goes
+      size_t run_end = word_end;
+      while (run_end + 64 <= end && ~selected[run_end / 64] == 0)
+        run_end += 64;
+      TopKScan(target, store, row, run_end, top_k);
+      row = run_end;
+    } else {
+      while (word != 0) {
+        int bit = __builtin_ctzll(word);
+        size_t this_row = row + bit;
+        double this_distance = SwapRowDistance(target, store, this_row);
+        if (this_distance <= TopKBound(top_k))
+          TopKPush(top_k, this_row, this_distance);
+        word &= word - 1;
+      }
+      row = word_end;
+    }
+  }
+}
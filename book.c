@@ -0,0 +1,295 @@
+/*** Swap book ***/
+// The store and its indexes, as the queries see them, with the trade
+// lifecycle applied. The SDR reports a trade's CANCEL and CORRECT events, and
+// its amendments, as rows of their own naming the trade in their Original
+// Dissemination ID (or, when that is empty, their own Dissemination ID). A
+// cancelled trade's row is tombstoned, a corrected one replaced by the
+// correction. The event rows themselves never are live trades, except a
+// correction of a trade we don't have.
+//
+// Rows are only ever tombstoned by setting their bit in dead, so the columns
+// and the k-d tree stay valid while queries read them; the searches drop
+// dead rows from their selection (see DropDeadRows). Once enough rows are
+// dead, or appended past the indexes, the whole book is rebuilt from its
+// live rows and swapped for the old one (see SwapBookCompact and AcquireBook
+// in server.c), which keeps the scans dense.
+//
+// Like the store's columns, dead is a range of address space with room for
+// a bit per row the store can hold, and only the part covering the rows
+// the book has taken in is committed.
+#define COMPACT_MIN_ROWS 1024
+
+typedef struct SwapBook {
+  SwapStore store;
+  KdTree kd_tree;
+  CategoryIndex category_index;
+  RangeIndex range_index;
+  MappedFile snapshot;      // backs the indexes when size > 0
+  IdIndex ids;              // Dissemination ID to row, dead rows included
+  Rollups rollups;          // of the live trades
+  uint64_t *dead;           // a bit per row, see SwapBookReserveDead
+  size_t dead_capacity;     // rows of dead committed
+  size_t n_dead;
+  size_t n_published_rows;  // store rows the queries see, see PublishedStore
+  size_t n_readers;         // queries using the book, see AcquireBook
+} SwapBook;
+
+// The store as queries should see it. Rows are only ever appended, past the
+// published ones, and the columns never move, so a copy of the store cut at
+// the published size stays consistent for the whole query.
+SwapStore PublishedStore(const SwapBook *book) {
+  SwapStore store = book->store;
+  store.size = __atomic_load_n(&book->n_published_rows, __ATOMIC_ACQUIRE);
+  return store;
+}
+
+void PublishRows(SwapBook *book, size_t n_rows) {
+  __atomic_store_n(&book->n_published_rows, n_rows, __ATOMIC_RELEASE);
+}
+
+int SwapBookIsLive(const SwapBook *book, size_t row) {
+  uint64_t word = __atomic_load_n(&book->dead[row / 64], __ATOMIC_RELAXED);
+  return !((word >> (row % 64)) & 1);
+}
+
+// Tombstones row, queries stop seeing it from their next selection on
+void SwapBookKill(SwapBook *book, size_t row) {
+  uint64_t bit = (uint64_t)1 << (row % 64);
+  if (__atomic_fetch_or(&book->dead[row / 64], bit, __ATOMIC_RELAXED) & bit)
+    return;
+  __atomic_store_n(&book->n_dead, book->n_dead + 1, __ATOMIC_RELAXED);
+}
+
+size_t DeadBitmapSize(const SwapBook *book) {
+  return BITMAP_WORDS(book->store.max_rows) * sizeof(uint64_t);
+}
+
+void SwapBookFreeDead(SwapBook *book) {
+  if (book->dead) munmap(book->dead, DeadBitmapSize(book));
+  book->dead = NULL;
+  book->dead_capacity = 0;
+}
+
+// Commits dead for at least n_rows rows, a chunk of store rows at a time.
+// The committed words never move, so queries can go on reading them.
+void SwapBookReserveDead(SwapBook *book, size_t n_rows) {
+  if (n_rows <= book->dead_capacity) return;
+  if (n_rows > book->store.max_rows) Die("SwapBookReserveDead - book is full");
+  if (!book->dead) {
+    void *dead = mmap(NULL, DeadBitmapSize(book), PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (dead == MAP_FAILED) Die("SwapBookReserveDead - mmap");
+    book->dead = dead;
+  }
+  size_t new_capacity = (n_rows + SWAP_STORE_CHUNK_ROWS - 1) /
+                        SWAP_STORE_CHUNK_ROWS * SWAP_STORE_CHUNK_ROWS;
+  // mprotect works on whole pages, which may hold more than a chunk's bits
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t begin = book->dead_capacity / 8 / page_size * page_size;
+  size_t end = (new_capacity / 8 + page_size - 1) / page_size * page_size;
+  if (mprotect((char *)book->dead + begin, end - begin,
+               PROT_READ | PROT_WRITE) != 0)
+    Die("SwapBookReserveDead - mprotect");
+  book->dead_capacity = new_capacity;
+}
+
+// Starts the tombstones, the id index and the rollups over, with rows
+// [0, n_rows) of the store as live trades
+void SwapBookTrackRows(SwapBook *book, size_t n_rows) {
+  SwapBookFreeDead(book);
+  IdIndexFree(&book->ids);
+  SwapBookReserveDead(book, n_rows);
+  book->n_dead = 0;
+  IdIndexInit(&book->ids, n_rows);
+  // the id of a replaced trade leads to its replacement, unless a row has
+  // that id itself
+  for (size_t row = 0; row < n_rows; row++) {
+    IdIndexPut(&book->ids, book->store.original_id[row], row);
+  }
+  for (size_t row = 0; row < n_rows; row++) {
+    IdIndexPut(&book->ids, book->store.id[row], row);
+  }
+  RollupsBuild(&book->rollups, &book->store, n_rows);
+}
+
+// Tombstones the row of a live trade, and takes it out of the rollups
+void SwapBookDropTrade(SwapBook *book, size_t row) {
+  SwapBookKill(book, row);
+  RollupsUpdate(&book->rollups, &book->store, row, -1);
+}
+
+// Row of the live trade with Dissemination ID id (or that replaced it),
+// among the published rows, ID_NOT_FOUND if there is none
+size_t SwapBookFind(const SwapBook *book, long id) {
+  size_t row = IdIndexFind(&book->ids, id);
+  if (row == ID_NOT_FOUND ||
+      row >= __atomic_load_n(&book->n_published_rows, __ATOMIC_ACQUIRE) ||
+      !SwapBookIsLive(book, row))
+    return ID_NOT_FOUND;
+  return row;
+}
+
+// What the events among new rows do to the published ones, held back until
+// the new rows are published too (see SwapBookPublishEvents)
+typedef struct StagedEvents {
+  size_t begin;   // the new rows, past the published ones
+  size_t end;
+  IdIndex ids;    // ids that move to new rows
+  IdIndex drops;  // published rows to tombstone, by row + 1
+} StagedEvents;
+
+// Row of the live trade with Dissemination ID id (or that replaced it), as
+// the events applied so far leave it, ID_NOT_FOUND if there is none
+size_t StagedFind(const SwapBook *book, const StagedEvents *staged, long id) {
+  size_t row = staged ? IdIndexFind(&staged->ids, id) : ID_NOT_FOUND;
+  if (row == ID_NOT_FOUND) row = IdIndexFind(&book->ids, id);
+  if (row == ID_NOT_FOUND || !SwapBookIsLive(book, row)) return ID_NOT_FOUND;
+  if (staged && IdIndexFind(&staged->drops, (long)row + 1) != ID_NOT_FOUND)
+    return ID_NOT_FOUND;
+  return row;
+}
+
+// New rows are tombstoned right away, queries can't see them yet
+void StagedDropTrade(SwapBook *book, StagedEvents *staged, size_t row) {
+  if (!staged) {
+    SwapBookDropTrade(book, row);
+  } else if (row >= staged->begin) {
+    SwapBookKill(book, row);
+  } else {
+    IdIndexPut(&staged->drops, (long)row + 1, row);
+  }
+}
+
+void StagedPutId(SwapBook *book, StagedEvents *staged, long id, size_t row) {
+  IdIndexPut(staged ? &staged->ids : &book->ids, id, row);
+}
+
+// Applies rows [begin, end) as events, in order. With staged NULL, in place:
+// a correction is copied over the row of the trade it corrects, which only
+// works before the indexes are built from those rows, and nothing is
+// published yet. Otherwise the rows are new ones past the published rows:
+// a corrected trade's row is tombstoned and the correction takes over its
+// ids, once SwapBookPublishEvents publishes the rows with what staged holds.
+void SwapBookApplyEvents(SwapBook *book, size_t begin, size_t end,
+                         StagedEvents *staged) {
+  SwapStore *store = &book->store;
+  SwapBookReserveDead(book, end);
+  if (staged) {
+    staged->begin = begin;
+    staged->end = end;
+    IdIndexInit(&staged->ids, 0);
+    IdIndexInit(&staged->drops, 0);
+  }
+  for (size_t row = begin; row < end; row++) {
+    long id = store->id[row];
+    long trade_id =
+        store->original_id[row] != 0 ? store->original_id[row] : id;
+    size_t trade_row = StagedFind(book, staged, trade_id);
+    int is_update = store->action_type[row] == CORRECT ||
+                    store->transaction_type[row] == AMENDMENT;
+    if (store->action_type[row] == CANCEL) {
+      if (trade_row != ID_NOT_FOUND) StagedDropTrade(book, staged, trade_row);
+      SwapBookKill(book, row);
+    } else if (is_update && trade_row != ID_NOT_FOUND && !staged) {
+      RollupsUpdate(&book->rollups, store, trade_row, -1);
+      SwapStoreCopyRow(store, trade_row, store, row);
+      RollupsUpdate(&book->rollups, store, trade_row, 1);
+      SwapBookKill(book, row);
+      IdIndexPut(&book->ids, id, trade_row);
+    } else {
+      if (is_update && trade_row != ID_NOT_FOUND)
+        StagedDropTrade(book, staged, trade_row);
+      // even with no live trade to replace, as SwapBookTrackRows would
+      if (is_update) StagedPutId(book, staged, trade_id, row);
+      StagedPutId(book, staged, id, row);
+      // new rows join the rollups once published
+      if (!staged) RollupsUpdate(&book->rollups, store, row, 1);
+    }
+  }
+}
+
+// Publishes the staged rows, then their ids and rollups, and only then
+// tombstones the rows they replace: a corrected trade is found all along,
+// under its old row or its correction, though both may be for a moment
+void SwapBookPublishEvents(SwapBook *book, StagedEvents *staged) {
+  PublishRows(book, staged->end);
+  IdTable *ids = staged->ids.table;
+  for (size_t slot = 0; slot <= ids->mask; slot++) {
+    if (ids->slots[slot].id != 0)
+      IdIndexPut(&book->ids, ids->slots[slot].id, ids->slots[slot].row);
+  }
+  for (size_t row = staged->begin; row < staged->end; row++) {
+    if (SwapBookIsLive(book, row))
+      RollupsUpdate(&book->rollups, &book->store, row, 1);
+  }
+  IdTable *drops = staged->drops.table;
+  for (size_t slot = 0; slot <= drops->mask; slot++) {
+    if (drops->slots[slot].id != 0)
+      SwapBookDropTrade(book, drops->slots[slot].row);
+  }
+  IdIndexFree(&staged->ids);
+  IdIndexFree(&staged->drops);
+}
+
+// Clears the dead rows of the store out of selected (see
+// CategoryIndexSelect). NULL, every row, stays NULL while nothing is dead.
+uint64_t *DropDeadRows(const SwapBook *book, const SwapStore *store,
+                       uint64_t *selected) {
+  if (__atomic_load_n(&book->n_dead, __ATOMIC_RELAXED) == 0) return selected;
+  size_t n_words = BITMAP_WORDS(store->size);
+  if (!selected) selected = BitmapAllRows(store->size);
+  for (size_t word = 0; word < n_words; word++) {
+    selected[word] &= ~__atomic_load_n(&book->dead[word], __ATOMIC_RELAXED);
+  }
+  return selected;
+}
+
+// Builds the indexes over every row of the store, which are all live, and
+// publishes them
+void SwapBookIndex(SwapBook *book) {
+  KdTreeBuild(&book->kd_tree, &book->store);
+  // after the tree, which reorders the rows
+  CategoryIndexBuild(&book->category_index, &book->store);
+  RangeIndexBuild(&book->range_index, &book->store);
+  SwapBookTrackRows(book, book->store.size);
+  PublishRows(book, book->store.size);
+}
+
+// Whether the first n_rows rows have enough dead or unindexed ones to be
+// worth a compacted book
+int SwapBookWantsCompaction(const SwapBook *book, size_t n_rows) {
+  size_t threshold = max(n_rows / 8, COMPACT_MIN_ROWS);
+  return book->n_dead > threshold || n_rows - book->kd_tree.n_rows > threshold;
+}
+
+// A new book of the live rows among the first n_rows, indexed and published.
+// Only reads from book, which queries can go on using meanwhile.
+SwapBook *SwapBookCompact(SwapBook *book, size_t n_rows) {
+  SwapBook *compacted = calloc(1, sizeof(SwapBook));
+  if (!compacted) Die("SwapBookCompact - calloc");
+  SwapStore *store = &compacted->store;
+  SwapStoreInit(store, book->store.max_rows);
+  SwapStoreReserve(store, n_rows - book->n_dead);
+  for (size_t row = 0; row < n_rows; row++) {
+    if (SwapBookIsLive(book, row))
+      SwapStoreCopyRow(store, store->size++, &book->store, row);
+  }
+  SwapBookIndex(compacted);
+  return compacted;
+}
+
+void SwapBookFree(SwapBook *book) {
+  if (book->snapshot.size > 0) {
+    // the indexes live in the mapping
+    UnmapFile(&book->snapshot);
+  } else {
+    CategoryIndexFree(&book->category_index);
+    RangeIndexFree(&book->range_index);
+    KdTreeFree(&book->kd_tree);
+  }
+  SwapStoreFree(&book->store);
+  IdIndexFree(&book->ids);
+  RollupsFree(&book->rollups);
+  SwapBookFreeDead(book);
+  memset(book, 0, sizeof(SwapBook));
+}
@@ -0,0 +1,201 @@
+/*** Response cache ***/
+// Responses to recent queries by their canonical form, so that a query polled
+// over and over is searched once per version of the data rather than once
+// per poll. An entry is only good for the data version it was answered at:
+// the version goes up once new rows are visible (see TailIngestLines), and a
+// shard that sees a newer version than its entries drops them all. The cache
+// is split into shards by key, each with its own mutex, LRU list and share of
+// the entries, so that threads looking up different queries rarely wait on
+// each other.
+#define CACHE_N_SHARDS 16
+#define CACHE_MAX_RESPONSE_SIZE (64 * 1024)  // bigger responses aren't kept
+
+typedef struct CacheEntry {
+  uint64_t hash;
+  size_t key_size;
+  size_t response_size;
+  struct CacheEntry *chain;  // next entry of the same bucket
+  struct CacheEntry *newer;  // LRU order
+  struct CacheEntry *older;
+  char data[];  // the key, then the response
+} CacheEntry;
+
+typedef struct CacheShard {
+  pthread_mutex_t mutex;
+  CacheEntry **buckets;
+  size_t mask;  // number of buckets - 1
+  CacheEntry *newest;
+  CacheEntry *oldest;
+  size_t n_entries;
+  size_t max_entries;
+  size_t version;  // of the data the entries were answered from
+  size_t n_hits;
+  size_t n_misses;
+  char pad[QUEUE_CACHE_LINE];  // keeps the shards' counters apart
+} CacheShard;
+
+typedef struct ResponseCache {
+  CacheShard shards[CACHE_N_SHARDS];
+} ResponseCache;
+
+typedef struct CacheStats {
+  size_t n_hits;
+  size_t n_misses;
+  size_t n_entries;
+} CacheStats;
+
+// FNV-1a
+uint64_t CacheHash(const char *key, size_t key_size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < key_size; i++) {
+    hash = (hash ^ (unsigned char)key[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Room for about max_entries responses
+void ResponseCacheInit(ResponseCache *cache, size_t max_entries) {
+  memset(cache, 0, sizeof(ResponseCache));
+  size_t max_shard_entries = max(max_entries / CACHE_N_SHARDS, 1);
+  size_t n_buckets = 2;
+  while (n_buckets < 2 * max_shard_entries) n_buckets *= 2;
+  for (int i = 0; i < CACHE_N_SHARDS; i++) {
+    CacheShard *shard = &cache->shards[i];
+    pthread_mutex_init(&shard->mutex, NULL);
+    shard->buckets = calloc(n_buckets, sizeof(CacheEntry *));
+    if (!shard->buckets) Die("ResponseCacheInit - calloc");
+    shard->mask = n_buckets - 1;
+    shard->max_entries = max_shard_entries;
+  }
+}
+
+void CacheShardUnlink(CacheShard *shard, CacheEntry *entry) {
+  if (entry->newer) {
+    entry->newer->older = entry->older;
+  } else {
+    shard->newest = entry->older;
+  }
+  if (entry->older) {
+    entry->older->newer = entry->newer;
+  } else {
+    shard->oldest = entry->newer;
+  }
+}
+
+void CacheShardPushNewest(CacheShard *shard, CacheEntry *entry) {
+  entry->newer = NULL;
+  entry->older = shard->newest;
+  if (shard->newest) {
+    shard->newest->newer = entry;
+  } else {
+    shard->oldest = entry;
+  }
+  shard->newest = entry;
+}
+
+void CacheShardRemove(CacheShard *shard, CacheEntry *entry) {
+  CacheEntry **link = &shard->buckets[entry->hash & shard->mask];
+  while (*link != entry) link = &(*link)->chain;
+  *link = entry->chain;
+  CacheShardUnlink(shard, entry);
+  shard->n_entries--;
+  free(entry);
+}
+
+// Drops every entry once the data has moved past their version. Returns 0 if
+// version is older than the shard's, whose entries are then left alone.
+int CacheShardSync(CacheShard *shard, size_t version) {
+  if (version < shard->version) return 0;
+  if (version > shard->version) {
+    while (shard->oldest) CacheShardRemove(shard, shard->oldest);
+    shard->version = version;
+  }
+  return 1;
+}
+
+CacheEntry *CacheShardFind(const CacheShard *shard, uint64_t hash,
+                           const char *key, size_t key_size) {
+  CacheEntry *entry = shard->buckets[hash & shard->mask];
+  while (entry && (entry->hash != hash || entry->key_size != key_size ||
+                   memcmp(entry->data, key, key_size) != 0))
+    entry = entry->chain;
+  return entry;
+}
+
+// Appends the response to key at version to output, returns 0 if there isn't
+// one
+int ResponseCacheGet(ResponseCache *cache, const char *key, size_t key_size,
+                     size_t version, IOBuffer *output) {
+  uint64_t hash = CacheHash(key, key_size);
+  CacheShard *shard = &cache->shards[(hash >> 32) % CACHE_N_SHARDS];
+  pthread_mutex_lock(&shard->mutex);
+  CacheEntry *entry = NULL;
+  if (CacheShardSync(shard, version))
+    entry = CacheShardFind(shard, hash, key, key_size);
+  if (entry) {
+    CacheShardUnlink(shard, entry);
+    CacheShardPushNewest(shard, entry);
+    IOBufferAppend(output, entry->data + key_size, entry->response_size);
+    shard->n_hits++;
+  } else {
+    shard->n_misses++;
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  return entry != NULL;
+}
+
+// Keeps the response to key, answered from the data at version, evicting the
+// least recently used entry of its shard when full
+void ResponseCachePut(ResponseCache *cache, const char *key, size_t key_size,
+                      size_t version, const char *response,
+                      size_t response_size) {
+  if (response_size > CACHE_MAX_RESPONSE_SIZE) return;
+  uint64_t hash = CacheHash(key, key_size);
+  CacheShard *shard = &cache->shards[(hash >> 32) % CACHE_N_SHARDS];
+  CacheEntry *entry = malloc(sizeof(CacheEntry) + key_size + response_size);
+  if (!entry) Die("ResponseCachePut - malloc");
+  entry->hash = hash;
+  entry->key_size = key_size;
+  entry->response_size = response_size;
+  memcpy(entry->data, key, key_size);
+  memcpy(entry->data + key_size, response, response_size);
+  pthread_mutex_lock(&shard->mutex);
+  if (!CacheShardSync(shard, version)) {
+    // answered from data that has changed since
+    pthread_mutex_unlock(&shard->mutex);
+    free(entry);
+    return;
+  }
+  CacheEntry *old_entry = CacheShardFind(shard, hash, key, key_size);
+  if (old_entry) CacheShardRemove(shard, old_entry);
+  if (shard->n_entries == shard->max_entries)
+    CacheShardRemove(shard, shard->oldest);
+  CacheEntry **bucket = &shard->buckets[hash & shard->mask];
+  entry->chain = *bucket;
+  *bucket = entry;
+  CacheShardPushNewest(shard, entry);
+  shard->n_entries++;
+  pthread_mutex_unlock(&shard->mutex);
+}
+
+CacheStats ResponseCacheStats(ResponseCache *cache) {
+  CacheStats stats = {0, 0, 0};
+  for (int i = 0; i < CACHE_N_SHARDS; i++) {
+    CacheShard *shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->mutex);
+    stats.n_hits += shard->n_hits;
+    stats.n_misses += shard->n_misses;
+    stats.n_entries += shard->n_entries;
+    pthread_mutex_unlock(&shard->mutex);
+  }
+  return stats;
+}
+
+void ResponseCacheFree(ResponseCache *cache) {
+  for (int i = 0; i < CACHE_N_SHARDS; i++) {
+    CacheShard *shard = &cache->shards[i];
+    while (shard->oldest) CacheShardRemove(shard, shard->oldest);
+    free(shard->buckets);
+    pthread_mutex_destroy(&shard->mutex);
+  }
+}
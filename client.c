@@ -1,54 +1,324 @@
 /*** Includes ***/
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
 #include "common.c"
+#include "query.c"
+#include "frame.c"
+#include "wire.c"
 
-#define BUFF_SIZE 64
+#define READ_SIZE 4096
 
 /*** Logging utils ***/
 
 /*** Client ***/
-char* GetUserInput(char* input){
-	int n = 0;
-	while ((input[n++] = getchar()) != '\n');
-	return input;
+// One connection for the whole session. Every request read from stdin (a
+// line, or a "BATCH <n>" line with its n query lines) goes out in a frame as
+// soon as it's read, without waiting for the responses before it; responses
+// are printed in request order as they come back. With --binary, the client
+// parses the queries itself and talks the binary protocol of wire.c, printing
+// the matches the way the text protocol would.
+typedef struct Buffer {
+	char* data;
+	size_t size;
+	size_t capacity;
+} Buffer;
+
+void BufferAppend(Buffer* buffer, const char* data, size_t size) {
+	if (buffer->size + size > buffer->capacity) {
+		buffer->capacity = max(2 * buffer->capacity, buffer->size + size);
+		buffer->data = realloc(buffer->data, buffer->capacity);
+		if (!buffer->data) Die("BufferAppend - realloc");
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
 }
 
-int SendToServer(const char* url, const int port, const char* msg) {
-	// Create socket
+void BufferConsume(Buffer* buffer, size_t n) {
+	memmove(buffer->data, buffer->data + n, buffer->size - n);
+	buffer->size -= n;
+}
+
+// How a request went out, which says how to print its response
+typedef enum RequestKind { REQUEST_TEXT, REQUEST_QUERY, REQUEST_BATCH, REQUEST_LOOKUP, REQUEST_AGGREGATE } RequestKind;
+
+typedef struct Session {
+	int sock;
+	Buffer input;     // stdin not yet sent
+	Buffer outgoing;  // frames the socket hasn't taken yet
+	Buffer incoming;  // response frames not complete yet
+	char** responses; // by request id, until printed
+	size_t* response_sizes;
+	RequestKind* request_kinds;
+	int binary;       // queries go packed, see wire.c
+	size_t n_sent;    // requests framed so far
+	size_t n_printed;
+	size_t n_batch_lines; // query lines the current request still needs
+	size_t request_start; // where in input the current request starts
+} Session;
+
+int Connect(const char* url, const int port) {
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
-	if (sock == -1) Die("SendToServer - socket");
+	if (sock == -1) Die("Connect - socket");
 	struct sockaddr_in address;
 	memset(&address, 0, sizeof(address));
 	address.sin_family = AF_INET;
 	address.sin_addr.s_addr = inet_addr(url);
 	address.sin_port = htons(port);
+	if (connect(sock, (struct sockaddr*)&address, (socklen_t) sizeof(address)) < 0) Die("Connect - connect");
+	return sock;
+}
+
+// Sends the frame asking for the binary protocol, and waits for the server to
+// echo it back
+void UseBinaryProtocol(int sock) {
+	size_t size = strlen(BINARY_PROTOCOL_REQUEST);
+	char frame[FRAME_HEADER_SIZE + sizeof(BINARY_PROTOCOL_REQUEST)];
+	FrameHeader header = {size, 0};
+	WriteFrameHeader(frame, &header);
+	memcpy(frame + FRAME_HEADER_SIZE, BINARY_PROTOCOL_REQUEST, size);
+	if (send(sock, frame, FRAME_HEADER_SIZE + size, 0) != (ssize_t)(FRAME_HEADER_SIZE + size)) Die("UseBinaryProtocol - send");
+	char ack[FRAME_HEADER_SIZE + sizeof(BINARY_PROTOCOL_REQUEST)];
+	size_t n_received = 0;
+	while (n_received < FRAME_HEADER_SIZE + size) {
+		ssize_t n_read = read(sock, ack + n_received, FRAME_HEADER_SIZE + size - n_received);
+		if (n_read <= 0) Die("UseBinaryProtocol - read");
+		n_received += n_read;
+	}
+	if (memcmp(ack, frame, FRAME_HEADER_SIZE + size) != 0) Die("UseBinaryProtocol - no binary protocol on the server");
+}
 
-	// Open connection
-	if(connect(sock, (struct sockaddr*)&address, (socklen_t) sizeof(address)) < 0) Die("SendToServer - connect");
+// Packs the ids of a "LOOKUP" line into payload
+void PackLookup(const char* line, Buffer* payload) {
+	// every id takes at least a digit and a separator
+	size_t max_ids = strlen(line) / 2 + 1;
+	long* ids = malloc(max_ids * sizeof(long));
+	if (!ids) Die("PackLookup - malloc");
+	size_t n_ids = IdsFromLookupLine(line, ids, max_ids);
+	char packed[LOOKUP_ID_SIZE];
+	WireWriteUint32(packed, n_ids | BINARY_LOOKUP_FLAG);
+	BufferAppend(payload, packed, sizeof(uint32_t));
+	for (size_t i = 0; i < n_ids; i++) {
+		WireWriteInt64(packed, ids[i]);
+		BufferAppend(payload, packed, LOOKUP_ID_SIZE);
+	}
+	free(ids);
+}
 
-	write(sock, msg, strlen(msg));
-	char buff[100];
-	memset(&buff, 0, sizeof(buff));
-	read(sock, buff, sizeof(buff));
-	close(sock);
+// Packs the query of an "AGGREGATE" line into payload
+void PackAggregate(const char* line, Buffer* payload) {
+	char packed[sizeof(uint32_t) + BINARY_QUERY_SIZE];
+	WireWriteUint32(packed, 1 | BINARY_AGGREGATE_FLAG);
+	SearchQuery query = QueryFromInputLine(line + strlen(AGGREGATE_KEYWORD));
+	EncodeBinaryQuery(&query, packed + sizeof(uint32_t));
+	BufferAppend(payload, packed, sizeof(packed));
+}
 
-	printf("%s\n", buff);
-	return 0;
+// Packs the queries of a request into payload. "kill" and the like go as text.
+RequestKind PackRequest(const char* request, size_t size, Buffer* payload) {
+	char* text = malloc(size + 1);
+	if (!text) Die("PackRequest - malloc");
+	memcpy(text, request, size);
+	text[size] = '\0';
+	char* line_end = strchr(text, '\n');
+	if (line_end) *line_end = '\0';
+	if (strncmp(text, LOOKUP_KEYWORD, strlen(LOOKUP_KEYWORD)) == 0) {
+		PackLookup(text, payload);
+		free(text);
+		return REQUEST_LOOKUP;
+	}
+	if (strncmp(text, AGGREGATE_KEYWORD, strlen(AGGREGATE_KEYWORD)) == 0) {
+		PackAggregate(text, payload);
+		free(text);
+		return REQUEST_AGGREGATE;
+	}
+	RequestKind kind = strncmp(text, "BATCH", strlen("BATCH")) == 0 ? REQUEST_BATCH : REQUEST_QUERY;
+	if (kind == REQUEST_QUERY && ((strcspn(text, "\r") == strlen("kill") && strncmp(text, "kill", strlen("kill")) == 0) || strncmp(text, "STATS", strlen("STATS")) == 0)) {
+		free(text);
+		return REQUEST_TEXT;
+	}
+	long n_queries = kind == REQUEST_BATCH ? strtol(text + strlen("BATCH"), NULL, 10) : 1;
+	char* line = kind == REQUEST_BATCH ? (line_end ? line_end + 1 : NULL) : text;
+	char count[sizeof(uint32_t)] = {0};
+	char packed[BINARY_QUERY_SIZE];
+	BufferAppend(payload, count, sizeof(count));
+	uint32_t n_packed = 0;
+	while (line && (long)n_packed < n_queries) {
+		line_end = strchr(line, '\n');
+		if (line_end) *line_end = '\0';
+		SearchQuery query = QueryFromInputLine(line);
+		EncodeBinaryQuery(&query, packed);
+		BufferAppend(payload, packed, BINARY_QUERY_SIZE);
+		n_packed++;
+		line = line_end && kind == REQUEST_BATCH ? line_end + 1 : NULL;
+	}
+	WireWriteUint32(payload->data, n_packed);
+	free(text);
+	return kind;
 }
 
-// Test our server
-int main(){
+// Prints the matches of a binary response as the text protocol has them
+void PrintBinaryResponse(const char* payload, size_t size, RequestKind kind) {
+	if (size < sizeof(uint32_t)) return;
+	uint32_t n_queries = WireReadUint32(payload);
+	size_t offset = sizeof(uint32_t);
+	char line[MAX_RECORD_TEXT_SIZE];
+	if (kind == REQUEST_AGGREGATE) {
+		// the count is of buckets
+		for (uint32_t i = 0; i < n_queries && offset + AGGREGATE_RECORD_SIZE <= size; i++) {
+			AggregateRecord record = DecodeAggregateRecord(payload + offset);
+			FormatAggregateRecord(&record, line, sizeof(line));
+			fputs(line, stdout);
+			offset += AGGREGATE_RECORD_SIZE;
+		}
+		return;
+	}
+	for (uint32_t i = 0; i < n_queries && offset + sizeof(uint32_t) <= size; i++) {
+		uint32_t n_matches = WireReadUint32(payload + offset);
+		offset += sizeof(uint32_t);
+		if (kind == REQUEST_BATCH) printf("Query:%u;\n", i);
+		for (uint32_t j = 0; j < n_matches && offset + SWAP_RECORD_SIZE <= size; j++) {
+			SwapRecord record = DecodeSwapRecord(payload + offset);
+			FormatSwapRecord(&record, line, sizeof(line));
+			fputs(line, stdout);
+			offset += SWAP_RECORD_SIZE;
+		}
+	}
+}
+
+// Frames input[request_start, end) as the next request
+void QueueRequest(Session* session, size_t end) {
+	const char* request = session->input.data + session->request_start;
+	size_t size = end - session->request_start;
+	Buffer packed = {0};
+	RequestKind kind = session->binary ? PackRequest(request, size, &packed) : REQUEST_TEXT;
+	if (kind != REQUEST_TEXT) {
+		request = packed.data;
+		size = packed.size;
+	}
+	char header_data[FRAME_HEADER_SIZE];
+	FrameHeader header = {size, session->n_sent};
+	WriteFrameHeader(header_data, &header);
+	BufferAppend(&session->outgoing, header_data, FRAME_HEADER_SIZE);
+	BufferAppend(&session->outgoing, request, size);
+	free(packed.data);
+	session->responses = realloc(session->responses, (session->n_sent + 1) * sizeof(char*));
+	session->response_sizes = realloc(session->response_sizes, (session->n_sent + 1) * sizeof(size_t));
+	session->request_kinds = realloc(session->request_kinds, (session->n_sent + 1) * sizeof(RequestKind));
+	if (!session->responses || !session->response_sizes || !session->request_kinds) Die("QueueRequest - realloc");
+	session->responses[session->n_sent] = NULL;
+	session->request_kinds[session->n_sent] = kind;
+	session->n_sent++;
+	session->request_start = end;
+}
+
+// Frames every request whose lines have all been read. At the end of stdin,
+// what's left is a request too.
+void QueueRequests(Session* session, int at_eof) {
+	size_t line_start = session->request_start;
+	char* newline;
+	while (line_start < session->input.size && (newline = memchr(session->input.data + line_start, '\n', session->input.size - line_start))) {
+		const char* line = session->input.data + line_start;
+		size_t line_end = newline - session->input.data + 1;
+		if (line_start == session->request_start && strncmp(line, "BATCH", strlen("BATCH")) == 0) {
+			// "BATCH <n>" is followed by n query lines, sent together
+			long n_queries = strtol(line + strlen("BATCH"), NULL, 10);
+			session->n_batch_lines = n_queries > 0 ? n_queries : 0;
+		} else if (line_start != session->request_start) {
+			session->n_batch_lines--;
+		}
+		line_start = line_end;
+		if (session->n_batch_lines == 0) QueueRequest(session, line_end);
+	}
+	if (at_eof && session->request_start < session->input.size) QueueRequest(session, session->input.size);
+	BufferConsume(&session->input, session->request_start);
+	session->request_start = 0;
+}
+
+// Stores the complete response frames, and prints the ones that are next
+void TakeResponses(Session* session) {
+	FrameHeader header;
+	size_t frame_size;
+	size_t offset = 0;
+	while ((frame_size = ReadFrame(session->incoming.data + offset, session->incoming.size - offset, &header)) > 0) {
+		if (header.request_id >= session->n_sent || session->responses[header.request_id]) Die("TakeResponses - unexpected response");
+		char* response = malloc(header.payload_size + 1);
+		if (!response) Die("TakeResponses - malloc");
+		memcpy(response, session->incoming.data + offset + FRAME_HEADER_SIZE, header.payload_size);
+		session->responses[header.request_id] = response;
+		session->response_sizes[header.request_id] = header.payload_size;
+		offset += frame_size;
+	}
+	BufferConsume(&session->incoming, offset);
+	while (session->n_printed < session->n_sent && session->responses[session->n_printed]) {
+		if (session->request_kinds[session->n_printed] == REQUEST_TEXT) fwrite(session->responses[session->n_printed], 1, session->response_sizes[session->n_printed], stdout);
+		else PrintBinaryResponse(session->responses[session->n_printed], session->response_sizes[session->n_printed], session->request_kinds[session->n_printed]);
+		printf("\n");
+		free(session->responses[session->n_printed]);
+		session->n_printed++;
+	}
+	fflush(stdout);
+}
+
+// Runs requests from stdin until it's exhausted and every response is in,
+// or the server hangs up
+void RunSession(Session* session) {
+	int stdin_done = 0;
+	char chunk[READ_SIZE];
+	while (!stdin_done || session->n_printed < session->n_sent) {
+		struct pollfd fds[2];
+		fds[0].fd = session->sock;
+		fds[0].events = POLLIN | (session->outgoing.size > 0 ? POLLOUT : 0);
+		fds[1].fd = STDIN_FILENO;
+		fds[1].events = stdin_done ? 0 : POLLIN;
+		if (poll(fds, stdin_done ? 1 : 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			Die("RunSession - poll");
+		}
+		if (!stdin_done && fds[1].revents) {
+			ssize_t n_read = read(STDIN_FILENO, chunk, sizeof(chunk));
+			if (n_read > 0) BufferAppend(&session->input, chunk, n_read);
+			else stdin_done = 1;
+			QueueRequests(session, stdin_done);
+		}
+		if (session->outgoing.size > 0) {
+			ssize_t n_sent = send(session->sock, session->outgoing.data, session->outgoing.size, MSG_DONTWAIT);
+			if (n_sent > 0) BufferConsume(&session->outgoing, n_sent);
+			else if (n_sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) break;
+		}
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			ssize_t n_read = read(session->sock, chunk, sizeof(chunk));
+			if (n_read <= 0) break;
+			BufferAppend(&session->incoming, chunk, n_read);
+			TakeResponses(session);
+		}
+	}
+}
+
+// Test our server, over the binary protocol with --binary
+int main(int argc, char** argv){
 	int port = 9999;
 	const char url[] = "127.0.0.1";
-	while (1) {
-		char msg[BUFF_SIZE];
-		memset(msg, 0, sizeof(msg));
-		GetUserInput(msg);
-		SendToServer(url, port, msg);
-	}
+	Session session;
+	memset(&session, 0, sizeof(session));
+	// a server that went away shows up as a failed send
+	signal(SIGPIPE, SIG_IGN);
+	session.sock = Connect(url, port);
+	session.binary = argc > 1 && strcmp(argv[1], "--binary") == 0;
+	if (session.binary) UseBinaryProtocol(session.sock);
+	RunSession(&session);
+	close(session.sock);
+	for (size_t i = session.n_printed; i < session.n_sent; i++) free(session.responses[i]);
+	free(session.responses);
+	free(session.response_sizes);
+	free(session.request_kinds);
+	free(session.input.data);
+	free(session.outgoing.data);
+	free(session.incoming.data);
 	return 0;
 }
@@ -1,5 +1,7 @@
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,10 +12,10 @@ void Die(const char *s) {
   exit(EXIT_FAILURE);
 }
 
-#define MAX_STRING_SIZE 4096
-#define min(x, y) ((x) > (y)) ? (y) : (x)
-#define max(x, y) ((x) > (y)) ? (x) : (y)
-#define abs(x) ((x) > 0) ? (x) : -(x)
+#define MAX_STRING_SIZE 32768
+#define min(x, y) (((x) > (y)) ? (y) : (x))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+#define abs(x) (((x) > 0) ? (x) : -(x))
 
 typedef struct StringBuffer {
   size_t capacity;
@@ -35,9 +37,11 @@ void StringResize(StringBuffer *buff) {
 
 void StringAppend(StringBuffer *buff, const char *new_string) {
   size_t new_string_size = strlen(new_string);
-  if (buff->capacity + new_string_size > MAX_STRING_SIZE)
+  // + 1 for the null terminator
+  if (buff->length + new_string_size + 1 > MAX_STRING_SIZE)
     Die("String exceeds allowable size");
-  while (buff->length + new_string_size > buff->capacity) StringResize(buff);
+  while (buff->length + new_string_size + 1 > buff->capacity)
+    StringResize(buff);
   for (size_t i = 0; i < new_string_size; i++) {
     buff->string[i + buff->length] = new_string[i];
   }
@@ -49,6 +53,46 @@ void StringClear(StringBuffer *buff) {
   if (buff->length > 0) free(buff->string);
 }
 
+/*** String views ***/
+// Pointer and length into someone else's buffer (e.g. a mapped file), not
+// null-terminated
+typedef struct StringView {
+  const char *data;
+  size_t size;
+} StringView;
+
+StringView ViewFromString(const char *string) {
+  StringView view = {string, strlen(string)};
+  return view;
+}
+
+int ViewEquals(StringView view, const char *string) {
+  size_t string_size = strlen(string);
+  return view.size == string_size &&
+         memcmp(view.data, string, string_size) == 0;
+}
+
+// Case-insensitive search, upper_match is expected in upper case
+int ViewContainsUpper(StringView view, const char *upper_match) {
+  size_t match_size = strlen(upper_match);
+  if (match_size > view.size) return 0;
+  for (size_t start = 0; start + match_size <= view.size; start++) {
+    size_t i = 0;
+    while (i < match_size &&
+           toupper((unsigned char)view.data[start + i]) == upper_match[i])
+      i++;
+    if (i == match_size) return 1;
+  }
+  return 0;
+}
+
+// Null-terminated copy into output, truncated to output_size - 1 chars
+void ViewCopy(StringView view, char *output, size_t output_size) {
+  size_t n_chars = min(view.size, output_size - 1);
+  memcpy(output, view.data, n_chars);
+  output[n_chars] = '\0';
+}
+
 /*** Logging utils ***/
 #define LOGFILE "/Users/aionfeehan/Desktop/DTCC/common.log"
 #define log(x) LogToFile((x), strlen((x)), LOGFILE)
@@ -69,6 +113,140 @@ void LogToFile(const char *message, size_t message_len,
   fclose(handler);
 }
 
+/*** Numeric parsing ***/
+// DTCC numbers straight from the cell, no copy: an optional sign, digits with
+// optional thousands separators, an optional fraction and exponent, and a
+// trailing "+" on notionals capped for dissemination (the value is the cap).
+// Both parsers return 0 on success and -1, leaving value alone, when the cell
+// isn't such a number.
+
+// Decimal digits of a double, enough for every mantissa we fit in a uint64_t
+#define MAX_FAST_DIGITS 19
+#define MAX_FAST_POW10 22  // largest power of 10 a double holds exactly
+
+static const double pow10_table[MAX_FAST_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Digits from text[*idx] on, into mantissa, with thousands separators if
+// allowed: a comma after each of the leading 1 to 3 digits and every 3 more.
+// Returns the number of digits read, -1 past MAX_FAST_DIGITS (the run is read
+// to its end all the same) and -2 for a misplaced separator.
+static inline int ParseDigitRun(const char *text, size_t size, size_t *idx,
+                                int allow_commas, uint64_t *mantissa,
+                                int n_digits) {
+  int start_digits = n_digits;
+  int is_long = 0, has_separator = 0;
+  int group = 0;  // digits since the last separator
+  for (; *idx < size; (*idx)++) {
+    unsigned digit = (unsigned char)text[*idx] - '0';
+    if (digit <= 9) {
+      if (n_digits == MAX_FAST_DIGITS) {
+        is_long = 1;
+      } else {
+        *mantissa = 10 * *mantissa + digit;
+        n_digits++;
+      }
+      group++;
+    } else if (allow_commas && text[*idx] == ',' && group > 0 &&
+               (group == 3 || (!has_separator && group < 3))) {
+      has_separator = 1;
+      group = 0;
+    } else {
+      break;
+    }
+  }
+  if (has_separator && group != 3) return -2;
+  if (is_long) return -1;
+  return n_digits - start_digits;
+}
+
+int ParseInteger(StringView cell, long *value) {
+  const char *text = cell.data;
+  size_t idx = 0;
+  int negative = 0;
+  if (idx < cell.size && (text[idx] == '-' || text[idx] == '+'))
+    negative = text[idx++] == '-';
+  uint64_t mantissa = 0;
+  int n_digits = ParseDigitRun(text, cell.size, &idx, 1, &mantissa, 0);
+  if (idx < cell.size && text[idx] == '+') idx++;
+  if (n_digits <= 0 || idx != cell.size || mantissa > (uint64_t)LONG_MAX)
+    return -1;
+  *value = negative ? -(long)mantissa : (long)mantissa;
+  return 0;
+}
+
+// The rare number that doesn't fit the fast path, separators dropped and
+// handed to strtod. ParseDigitRun has checked those of the integer part, a
+// comma past it is left for strtod to reject.
+static int ParseLongNumber(StringView cell, double *value) {
+  char buffer[64];
+  size_t n_chars = 0;
+  int is_integer_part = 1;
+  for (size_t i = 0; i < cell.size; i++) {
+    char c = cell.data[i];
+    if (c == '.' || c == 'e' || c == 'E') is_integer_part = 0;
+    if (c == ',' && is_integer_part) continue;
+    if (n_chars + 1 == sizeof(buffer)) return -1;
+    buffer[n_chars++] = c;
+  }
+  if (n_chars > 0 && buffer[n_chars - 1] == '+') n_chars--;
+  buffer[n_chars] = '\0';
+  char *endptr = NULL;
+  errno = 0;
+  double result = strtod(buffer, &endptr);
+  if (n_chars == 0 || endptr != buffer + n_chars || errno != 0) return -1;
+  *value = result;
+  return 0;
+}
+
+int ParseNumber(StringView cell, double *value) {
+  const char *text = cell.data;
+  size_t idx = 0;
+  int negative = 0;
+  if (idx < cell.size && (text[idx] == '-' || text[idx] == '+'))
+    negative = text[idx++] == '-';
+  uint64_t mantissa = 0;
+  int n_integer_digits = ParseDigitRun(text, cell.size, &idx, 1, &mantissa, 0);
+  if (n_integer_digits == -2) return -1;
+  int n_fraction_digits = 0;
+  if (n_integer_digits >= 0 && idx < cell.size && text[idx] == '.') {
+    idx++;
+    n_fraction_digits = ParseDigitRun(text, cell.size, &idx, 0, &mantissa,
+                                      n_integer_digits);
+  }
+  if (n_integer_digits < 0 || n_fraction_digits < 0) {
+    // more significant digits than the fast path handles
+    return ParseLongNumber(cell, value);
+  }
+  if (n_integer_digits + n_fraction_digits == 0) return -1;
+  int exponent = 0;
+  if (idx < cell.size && (text[idx] == 'e' || text[idx] == 'E')) {
+    idx++;
+    int negative_exponent = 0;
+    if (idx < cell.size && (text[idx] == '-' || text[idx] == '+'))
+      negative_exponent = text[idx++] == '-';
+    uint64_t exponent_digits = 0;
+    int n_exponent_digits =
+        ParseDigitRun(text, cell.size, &idx, 0, &exponent_digits, 0);
+    if (n_exponent_digits <= 0 || exponent_digits > 300) return -1;
+    exponent = negative_exponent ? -(int)exponent_digits : (int)exponent_digits;
+  }
+  if (idx < cell.size && text[idx] == '+') idx++;
+  if (idx != cell.size) return -1;
+  exponent -= n_fraction_digits;
+  if (exponent < -MAX_FAST_POW10 || exponent > MAX_FAST_POW10 ||
+      mantissa > ((uint64_t)1 << 53)) {
+    return ParseLongNumber(cell, value);
+  }
+  // an exact mantissa times or over an exact power of ten rounds correctly
+  double result = (double)mantissa;
+  result = exponent < 0 ? result / pow10_table[-exponent]
+                        : result * pow10_table[exponent];
+  *value = negative ? -result : result;
+  return 0;
+}
+
 /*** Date parsing ***/
 #define DATE_STR_LEN 11      // strlen("2022-09-10") + '\0'
 #define DATETIME_STR_LEN 21  // strlen("2022-09-10T20:15:56") + '\0'
@@ -78,149 +256,124 @@ void LogToFile(const char *message, size_t message_len,
 #define DATETIME_MINUTE_OFFSET 14
 #define DATETIME_SECOND_OFFSET 17
 
-void StripCommas(const char *input, char *output, size_t input_size) {
-  int write_idx = 0;
-  int read_idx = 0;
-  char this_char = 0;
-  for (size_t i = 0; i < input_size; i++) {
-    if ((this_char = input[read_idx++]) != ',') output[write_idx++] = this_char;
-  }
+// Days since 1970-01-01 in the proleptic Gregorian calendar, month in 1..12
+int32_t DaysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  const int era = (year >= 0 ? year : year - 399) / 400;
+  const int year_of_era = year - era * 400;
+  const int day_of_year =
+      (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
 }
 
-long HandleStrtol(const char *input) {
-  // strip out commas
-  char buffer[32];
-  size_t input_len = strlen(input);
-  StripCommas(input, buffer, input_len + 1);
-  char *endptr = NULL;
-  long res = strtol(buffer, &endptr, 10);
-  if (res == 0) {
-    if (errno != 0) {
-      char err_msg[64];
-      sprintf(err_msg, "Encountered error in strtol, errno : %d, input: %s",
-              errno, input);
-      log(err_msg);
-    } else if (buffer == endptr) {
-      char err_msg[64];
-      sprintf(err_msg,
-              "Encountered error in strtol, no characters read from input: %s",
-              input);
-      log(err_msg);
-    }
-  }
-  return res;
+// Inverse of DaysFromCivil
+void CivilFromDays(int32_t days, int *year, int *month, int *day) {
+  days += 719468;
+  const int era = (days >= 0 ? days : days - 146096) / 146097;
+  const int day_of_era = days - era * 146097;
+  const int year_of_era = (day_of_era - day_of_era / 1460 +
+                           day_of_era / 36524 - day_of_era / 146096) /
+                          365;
+  const int day_of_year =
+      day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const int month_index = (5 * day_of_year + 2) / 153;
+  *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+  *month = month_index + (month_index < 10 ? 3 : -9);
+  *year = year_of_era + era * 400 + (*month <= 2);
 }
 
-float HandleStrtof(const char *input) {
-  char buffer[32];
-  size_t input_len = strlen(input);
-  StripCommas(input, buffer, input_len + 1);
-  char *endptr = NULL;
-  float res = strtof(buffer, &endptr);
-  if (res == 0) {
-    if (errno != 0) {
-      char err_msg[64];
-      sprintf(err_msg, "Encountered error in strtof, errno : %d, input: %s",
-              errno, input);
-      log(err_msg);
-    } else if (buffer == endptr) {
-      char err_msg[64];
-      sprintf(err_msg,
-              "Encountered error in strtof, no characters read from input: %s",
-              input);
-      log(err_msg);
-    }
+#define SECONDS_PER_DAY (24 * 60 * 60)
+
+// Value of n ASCII digits, or -1 if one of them isn't a digit
+static inline int ParseDigits(const char *digits, int n) {
+  int value = 0;
+  unsigned bad = 0;
+  for (int i = 0; i < n; i++) {
+    unsigned digit = (unsigned char)digits[i] - '0';
+    bad |= digit > 9;
+    value = 10 * value + (int)digit;
   }
-  return res;
+  return bad ? -1 : value;
 }
 
-// assume date is in format YYYY-MM-DD
-void ParseDate(const char *date, int *year, int *month, int *day) {
-  size_t expected_len = strlen("YYYY-MM-DD");
-  if (strlen(date) != expected_len) Die("Unsupported date format - wrong size");
-  char year_c[5], month_c[3], day_c[3];
-  strncpy(year_c, date, 4);
-  strncpy(month_c, date + DATETIME_MONTH_OFFSET, 2);
-  strncpy(day_c, date + DATETIME_DAY_OFFSET, 2);
-  year_c[4] = '\0';
-  month_c[2] = '\0';
-  day_c[2] = '\0';
-  *year = HandleStrtol(year_c) - 1900;
-  *month = HandleStrtol(month_c);
-  *day = HandleStrtol(day_c);
-  return;
-}
-
-// handle how case where we want 1 to be cast to the string "01"
-void CastIntTo2Chars(char *output, int input) {
-  if ((input < 0) || (input > 99)) {
-    Die("Invalid number passed to CastIntTo2Chars");
-  } else if (input < 10) {
-    output[0] = '0';
-    sprintf(output + 1, "%d", input);
-  } else {
-    sprintf(output, "%d", input);
-  }
+static inline int IsLeapYear(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
 }
 
-// take struct tm and turn it back into a string like YYYY-MM-DD
-void DateFromTm(char *output_string, const struct tm input_tm) {
-  sprintf(output_string, "%d", input_tm.tm_year + 1900);
-  CastIntTo2Chars(output_string + 5, input_tm.tm_mon);
-  CastIntTo2Chars(output_string + 8, input_tm.tm_mday);
-  output_string[DATETIME_MONTH_OFFSET - 1] = '-';
-  output_string[DATETIME_DAY_OFFSET - 1] = '-';
-  output_string[DATE_STR_LEN - 1] = '\0';
-  return;
-}
-
-// assume datetime is in format YYYY-MM-DDTHH:MM:SS
-void ParseDatetime(const char *datetime, int *year, int *month, int *day,
-                   int *hour, int *minute, int *second) {
-  size_t expected_len = strlen("YYYY-MM-DDTHH:MM:SS");
-  if (strlen(datetime) != expected_len)
-    Die("Unsupported date format - wrong size");
-  char year_c[5], month_c[3], day_c[3], hour_c[3], minute_c[3], second_c[3];
-  strncpy(year_c, datetime, 4);
-  strncpy(month_c, datetime + DATETIME_MINUTE_OFFSET, 2);
-  strncpy(day_c, datetime + DATETIME_DAY_OFFSET, 2);
-  strncpy(hour_c, datetime + DATETIME_HOUR_OFFSET, 2);
-  strncpy(minute_c, datetime + DATETIME_MINUTE_OFFSET, 2);
-  strncpy(second_c, datetime + DATETIME_SECOND_OFFSET, 2);
-  year_c[4] = '\0';
-  month_c[2] = '\0';
-  day_c[2] = '\0';
-  hour_c[2] = '\0';
-  minute_c[2] = '\0';
-  second_c[2] = '\0';
-  *year = HandleStrtol(year_c) - 1900;
-  *month = HandleStrtol(month_c);
-  *day = HandleStrtol(day_c);
-  *hour = HandleStrtol(hour_c);
-  *minute = HandleStrtol(minute_c);
-  *second = HandleStrtol(second_c);
-  return;
-}
-
-// convert struct tm back to format like YYYY-MM-DD HH:MM:SS
-void DatetimeFromTm(char *output_string, const struct tm input_tm) {
-  sprintf(output_string, "%d", input_tm.tm_year);
-  CastIntTo2Chars(output_string + DATETIME_MONTH_OFFSET, input_tm.tm_mon);
-  sprintf(output_string + DATETIME_DAY_OFFSET, "%d", input_tm.tm_mday);
-  sprintf(output_string + DATETIME_HOUR_OFFSET, "%d", input_tm.tm_hour);
-  sprintf(output_string + DATETIME_MINUTE_OFFSET, "%d", input_tm.tm_min);
-  sprintf(output_string + DATETIME_SECOND_OFFSET, "%d", input_tm.tm_sec);
-  output_string[DATETIME_MONTH_OFFSET - 1] = '-';
-  output_string[DATETIME_DAY_OFFSET - 1] = '-';
-  output_string[DATETIME_HOUR_OFFSET - 1] = ' ';
-  output_string[DATETIME_MINUTE_OFFSET - 1] = ':';
-  output_string[DATETIME_SECOND_OFFSET - 1] = ':';
-  output_string[DATETIME_STR_LEN] = '\0';
-  return;
+static inline int DaysInMonth(int year, int month) {
+  static const int days_in_month[13] = {0,  31, 28, 31, 30, 31, 30,
+                                        31, 31, 30, 31, 30, 31};
+  return days_in_month[month] + (month == 2 && IsLeapYear(year));
+}
+
+// YYYY-MM-DD straight to days since epoch. Returns 0 on success, -1 (leaving
+// epoch_day alone) if the text isn't a valid date in that exact format.
+int ParseEpochDay(StringView date, int32_t *epoch_day) {
+  if (date.size != DATE_STR_LEN - 1) return -1;
+  const char *text = date.data;
+  int year = ParseDigits(text, 4);
+  int month = ParseDigits(text + DATETIME_MONTH_OFFSET, 2);
+  int day = ParseDigits(text + DATETIME_DAY_OFFSET, 2);
+  if ((year < 0) | (month < 1) | (month > 12) | (day < 1) |
+      (text[DATETIME_MONTH_OFFSET - 1] != '-') |
+      (text[DATETIME_DAY_OFFSET - 1] != '-'))
+    return -1;
+  if (day > DaysInMonth(year, month)) return -1;
+  *epoch_day = DaysFromCivil(year, month, day);
+  return 0;
+}
+
+// YYYY-MM-DDTHH:MM:SS (a trailing Z for UTC is accepted) straight to seconds
+// since epoch. Returns 0 on success, -1 (leaving epoch_seconds alone) if the
+// text isn't a valid datetime in that format.
+int ParseEpochSeconds(StringView datetime, int64_t *epoch_seconds) {
+  const size_t datetime_len = DATETIME_SECOND_OFFSET + 2;
+  size_t size = datetime.size;
+  if (size == datetime_len + 1 && datetime.data[datetime_len] == 'Z') size--;
+  if (size != datetime_len) return -1;
+  const char *text = datetime.data;
+  StringView date = {text, DATE_STR_LEN - 1};
+  int32_t epoch_day;
+  if (ParseEpochDay(date, &epoch_day) != 0) return -1;
+  int hour = ParseDigits(text + DATETIME_HOUR_OFFSET, 2);
+  int minute = ParseDigits(text + DATETIME_MINUTE_OFFSET, 2);
+  int second = ParseDigits(text + DATETIME_SECOND_OFFSET, 2);
+  if ((hour < 0) | (hour > 23) | (minute < 0) | (minute > 59) | (second < 0) |
+      (second > 59) | (text[DATETIME_HOUR_OFFSET - 1] != 'T') |
+      (text[DATETIME_MINUTE_OFFSET - 1] != ':') |
+      (text[DATETIME_SECOND_OFFSET - 1] != ':'))
+    return -1;
+  *epoch_seconds = (int64_t)epoch_day * SECONDS_PER_DAY + hour * 60 * 60 +
+                   minute * 60 + second;
+  return 0;
+}
+
+// YYYY-MM-DD from days since epoch
+void DateFromEpochDay(char *output_string, int32_t epoch_day) {
+  int year, month, day;
+  CivilFromDays(epoch_day, &year, &month, &day);
+  sprintf(output_string, "%04d-%02d-%02d", year, month, day);
+}
+
+// YYYY-MM-DDTHH:MM:SS from seconds since epoch
+void DatetimeFromEpochSeconds(char *output_string, int64_t epoch_seconds) {
+  int64_t epoch_day = epoch_seconds / SECONDS_PER_DAY;
+  int64_t seconds_in_day = epoch_seconds % SECONDS_PER_DAY;
+  if (seconds_in_day < 0) {
+    seconds_in_day += SECONDS_PER_DAY;
+    epoch_day--;
+  }
+  DateFromEpochDay(output_string, (int32_t)epoch_day);
+  sprintf(output_string + DATE_STR_LEN - 1, "T%02d:%02d:%02d",
+          (int)(seconds_in_day / 3600), (int)(seconds_in_day / 60 % 60),
+          (int)(seconds_in_day % 60));
 }
 
 /*** Data structures ***/
 #define ID_COL "Dissemination ID"
+#define ORIGINAL_ID_COL "Original Dissemination ID"
 #define START_COL "Effective Date"
 #define END_COL "Expiration Date"
 #define TRADE_TIME_COL "Execution Timestamp"
@@ -253,9 +406,10 @@ typedef enum Currency { CURRENCY_ERROR, USD, EUR } Currency;
 
 typedef struct Swap {
   long id;
-  struct tm start_date;
-  struct tm end_date;
-  struct tm trade_time;
+  long original_id;  // the trade a CANCEL, CORRECT or amendment is about
+  int32_t start_day;   // days since 1970-01-01, 0 when unset
+  int32_t end_day;
+  int64_t trade_time;  // seconds since 1970-01-01T00:00:00, 0 when unset
   float fixed_rate;
   float notional;
   RefRate ref_rate;
@@ -269,8 +423,8 @@ typedef struct Swap {
 } Swap;
 
 void SwapAttributeLine(StringBuffer *buff, char *attr_name, char *attr_value) {
-  char line[32];
-  sprintf(line, "%s: %s \n", attr_name, attr_value);
+  char line[320];
+  snprintf(line, sizeof(line), "%s: %s \n", attr_name, attr_value);
   StringAppend(buff, line);
 }
 
@@ -285,13 +439,13 @@ void LogSwapDetails(Swap *swap) {
   sprintf(msg_buffer, "%lf", swap->notional);
   SwapAttributeLine(&buff, "Notional", msg_buffer);
   // Start
-  DateFromTm(msg_buffer, swap->start_date);
+  DateFromEpochDay(msg_buffer, swap->start_day);
   SwapAttributeLine(&buff, "Start date", msg_buffer);
   // End
-  DateFromTm(msg_buffer, swap->end_date);
+  DateFromEpochDay(msg_buffer, swap->end_day);
   SwapAttributeLine(&buff, "End date", msg_buffer);
   // Trade time
-  DatetimeFromTm(msg_buffer, swap->trade_time);
+  DatetimeFromEpochSeconds(msg_buffer, swap->trade_time);
   SwapAttributeLine(&buff, "Traded at", msg_buffer);
   // Fixed rate
   sprintf(msg_buffer, "%f", swap->fixed_rate);
@@ -302,6 +456,7 @@ void LogSwapDetails(Swap *swap) {
 
 typedef enum AttrToParse {
   ID,
+  ORIGINAL_ID,
   START_DATE,
   END_DATE,
   TRADE_TIME,
@@ -343,6 +498,8 @@ enum AttrToParse EvaluateColname(const char *col_name) {
   enum AttrToParse res;
   if (strcmp(col_name, ID_COL) == 0) {
     res = ID;
+  } else if (strcmp(col_name, ORIGINAL_ID_COL) == 0) {
+    res = ORIGINAL_ID;
   } else if (strcmp(col_name, START_COL) == 0) {
     res = START_DATE;
   } else if (strcmp(col_name, END_COL) == 0) {
@@ -392,34 +549,20 @@ void StringUpper(char *target_string) {
 }
 
 int StringContains(const char *target_string, const char *match_string) {
-  size_t target_string_len = strlen(target_string);
-  size_t match_string_len = strlen(match_string);
-  if (match_string_len > target_string_len) {
-    return 0;
-  }
-  char chunk[match_string_len];
-  for (size_t chunk_start = 0;
-       chunk_start < target_string_len - match_string_len; chunk_start++) {
-    strncpy(chunk, target_string + chunk_start, match_string_len);
-    if (strcmp(chunk, match_string) == 0) {
-      return 1;
-    }
-  }
-  return 0;
+  return strstr(target_string, match_string) != NULL;
 }
 
-enum RefRate ParseRefRate(char *ref_rate) {
+enum RefRate ParseRefRate(StringView ref_rate) {
   enum RefRate res;
-  StringUpper(ref_rate);
-  if (StringContains(ref_rate, "SOFR") &&
-      StringContains(ref_rate, "COMPOUND")) {
+  if (ViewContainsUpper(ref_rate, "SOFR") &&
+      ViewContainsUpper(ref_rate, "COMPOUND")) {
     res = USSOFR;
-  } else if (StringContains(ref_rate, "SOFR") &&
-             StringContains(ref_rate, "TERM")) {
+  } else if (ViewContainsUpper(ref_rate, "SOFR") &&
+             ViewContainsUpper(ref_rate, "TERM")) {
     res = USSTERM;
-  } else if (StringContains(ref_rate, "CPI")) {
+  } else if (ViewContainsUpper(ref_rate, "CPI")) {
     res = USCPI;
-  } else if (StringContains(ref_rate, "LIBOR")) {
+  } else if (ViewContainsUpper(ref_rate, "LIBOR")) {
     res = USLIBOR;
   } else {
     res = REF_RATE_ERROR;
@@ -427,15 +570,15 @@ enum RefRate ParseRefRate(char *ref_rate) {
   return res;
 }
 
-enum PayFreq ParsePayFreq(const char *input) {
+enum PayFreq ParsePayFreq(StringView input) {
   enum PayFreq res;
-  if (strcmp(input, "1M") == 0) {
+  if (ViewEquals(input, "1M")) {
     res = M;
-  } else if (strcmp(input, "3M") == 0) {
+  } else if (ViewEquals(input, "3M")) {
     res = Q;
-  } else if (strcmp(input, "6M") == 0) {
+  } else if (ViewEquals(input, "6M")) {
     res = S;
-  } else if (strcmp(input, "1Y") == 0) {
+  } else if (ViewEquals(input, "1Y")) {
     res = A;
   } else {
     res = PAY_FREQ_ERROR;
@@ -443,6 +586,33 @@ enum PayFreq ParsePayFreq(const char *input) {
   return res;
 }
 
+// Drops the quotes enclosing a whole cell
+StringView StripQuotes(StringView cell) {
+  if (cell.size >= 2 && cell.data[0] == '"' &&
+      cell.data[cell.size - 1] == '"') {
+    cell.data++;
+    cell.size -= 2;
+  }
+  return cell;
+}
+
+// Splits the next cell off the front of line. Commas between double quotes
+// don't split, and quotes enclosing the whole cell are dropped.
+StringView NextCSVCell(StringView *line) {
+  const char *cursor = line->data;
+  const char *line_end = line->data + line->size;
+  int open_quotes = 0;
+  while (cursor < line_end && (open_quotes || *cursor != ',')) {
+    if (*cursor == '"') open_quotes = !open_quotes;
+    cursor++;
+  }
+  StringView cell = {line->data, cursor - line->data};
+  if (cursor < line_end) cursor++;  // skip the comma
+  line->size = line_end - cursor;
+  line->data = cursor;
+  return StripQuotes(cell);
+}
+
 // Reads the line of .csv into elem_array and returns the number of found
 // elements
 int ParseLine(
@@ -452,112 +622,132 @@ int ParseLine(
     int n_chars,             // size of input_line
     size_t max_colname_len   // size allocated for each title in elem_array
 ) {
-  int elem_idx = 0;
-  int max_buff_size = 64;
-  char buffer[max_buff_size];
-  int buffer_size = 0;
-  int char_idx = 0;
-  char this_char = 0;
-  int open_quote = 0;
-  while (char_idx <= n_chars) {
-    this_char = input_line[char_idx];
-    // we assume special cases (containing "," in their value) are passed in
-    // between " "
-    if ((this_char == ',') && (open_quote == 0)) {
-      buffer[buffer_size] = '\0';
-      strcpy(&elem_array[elem_idx], buffer);
-      elem_idx = elem_idx + max_colname_len;
-      buffer_size = 0;
-    } else if ((this_char == '\n') | (this_char == EOF)) {
-      break;
-    } else if (this_char == '"') {
-      if (open_quote == 1) {
-        open_quote = 0;
-      } else {
-        open_quote = 1;
-      }
-    } else {
-      if (buffer_size + 1 == max_buff_size) {
-        printf("Buffer contains %s\n", buffer);
-        Die("Buffer has reached max size");
-      }
-      buffer[buffer_size++] = this_char;
-    }
-    char_idx++;
+  StringView line = {input_line, n_chars};
+  int n_elems = 0;
+  while (line.size > 0) {
+    StringView cell = NextCSVCell(&line);
+    ViewCopy(cell, &elem_array[n_elems * max_colname_len], max_colname_len);
+    n_elems++;
   }
-  return elem_idx / max_colname_len;
+  return n_elems;
 }
 
-void AssignSwapValue(Swap *swap_p, enum AttrToParse attr_name,
-                     char *attr_value) {
+// Cells that didn't parse are left unset and counted here instead of
+// stopping the load; the loader reports the counts once it's done
+typedef enum BadCellKind {
+  BAD_DATE,
+  BAD_DATETIME,
+  BAD_INTEGER,
+  BAD_NUMBER,
+  N_BAD_CELL_KINDS
+} BadCellKind;
+const char *bad_cell_names[N_BAD_CELL_KINDS] = {"date", "datetime", "integer",
+                                              "number"};
+unsigned long bad_cell_counts[N_BAD_CELL_KINDS];
+
+static inline void CountBadCell(BadCellKind kind) {
+  __atomic_fetch_add(&bad_cell_counts[kind], 1, __ATOMIC_RELAXED);
+}
+
+// Prints and resets the counts of cells that didn't parse
+void ReportBadCells(const char *source) {
+  for (int kind = 0; kind < N_BAD_CELL_KINDS; kind++) {
+    unsigned long count =
+        __atomic_exchange_n(&bad_cell_counts[kind], 0, __ATOMIC_RELAXED);
+    if (count > 0)
+      printf("%s: %lu invalid %s cells left unset\n", source, count,
+             bad_cell_names[kind]);
+  }
+}
+
+void AssignSwapValueView(Swap *swap_p, enum AttrToParse attr_name,
+                         StringView attr_value) {
+  double number;
   switch (attr_name) {
     case ID:
-      swap_p->id = HandleStrtol(attr_value);
+      if (attr_value.size > 0 && ParseInteger(attr_value, &(swap_p->id)) != 0)
+        CountBadCell(BAD_INTEGER);
+      break;
+    case ORIGINAL_ID:
+      if (attr_value.size > 0 &&
+          ParseInteger(attr_value, &(swap_p->original_id)) != 0)
+        CountBadCell(BAD_INTEGER);
       break;
     case START_DATE:
-      ParseDate(attr_value, &(swap_p->start_date.tm_year),
-                &(swap_p->start_date.tm_mon), &(swap_p->start_date.tm_mday));
+      if (ParseEpochDay(attr_value, &(swap_p->start_day)) != 0)
+        CountBadCell(BAD_DATE);
       break;
     case END_DATE:
-      ParseDate(attr_value, &(swap_p->end_date.tm_year),
-                &(swap_p->end_date.tm_mon), &(swap_p->end_date.tm_mday));
+      if (ParseEpochDay(attr_value, &(swap_p->end_day)) != 0)
+        CountBadCell(BAD_DATE);
       break;
     case TRADE_TIME:
-      ParseDatetime(attr_value, &(swap_p->trade_time.tm_year),
-                    &(swap_p->trade_time.tm_mon), &(swap_p->trade_time.tm_mday),
-                    &(swap_p->trade_time.tm_hour), &(swap_p->trade_time.tm_min),
-                    &(swap_p->trade_time.tm_sec));
+      if (ParseEpochSeconds(attr_value, &(swap_p->trade_time)) != 0)
+        CountBadCell(BAD_DATETIME);
       break;
     case FIXED_RATE:
-      if (strlen(attr_value) > 0) swap_p->fixed_rate = HandleStrtof(attr_value);
+      if (attr_value.size == 0) break;
+      if (ParseNumber(attr_value, &number) == 0) {
+        swap_p->fixed_rate = (float)number;
+      } else {
+        CountBadCell(BAD_NUMBER);
+      }
       break;
     case NOTIONAL:
-      swap_p->notional = HandleStrtof(attr_value);
+      if (attr_value.size == 0) break;
+      // a float, like the fixed rate, to halve the column the searches scan:
+      // past 2^24 a notional keeps 24 significant bits (250,000,001 reads
+      // back as 250,000,000), rounded the same way as bounds and targets
+      if (ParseNumber(attr_value, &number) == 0) {
+        swap_p->notional = (float)number;
+      } else {
+        CountBadCell(BAD_NUMBER);
+      }
       break;
     case ACTION_TYPE:
-      if (strcmp(attr_value, "NEW") == 0) {
+      if (ViewEquals(attr_value, "NEW")) {
         swap_p->action_type = NEW;
-      } else if (strcmp(attr_value, "CORRECT") == 0) {
+      } else if (ViewEquals(attr_value, "CORRECT")) {
         swap_p->action_type = CORRECT;
-      } else if (strcmp(attr_value, "CANCEL") == 0) {
+      } else if (ViewEquals(attr_value, "CANCEL")) {
         swap_p->action_type = CANCEL;
       } else {
         swap_p->action_type = ACTION_ERROR;
       }
       break;
     case TRANSACTION_TYPE:
-      if (strcmp(attr_value, "Trade") == 0) {
+      if (ViewEquals(attr_value, "Trade")) {
         swap_p->transaction_type = TRADE;
-      } else if (strcmp(attr_value, "Amendment") == 0) {
+      } else if (ViewEquals(attr_value, "Amendment")) {
         swap_p->transaction_type = AMENDMENT;
-      } else if (strcmp(attr_value, "Termination") == 0) {
+      } else if (ViewEquals(attr_value, "Termination")) {
         swap_p->transaction_type = TERMINATION;
       } else {
         swap_p->transaction_type = TRANSACTION_ERROR;
       }
       break;
     case IS_BLOCK_TRADE:
-      if (strcmp(attr_value, "Y") == 0) {
+      if (ViewEquals(attr_value, "Y")) {
         swap_p->is_block_trade = Y;
-      } else if (strcmp(attr_value, "N") == 0) {
+      } else if (ViewEquals(attr_value, "N")) {
         swap_p->is_block_trade = N;
       } else {
         swap_p->is_block_trade = BLOCK_TRADE_ERROR;
       }
       break;
     case VENUE:
-      if (strcmp(attr_value, "OFF") == 0) {
+      if (ViewEquals(attr_value, "OFF")) {
         swap_p->venue = OFF;
-      } else if (strcmp(attr_value, "ON") == 0) {
+      } else if (ViewEquals(attr_value, "ON")) {
         swap_p->venue = ON;
       } else {
         swap_p->venue = VENUE_ERROR;
       }
       break;
     case CURRENCY:
-      if (strcmp(attr_value, "USD") == 0) {
+      if (ViewEquals(attr_value, "USD")) {
         swap_p->currency = USD;
-      } else if (strcmp(attr_value, "EUR") == 0) {
+      } else if (ViewEquals(attr_value, "EUR")) {
         swap_p->currency = EUR;
       } else {
         swap_p->currency = CURRENCY_ERROR;
@@ -568,8 +758,10 @@ void AssignSwapValue(Swap *swap_p, enum AttrToParse attr_name,
       break;
     case FIXED_PAY_FREQ:
       swap_p->fixed_pay_freq = ParsePayFreq(attr_value);
+      break;
     case REF_RATE:
       swap_p->ref_rate = ParseRefRate(attr_value);
+      break;
     case PARSE_ERROR:
       break;
     default:
@@ -577,68 +769,125 @@ void AssignSwapValue(Swap *swap_p, enum AttrToParse attr_name,
   }
 }
 
-// Reads data from one line of the csv file into a Swap structure
+void AssignSwapValue(Swap *swap_p, enum AttrToParse attr_name,
+                     char *attr_value) {
+  AssignSwapValueView(swap_p, attr_name, ViewFromString(attr_value));
+}
+
+// NextCSVCell without building the cell, for columns nothing reads. Plain
+// and simply quoted cells are jumped over with memchr, anything else (escaped
+// quotes) goes through NextCSVCell.
+void SkipCSVCell(StringView *line) {
+  const char *line_end = line->data + line->size;
+  const char *cell_end = NULL;
+  if (line->size > 0 && line->data[0] == '"') {
+    const char *closing = memchr(line->data + 1, '"', line->size - 1);
+    if (closing && (closing + 1 == line_end || closing[1] == ','))
+      cell_end = closing + 1;
+  } else {
+    const char *comma = memchr(line->data, ',', line->size);
+    cell_end = comma ? comma : line_end;
+    if (memchr(line->data, '"', cell_end - line->data)) cell_end = NULL;
+  }
+  if (!cell_end) {
+    NextCSVCell(line);
+    return;
+  }
+  if (cell_end < line_end) cell_end++;  // skip the comma
+  line->size = line_end - cell_end;
+  line->data = cell_end;
+}
+
+/*** Column plan ***/
+// The attribute each column of a file holds, resolved once from its header so
+// that rows are parsed without comparing column names
+typedef struct ColumnPlan {
+  size_t n_columns;  // up to the last column we read, the rest is never split
+  enum AttrToParse *attrs;
+} ColumnPlan;
+
+ColumnPlan ColumnPlanBuild(const char *colnames,  // as parsed by ParseLine
+                           size_t n_colnames, size_t max_colname_len) {
+  ColumnPlan plan;
+  plan.n_columns = 0;
+  plan.attrs = malloc(max(n_colnames, 1) * sizeof(enum AttrToParse));
+  if (!plan.attrs) Die("ColumnPlanBuild - malloc");
+  for (size_t col = 0; col < n_colnames; col++) {
+    plan.attrs[col] = EvaluateColname(&colnames[col * max_colname_len]);
+    if (plan.attrs[col] != PARSE_ERROR) plan.n_columns = col + 1;
+  }
+  return plan;
+}
+
+void ColumnPlanFree(ColumnPlan *plan) {
+  free(plan->attrs);
+  memset(plan, 0, sizeof(ColumnPlan));
+}
+
+// A swap being filled in cell by cell. The pay frequency columns only say
+// which leg is floating once the ref rate column has been seen, so they are
+// resolved at the end.
+typedef struct SwapCells {
+  Swap swap;
+  StringView pay_freq_1;
+  StringView pay_freq_2;
+  int col_1_is_float;
+} SwapCells;
+
+void SwapCellsInit(SwapCells *cells) {
+  memset(cells, 0, sizeof(SwapCells));
+  cells->pay_freq_1.data = cells->pay_freq_2.data = "";
+}
+
+void SwapCellsAssign(SwapCells *cells, enum AttrToParse attr_name,
+                     StringView cell) {
+  if (cell.size == 0) return;
+  if (attr_name == REF_RATE_IN_COL_1) {
+    cells->col_1_is_float = 1;
+    cells->swap.ref_rate = ParseRefRate(cell);
+  } else if (attr_name == REF_RATE_IN_COL_2) {
+    cells->col_1_is_float = 0;
+    cells->swap.ref_rate = ParseRefRate(cell);
+  } else if (attr_name == PAY_FREQ_1) {
+    cells->pay_freq_1 = cell;
+  } else if (attr_name == PAY_FREQ_2) {
+    cells->pay_freq_2 = cell;
+  } else {
+    AssignSwapValueView(&cells->swap, attr_name, cell);
+  }
+}
+
+Swap SwapCellsFinish(SwapCells *cells) {
+  Swap *swap_p = &cells->swap;
+  if (cells->col_1_is_float) {
+    swap_p->float_pay_freq = ParsePayFreq(cells->pay_freq_1);
+    swap_p->fixed_pay_freq = ParsePayFreq(cells->pay_freq_2);
+  } else {
+    swap_p->float_pay_freq = ParsePayFreq(cells->pay_freq_2);
+    swap_p->fixed_pay_freq = ParsePayFreq(cells->pay_freq_1);
+  }
+  return *swap_p;
+}
+
+// Reads data from one line of the csv file into a Swap structure. The cells
+// are parsed straight out of input_line, which doesn't need to be
+// null-terminated.
 Swap SwapFromCSVLine(const char *input_line,  // input line of .csv text
                      int line_size,           // size in input_line
-                     const char *data_cols,   // column names, assumed to have
-                                              // been parsed from ParseLine
-                     size_t max_colname_len  // size of each column name element
+                     const ColumnPlan *plan   // from the file's header
 ) {
-  Swap swap;
-  int max_buffer_size = 32;
-  char buffer[max_buffer_size];
-  int char_idx = 0;
-  int col_idx = 0;
-  int buffer_size = 0;
-  char pay_freq_1[max_buffer_size], pay_freq_2[max_buffer_size];
-  int col_1_is_float = 0;
-  // Use this as a flag for parsing entries enclosed with " "
-  int open_quotes = 0;
-  while (char_idx < line_size) {
-    const char this_char = input_line[char_idx];
-    // if we reach a ',' and we have not found open quotes, we check out column
-    // name and parse our buffer into the corresponding attribute of swap
-    if ((this_char == ',') && (open_quotes == 0)) {
-      buffer[buffer_size] = '\0';
-      if (buffer_size > 0) {
-        enum AttrToParse attr_name = EvaluateColname(&data_cols[col_idx]);
-        if (attr_name == REF_RATE_IN_COL_1) {
-          col_1_is_float = 1;
-          swap.ref_rate = ParseRefRate(buffer);
-        } else if (attr_name == REF_RATE_IN_COL_2) {
-          col_1_is_float = 0;
-          swap.ref_rate = ParseRefRate(buffer);
-        } else if (attr_name == PAY_FREQ_1) {
-          strncpy(pay_freq_1, buffer, buffer_size);
-        } else if (attr_name == PAY_FREQ_2) {
-          strncpy(pay_freq_2, buffer, buffer_size);
-        } else {
-          AssignSwapValue(&swap, attr_name, buffer);
-        }
-      }
-      buffer_size = 0;
-      col_idx = col_idx + max_colname_len;
-    } else if (this_char == '"') {
-      // if we run into a quote, we switch the flag and continue parsing,
-      // ignoring the quote
-      if (open_quotes == 0) {
-        open_quotes = 1;
-      } else {
-        open_quotes = 0;
-      }
+  SwapCells cells;
+  SwapCellsInit(&cells);
+  StringView line = {input_line, line_size};
+  for (size_t col = 0; col < plan->n_columns && line.size > 0; col++) {
+    enum AttrToParse attr_name = plan->attrs[col];
+    if (attr_name == PARSE_ERROR) {
+      SkipCSVCell(&line);
     } else {
-      buffer[buffer_size++] = this_char;
+      SwapCellsAssign(&cells, attr_name, NextCSVCell(&line));
     }
-    char_idx++;
-  }
-  if (col_1_is_float) {
-    swap.float_pay_freq = ParsePayFreq(pay_freq_1);
-    swap.fixed_pay_freq = ParsePayFreq(pay_freq_2);
-  } else {
-    swap.float_pay_freq = ParsePayFreq(pay_freq_2);
-    swap.fixed_pay_freq = ParsePayFreq(pay_freq_1);
   }
-  return swap;
+  return SwapCellsFinish(&cells);
 }
 
 // int main() {
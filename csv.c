@@ -0,0 +1,90 @@
+/*** Memory-mapped CSV files ***/
+// The loader maps the whole file read-only and tokenizes it in place: lines
+// and cells are StringViews into the mapping, and nothing is copied until a
+// cell is parsed into the store.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct MappedFile {
+  const char *data;
+  size_t size;
+} MappedFile;
+
+// Private mapping of the whole file: with PROT_WRITE, writes go to private
+// copies of the pages and never reach the file. Returns 0 on success, -1 if
+// the file can't be opened or mapped.
+int MapFileWithAccess(MappedFile *file, const char *filename, int protection,
+                      int advice) {
+  memset(file, 0, sizeof(MappedFile));
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return -1;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0) {
+    close(fd);
+    return -1;
+  }
+  file->size = file_stat.st_size;
+  if (file->size > 0) {
+    void *data = mmap(NULL, file->size, protection, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    madvise(data, file->size, advice);
+    file->data = data;
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+  return 0;
+}
+
+int MapFile(MappedFile *file, const char *filename) {
+  // read once front to back: read ahead aggressively, drop pages behind
+  return MapFileWithAccess(file, filename, PROT_READ, MADV_SEQUENTIAL);
+}
+
+void UnmapFile(MappedFile *file) {
+  if (file->size > 0) munmap((void *)file->data, file->size);
+  memset(file, 0, sizeof(MappedFile));
+}
+
+StringView MappedFileView(const MappedFile *file) {
+  StringView view = {file->data, file->size};
+  return view;
+}
+
+// 1 if the range holds an odd number of double quotes, i.e. a range that
+// starts outside quotes ends inside them
+int QuoteParity(const char *data, size_t size) {
+  int parity = 0;
+  for (size_t i = 0; i < size; i++) parity ^= (data[i] == '"');
+  return parity;
+}
+
+// Splits the next line off the front of remaining, without its line break
+// ("\n" or "\r\n"). Line breaks inside a quoted cell don't end the line.
+StringView NextLine(StringView *remaining) {
+  StringView line = {remaining->data, remaining->size};
+  const char *remaining_end = remaining->data + remaining->size;
+  const char *cursor = remaining->data;
+  const char *newline = NULL;
+  int open_quotes = 0;
+  while (cursor < remaining_end &&
+         (newline = memchr(cursor, '\n', remaining_end - cursor))) {
+    open_quotes ^= QuoteParity(cursor, newline - cursor);
+    if (!open_quotes) break;
+    cursor = newline + 1;
+    newline = NULL;
+  }
+  if (newline) {
+    line.size = newline - remaining->data;
+    remaining->size -= line.size + 1;
+    remaining->data = newline + 1;
+  } else {
+    remaining->data = remaining_end;
+    remaining->size = 0;
+  }
+  if (line.size > 0 && line.data[line.size - 1] == '\r') line.size--;
+  return line;
+}
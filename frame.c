@@ -0,0 +1,42 @@
+/*** Framing ***/
+// Requests and responses on a persistent connection travel as frames: the
+// payload size and the request id, both 4-byte big-endian, then the payload.
+// The client picks the ids and gets each one back on its response, so it can
+// send requests without waiting and match the responses, which come back in
+// whatever order they're ready. Requests stay well under 16MB, so the first
+// byte of a framed connection is always 0, which is how the server tells it
+// from a one-shot text request.
+#define FRAME_HEADER_SIZE 8
+
+typedef struct FrameHeader {
+  uint32_t payload_size;
+  uint32_t request_id;
+} FrameHeader;
+
+static inline void WriteUint32(char *out, uint32_t value) {
+  out[0] = (char)(value >> 24);
+  out[1] = (char)(value >> 16);
+  out[2] = (char)(value >> 8);
+  out[3] = (char)value;
+}
+
+static inline uint32_t ReadUint32(const char *in) {
+  const unsigned char *bytes = (const unsigned char *)in;
+  return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+         ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+void WriteFrameHeader(char *out, const FrameHeader *header) {
+  WriteUint32(out, header->payload_size);
+  WriteUint32(out + 4, header->request_id);
+}
+
+// Reads the header at the front of data. Returns the size of the whole
+// frame, or 0 while it hasn't all arrived.
+size_t ReadFrame(const char *data, size_t size, FrameHeader *header) {
+  if (size < FRAME_HEADER_SIZE) return 0;
+  header->payload_size = ReadUint32(data);
+  header->request_id = ReadUint32(data + 4);
+  size_t frame_size = FRAME_HEADER_SIZE + (size_t)header->payload_size;
+  return size < frame_size ? 0 : frame_size;
+}
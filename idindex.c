@@ -0,0 +1,104 @@
+/*** Dissemination ID index ***/
+// Open addressing hash table from a Dissemination ID to the store row holding
+// that trade, with linear probing over a power-of-two table kept at most half
+// full. Only one thread writes to it, any number may look ids up at the same
+// time: a slot's row is written before its id is published, and a table that
+// fills up is copied into one twice the size rather than rehashed in place.
+// The old tables are kept until the index is freed, for the lookups still
+// going through them; there are never more of them than fit in the current
+// one.
+#define ID_NOT_FOUND ((size_t)-1)
+#define MIN_ID_TABLE_SIZE 1024
+
+typedef struct IdSlot {
+  long id;  // 0 for an empty slot, ids are never 0
+  size_t row;
+} IdSlot;
+
+typedef struct IdTable {
+  size_t mask;  // table size - 1
+  struct IdTable *previous;  // the table this one replaced
+  IdSlot slots[];
+} IdTable;
+
+typedef struct IdIndex {
+  IdTable *table;
+  size_t n_ids;
+} IdIndex;
+
+static inline size_t IdHash(long id) {
+  uint64_t hash = (uint64_t)id * 0x9e3779b97f4a7c15ULL;
+  return hash ^ (hash >> 32);
+}
+
+IdTable *IdTableAlloc(size_t size) {
+  IdTable *table = calloc(1, sizeof(IdTable) + size * sizeof(IdSlot));
+  if (!table) Die("IdTableAlloc - calloc");
+  table->mask = size - 1;
+  return table;
+}
+
+// Room for n_ids ids before the table has to grow
+void IdIndexInit(IdIndex *index, size_t n_ids) {
+  size_t size = MIN_ID_TABLE_SIZE;
+  while (size < 2 * n_ids) size *= 2;
+  index->table = IdTableAlloc(size);
+  index->n_ids = 0;
+}
+
+void IdIndexFree(IdIndex *index) {
+  IdTable *table = index->table;
+  while (table) {
+    IdTable *previous = table->previous;
+    free(table);
+    table = previous;
+  }
+  memset(index, 0, sizeof(IdIndex));
+}
+
+// Row of id, ID_NOT_FOUND if it isn't in the index. Safe alongside IdIndexPut.
+size_t IdIndexFind(const IdIndex *index, long id) {
+  const IdTable *table = __atomic_load_n(&index->table, __ATOMIC_ACQUIRE);
+  if (id == 0 || !table) return ID_NOT_FOUND;
+  size_t slot = IdHash(id) & table->mask;
+  for (;; slot = (slot + 1) & table->mask) {
+    long slot_id = __atomic_load_n(&table->slots[slot].id, __ATOMIC_ACQUIRE);
+    if (slot_id == 0) return ID_NOT_FOUND;
+    if (slot_id == id)
+      return __atomic_load_n(&table->slots[slot].row, __ATOMIC_RELAXED);
+  }
+}
+
+// Inserts into a table the caller makes sure has room, returns 1 if id is new
+int IdTablePut(IdTable *table, long id, size_t row) {
+  size_t slot = IdHash(id) & table->mask;
+  for (;; slot = (slot + 1) & table->mask) {
+    IdSlot *this_slot = &table->slots[slot];
+    if (this_slot->id == id) {
+      __atomic_store_n(&this_slot->row, row, __ATOMIC_RELAXED);
+      return 0;
+    }
+    if (this_slot->id == 0) {
+      __atomic_store_n(&this_slot->row, row, __ATOMIC_RELAXED);
+      __atomic_store_n(&this_slot->id, id, __ATOMIC_RELEASE);
+      return 1;
+    }
+  }
+}
+
+// Points id at row, replacing the row it had. Ids of 0 are ignored.
+void IdIndexPut(IdIndex *index, long id, size_t row) {
+  if (id == 0) return;
+  IdTable *table = index->table;
+  if (2 * (index->n_ids + 1) > table->mask + 1) {
+    IdTable *grown = IdTableAlloc(2 * (table->mask + 1));
+    for (size_t slot = 0; slot <= table->mask; slot++) {
+      if (table->slots[slot].id != 0)
+        IdTablePut(grown, table->slots[slot].id, table->slots[slot].row);
+    }
+    grown->previous = table;
+    __atomic_store_n(&index->table, grown, __ATOMIC_RELEASE);
+    table = grown;
+  }
+  index->n_ids += IdTablePut(table, id, row);
+}
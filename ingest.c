@@ -0,0 +1,126 @@
+/*** Parallel CSV ingestion ***/
+// The body of a mapped file is cut into byte ranges, each moved forward to
+// the first line break that isn't inside a quoted cell. Each task counts the
+// lines in its range, a prefix sum over the counts gives every range its
+// first row, and the tasks then parse their lines straight into those rows
+// of the store: no per-thread segments to copy back together.
+#define INGEST_CHUNKS_PER_WORKER 4
+#ifndef MIN_INGEST_CHUNK_SIZE  // tests set it low to cut small bodies finer
+#define MIN_INGEST_CHUNK_SIZE (1 << 20)
+#endif
+
+typedef struct IngestChunk {
+  const char *begin;
+  const char *end;
+  int quote_parity;  // of the raw range, before aligning to lines
+  size_t n_lines;
+  size_t first_row;
+} IngestChunk;
+
+typedef struct CSVIngest {
+  StringView body;
+  IngestChunk *chunks;
+  size_t n_chunks;
+  const ColumnPlan *plan;
+  SwapStore *store;
+  size_t end_row;  // rows past the store's max_rows are dropped
+} CSVIngest;
+
+void IngestQuoteParityTask(void *job, size_t task_idx, size_t worker_idx) {
+  (void)worker_idx;
+  CSVIngest *ingest = job;
+  IngestChunk *chunk = &ingest->chunks[task_idx];
+  chunk->quote_parity =
+      CSVQuoteParity(chunk->begin, chunk->end - chunk->begin);
+}
+
+void IngestCountTask(void *job, size_t task_idx, size_t worker_idx) {
+  (void)worker_idx;
+  CSVIngest *ingest = job;
+  IngestChunk *chunk = &ingest->chunks[task_idx];
+  CSVScanner scanner;
+  CSVScannerInit(&scanner, chunk->begin, chunk->end);
+  CSVLine line;
+  chunk->n_lines = 0;
+  while (CSVScannerNextLine(&scanner, &line, 0)) chunk->n_lines++;
+}
+
+void IngestParseTask(void *job, size_t task_idx, size_t worker_idx) {
+  (void)worker_idx;
+  CSVIngest *ingest = job;
+  IngestChunk *chunk = &ingest->chunks[task_idx];
+  CSVScanner scanner;
+  CSVScannerInit(&scanner, chunk->begin, chunk->end);
+  CSVLine line;
+  size_t row = chunk->first_row;
+  while (row < ingest->end_row &&
+         CSVScannerNextLine(&scanner, &line, ingest->plan->n_columns)) {
+    Swap swap = SwapFromCSVCells(&line, ingest->plan);
+    SwapStoreSet(ingest->store, row++, &swap);
+  }
+}
+
+// Moves each chunk's start past the first line break outside quotes, given
+// the quote parity of the raw ranges before it
+void IngestAlignChunks(CSVIngest *ingest) {
+  const char *body_end = ingest->body.data + ingest->body.size;
+  int open_quotes = 0;
+  for (size_t i = 0; i < ingest->n_chunks; i++) {
+    IngestChunk *chunk = &ingest->chunks[i];
+    int chunk_parity = chunk->quote_parity;
+    if (i > 0) {
+      const char *cursor = max(chunk->begin, ingest->chunks[i - 1].begin);
+      int in_quotes = open_quotes;
+      if (cursor != chunk->begin) {
+        // the previous chunk's line ran past this raw range
+        in_quotes = 0;
+      }
+      while (cursor < body_end && (in_quotes || *cursor != '\n')) {
+        in_quotes ^= (*cursor == '"');
+        cursor++;
+      }
+      chunk->begin = cursor < body_end ? cursor + 1 : body_end;
+      ingest->chunks[i - 1].end = chunk->begin;
+    }
+    open_quotes ^= chunk_parity;
+  }
+  ingest->chunks[ingest->n_chunks - 1].end = body_end;
+}
+
+// Parses every line of body into the store, from row store->size on, and
+// returns the number of rows added. The store commits memory for exactly the
+// rows counted, lines past its max_rows are dropped.
+size_t IngestCSVBody(WorkerPool *pool, StringView body,
+                     const ColumnPlan *plan, SwapStore *store) {
+  if (body.size == 0) return 0;
+  CSVIngest ingest;
+  ingest.body = body;
+  ingest.plan = plan;
+  ingest.store = store;
+  ingest.n_chunks = min(INGEST_CHUNKS_PER_WORKER * pool->n_workers,
+                        body.size / MIN_INGEST_CHUNK_SIZE + 1);
+  ingest.chunks = malloc(ingest.n_chunks * sizeof(IngestChunk));
+  if (!ingest.chunks) Die("IngestCSVBody - malloc");
+  size_t raw_chunk_size = body.size / ingest.n_chunks;
+  for (size_t i = 0; i < ingest.n_chunks; i++) {
+    ingest.chunks[i].begin = body.data + i * raw_chunk_size;
+    ingest.chunks[i].end = i + 1 < ingest.n_chunks
+                               ? body.data + (i + 1) * raw_chunk_size
+                               : body.data + body.size;
+  }
+  WorkerPoolRun(pool, IngestQuoteParityTask, &ingest, ingest.n_chunks);
+  IngestAlignChunks(&ingest);
+  WorkerPoolRun(pool, IngestCountTask, &ingest, ingest.n_chunks);
+  size_t next_row = store->size;
+  for (size_t i = 0; i < ingest.n_chunks; i++) {
+    ingest.chunks[i].first_row = next_row;
+    next_row += ingest.chunks[i].n_lines;
+  }
+  ingest.end_row = min(next_row, store->max_rows);
+  SwapStoreReserve(store, ingest.end_row);
+  WorkerPoolRun(pool, IngestParseTask, &ingest, ingest.n_chunks);
+  size_t n_added = ingest.end_row - store->size;
+  store->size += n_added;
+  free(ingest.chunks);
+  return n_added;
+}
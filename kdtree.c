@@ -0,0 +1,263 @@
+/*** k-d tree over the numeric swap coordinates ***/
+// Built once after loading: the store rows are reordered so that every node
+// covers a contiguous range of rows, which lets the leaves reuse the same
+// distance kernels as the brute-force scan.
+#define KD_LEAF_SIZE 64
+#define KD_N_DIMS 5
+
+typedef enum KdDim {
+  KD_START_DAY,
+  KD_END_DAY,
+  KD_TRADE_TIME,
+  KD_FIXED_RATE,
+  KD_NOTIONAL
+} KdDim;
+
+// Bounding box of the rows in [begin, end), in column units
+typedef struct KdNode {
+  size_t begin;
+  size_t end;
+  size_t left;   // child node indices, 0 for a leaf (the root is never a child)
+  size_t right;
+  int32_t min_start_day, max_start_day;
+  int32_t min_end_day, max_end_day;
+  int64_t min_trade_time, max_trade_time;
+  float min_fixed_rate, max_fixed_rate;
+  float min_notional, max_notional;
+} KdNode;
+
+typedef struct KdTree {
+  size_t n_nodes;
+  size_t capacity;
+  size_t n_rows;  // the tree covers store rows [0, n_rows)
+  KdNode *nodes;
+} KdTree;
+
+// Used to pick and partition split dimensions only, never for distances
+static inline double KdKey(const SwapStore *store, size_t row, int dim) {
+  switch (dim) {
+    case KD_START_DAY:
+      return store->start_day[row];
+    case KD_END_DAY:
+      return store->end_day[row];
+    case KD_TRADE_TIME:
+      return (double)store->trade_time[row];
+    case KD_FIXED_RATE:
+      return store->fixed_rate[row];
+    default:
+      return store->notional[row];
+  }
+}
+
+void KdNodeBounds(KdNode *node, const SwapStore *store, const size_t *order) {
+  size_t first = order[node->begin];
+  node->min_start_day = node->max_start_day = store->start_day[first];
+  node->min_end_day = node->max_end_day = store->end_day[first];
+  node->min_trade_time = node->max_trade_time = store->trade_time[first];
+  node->min_fixed_rate = node->max_fixed_rate = store->fixed_rate[first];
+  node->min_notional = node->max_notional = store->notional[first];
+  for (size_t i = node->begin + 1; i < node->end; i++) {
+    size_t row = order[i];
+    node->min_start_day = min(node->min_start_day, store->start_day[row]);
+    node->max_start_day = max(node->max_start_day, store->start_day[row]);
+    node->min_end_day = min(node->min_end_day, store->end_day[row]);
+    node->max_end_day = max(node->max_end_day, store->end_day[row]);
+    node->min_trade_time = min(node->min_trade_time, store->trade_time[row]);
+    node->max_trade_time = max(node->max_trade_time, store->trade_time[row]);
+    node->min_fixed_rate = min(node->min_fixed_rate, store->fixed_rate[row]);
+    node->max_fixed_rate = max(node->max_fixed_rate, store->fixed_rate[row]);
+    node->min_notional = min(node->min_notional, store->notional[row]);
+    node->max_notional = max(node->max_notional, store->notional[row]);
+  }
+}
+
+// Spread of each dimension in the box, used to normalise the split choice
+void KdNodeSpreads(const KdNode *node, double *spreads) {
+  spreads[KD_START_DAY] =
+      (double)node->max_start_day - (double)node->min_start_day;
+  spreads[KD_END_DAY] = (double)node->max_end_day - (double)node->min_end_day;
+  spreads[KD_TRADE_TIME] =
+      (double)node->max_trade_time - (double)node->min_trade_time;
+  spreads[KD_FIXED_RATE] =
+      (double)node->max_fixed_rate - (double)node->min_fixed_rate;
+  spreads[KD_NOTIONAL] =
+      (double)node->max_notional - (double)node->min_notional;
+}
+
+// Partial sort of order[begin, end) on dim so that order[nth] is in its
+// sorted position (quickselect)
+void KdSelect(const SwapStore *store, size_t *order, size_t begin, size_t end,
+              size_t nth, int dim) {
+  while (end - begin > 1) {
+    double pivot = KdKey(store, order[begin + (end - begin) / 2], dim);
+    size_t lo = begin, hi = end - 1;
+    while (lo <= hi) {
+      while (KdKey(store, order[lo], dim) < pivot) lo++;
+      while (KdKey(store, order[hi], dim) > pivot) hi--;
+      if (lo <= hi) {
+        size_t tmp = order[lo];
+        order[lo++] = order[hi];
+        order[hi] = tmp;
+        if (hi == 0) break;
+        hi--;
+      }
+    }
+    if (nth <= hi) {
+      end = hi + 1;
+    } else if (nth >= lo) {
+      begin = lo;
+    } else {
+      return;
+    }
+  }
+}
+
+size_t KdTreeAddNode(KdTree *tree, size_t begin, size_t end) {
+  if (tree->n_nodes == tree->capacity) {
+    tree->capacity = tree->capacity ? 2 * tree->capacity : 64;
+    tree->nodes = realloc(tree->nodes, tree->capacity * sizeof(KdNode));
+    if (!tree->nodes) Die("KdTreeAddNode - realloc");
+  }
+  KdNode *node = &tree->nodes[tree->n_nodes];
+  memset(node, 0, sizeof(KdNode));
+  node->begin = begin;
+  node->end = end;
+  return tree->n_nodes++;
+}
+
+size_t KdTreeBuildNode(KdTree *tree, const SwapStore *store, size_t *order,
+                       size_t begin, size_t end,
+                       const double *global_spreads) {
+  size_t node_idx = KdTreeAddNode(tree, begin, end);
+  KdNodeBounds(&tree->nodes[node_idx], store, order);
+  if (end - begin <= KD_LEAF_SIZE) return node_idx;
+  // split on the widest dimension relative to the whole book
+  double spreads[KD_N_DIMS];
+  KdNodeSpreads(&tree->nodes[node_idx], spreads);
+  int split_dim = 0;
+  double widest = -1;
+  for (int dim = 0; dim < KD_N_DIMS; dim++) {
+    double normalised =
+        global_spreads[dim] > 0 ? spreads[dim] / global_spreads[dim] : 0;
+    if (normalised > widest) {
+      widest = normalised;
+      split_dim = dim;
+    }
+  }
+  size_t middle = begin + (end - begin) / 2;
+  KdSelect(store, order, begin, end, middle, split_dim);
+  size_t left = KdTreeBuildNode(tree, store, order, begin, middle,
+                                global_spreads);
+  size_t right =
+      KdTreeBuildNode(tree, store, order, middle, end, global_spreads);
+  // tree->nodes may have moved while building the children
+  tree->nodes[node_idx].left = left;
+  tree->nodes[node_idx].right = right;
+  return node_idx;
+}
+
+// Builds the tree over every row currently in the store, reordering the store
+void KdTreeBuild(KdTree *tree, SwapStore *store) {
+  memset(tree, 0, sizeof(KdTree));
+  tree->n_rows = store->size;
+  if (store->size == 0) return;
+  size_t *order = malloc(store->size * sizeof(size_t));
+  if (!order) Die("KdTreeBuild - malloc");
+  for (size_t i = 0; i < store->size; i++) order[i] = i;
+  KdNode root = {0};
+  root.end = store->size;
+  KdNodeBounds(&root, store, order);
+  double global_spreads[KD_N_DIMS];
+  KdNodeSpreads(&root, global_spreads);
+  KdTreeBuildNode(tree, store, order, 0, store->size, global_spreads);
+  SwapStorePermute(store, order);
+  free(order);
+}
+
+void KdTreeFree(KdTree *tree) {
+  free(tree->nodes);
+  memset(tree, 0, sizeof(KdTree));
+}
+
+// Lower bound on the distance from the target to any row in the box. Each
+// term is computed the same way as in SwapRowDistance from a gap that is no
+// bigger than the row's own difference, so rounding can't push the bound
+// above a real distance.
+static inline double KdNodeDistance(const SwapTarget *target,
+                                    const KdNode *node) {
+  double start_gap =
+      target->start_day < node->min_start_day
+          ? (double)(node->min_start_day - target->start_day)
+          : (target->start_day > node->max_start_day
+                 ? (double)(target->start_day - node->max_start_day)
+                 : 0);
+  double end_gap = target->end_day < node->min_end_day
+                       ? (double)(node->min_end_day - target->end_day)
+                       : (target->end_day > node->max_end_day
+                              ? (double)(target->end_day - node->max_end_day)
+                              : 0);
+  double trade_time_gap =
+      target->trade_time < node->min_trade_time
+          ? (double)(node->min_trade_time - target->trade_time)
+          : (target->trade_time > node->max_trade_time
+                 ? (double)(target->trade_time - node->max_trade_time)
+                 : 0);
+  double fixed_rate_gap =
+      target->fixed_rate < node->min_fixed_rate
+          ? (double)node->min_fixed_rate - (double)target->fixed_rate
+          : (target->fixed_rate > node->max_fixed_rate
+                 ? (double)target->fixed_rate - (double)node->max_fixed_rate
+                 : 0);
+  double notional_gap =
+      target->notional < node->min_notional
+          ? (double)node->min_notional - (double)target->notional
+          : (target->notional > node->max_notional
+                 ? (double)target->notional - (double)node->max_notional
+                 : 0);
+  return start_gap * start_gap * target->start_weight +
+         end_gap * end_gap * target->end_weight +
+         trade_time_gap * trade_time_gap * target->trade_time_weight +
+         fixed_rate_gap * fixed_rate_gap * target->fixed_rate_weight +
+         notional_gap * notional_gap * target->notional_weight;
+}
+
+// Nodes are only pruned when their bound is strictly worse than the current
+// K-th match, so ties on distance still resolve to the lowest row exactly as
+// in the scan
+void KdTreeSearchNode(const KdTree *tree, size_t node_idx,
+                      const SwapTarget *target, const SwapStore *store,
+                      const uint64_t *selected, TopK *top_k) {
+  const KdNode *node = &tree->nodes[node_idx];
+  if (node->left == 0) {
+    TopKScanSelected(target, store, node->begin, node->end, selected, top_k);
+    return;
+  }
+  size_t near_child = node->left, far_child = node->right;
+  double near_distance = KdNodeDistance(target, &tree->nodes[near_child]);
+  double far_distance = KdNodeDistance(target, &tree->nodes[far_child]);
+  if (far_distance < near_distance) {
+    size_t tmp_child = near_child;
+    near_child = far_child;
+    far_child = tmp_child;
+    double tmp_distance = near_distance;
+    near_distance = far_distance;
+    far_distance = tmp_distance;
+  }
+  if (near_distance <= TopKBound(top_k))
+    KdTreeSearchNode(tree, near_child, target, store, selected, top_k);
+  if (far_distance <= TopKBound(top_k))
+    KdTreeSearchNode(tree, far_child, target, store, selected, top_k);
+}
+
+// Same results as TopKScanSelected over the whole store, rows the tree
+// doesn't cover yet are scanned
+void KdTreeSearch(const KdTree *tree, const SwapTarget *target,
+                  const SwapStore *store, const uint64_t *selected,
+                  TopK *top_k) {
+  if (tree->n_nodes > 0 &&
+      KdNodeDistance(target, &tree->nodes[0]) <= TopKBound(top_k))
+    KdTreeSearchNode(tree, 0, target, store, selected, top_k);
+  if (tree->n_rows < store->size)
+    TopKScanSelected(target, store, tree->n_rows, store->size, selected,
+                     top_k);
+}
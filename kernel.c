@@ -0,0 +1,239 @@
+/*** Distance kernels ***/
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+#include <float.h>
+
+// Query swap converted to the units of the store columns, along with the
+// weight of each numeric coordinate in the L2 distance
+typedef struct SwapTarget {
+  int32_t start_day;
+  int32_t end_day;
+  int64_t trade_time;
+  float fixed_rate;
+  float notional;
+  double start_weight;
+  double end_weight;
+  double trade_time_weight;
+  double fixed_rate_weight;
+  double notional_weight;
+  RefRate ref_rate;
+  PayFreq fixed_pay_freq;
+  PayFreq float_pay_freq;
+} SwapTarget;
+
+// Coordinates left out of the query get a weight of 0
+SwapTarget SwapTargetFromSwap(const Swap *swap_p) {
+  SwapTarget target;
+  target.start_day = swap_p->start_day;
+  target.end_day = swap_p->end_day;
+  target.trade_time = swap_p->trade_time;
+  target.fixed_rate = swap_p->fixed_rate;
+  target.notional = swap_p->notional;
+  target.start_weight = (swap_p->start_day == 0 ? 0 : 1);
+  target.end_weight = (swap_p->end_day == 0 ? 0 : 1);
+  target.trade_time_weight = (swap_p->trade_time == 0 ? 0 : 1);
+  target.fixed_rate_weight = (swap_p->fixed_rate == 0 ? 0 : 1);
+  target.notional_weight = (swap_p->notional == 0 ? 0 : 1);
+  target.ref_rate = swap_p->ref_rate;
+  target.fixed_pay_freq = swap_p->fixed_pay_freq;
+  target.float_pay_freq = swap_p->float_pay_freq;
+  return target;
+}
+
+// Weighted squared L2 distance between the target and one row. Every kernel
+// below evaluates exactly this expression, in this order, so that they all
+// agree bit for bit on which row is nearest.
+static inline double SwapRowDistance(const SwapTarget *target,
+                                     const SwapStore *store, size_t row) {
+  double start_distance = (double)(store->start_day[row] - target->start_day);
+  double end_distance = (double)(store->end_day[row] - target->end_day);
+  double trade_time_distance =
+      (double)(store->trade_time[row] - target->trade_time);
+  double fixed_rate_distance =
+      (double)store->fixed_rate[row] - (double)target->fixed_rate;
+  double notional_distance =
+      (double)store->notional[row] - (double)target->notional;
+  return start_distance * start_distance * target->start_weight +
+         end_distance * end_distance * target->end_weight +
+         trade_time_distance * trade_time_distance *
+             target->trade_time_weight +
+         fixed_rate_distance * fixed_rate_distance *
+             target->fixed_rate_weight +
+         notional_distance * notional_distance * target->notional_weight;
+}
+
+// Nearest row in [begin, end). Ties go to the lowest row. Returns end if the
+// range is empty.
+size_t NearestRowScalar(const SwapTarget *target, const SwapStore *store,
+                        size_t begin, size_t end, double *nearest_distance) {
+  double best = DBL_MAX;
+  size_t best_row = end;
+  for (size_t row = begin; row < end; row++) {
+    double this_distance = SwapRowDistance(target, store, row);
+    if (this_distance < best) {
+      best = this_distance;
+      best_row = row;
+    }
+  }
+  *nearest_distance = best;
+  return best_row;
+}
+
+// Writes the distance of every row in [begin, end) to distances[row - begin]
+void DistancesScalar(const SwapTarget *target, const SwapStore *store,
+                     size_t begin, size_t end, double *distances) {
+  for (size_t row = begin; row < end; row++) {
+    distances[row - begin] = SwapRowDistance(target, store, row);
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+// int64 -> double for |x| < 2^51, AVX2 has no direct conversion
+__attribute__((target("avx2"))) static inline __m256d Int64ToDouble(
+    __m256i x) {
+  const __m256i magic_int = _mm256_set1_epi64x(0x4338000000000000LL);
+  const __m256d magic_double = _mm256_set1_pd(6755399441055744.0);
+  return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(x, magic_int)),
+                       magic_double);
+}
+
+// Squared weighted distance for the 4 rows starting at row. Four double lanes
+// by design: float lanes would take 8 rows per instruction, but lose 29 bits
+// of the squared second and notional differences (up to ~1e18), and the
+// kernels would stop agreeing with SwapRowDistance.
+__attribute__((target("avx2"))) static inline __m256d SwapRowDistance4(
+    const SwapTarget *target, const SwapStore *store, size_t row) {
+  __m256d start_distance = _mm256_cvtepi32_pd(_mm_sub_epi32(
+      _mm_loadu_si128((const __m128i *)(store->start_day + row)),
+      _mm_set1_epi32(target->start_day)));
+  __m256d end_distance = _mm256_cvtepi32_pd(_mm_sub_epi32(
+      _mm_loadu_si128((const __m128i *)(store->end_day + row)),
+      _mm_set1_epi32(target->end_day)));
+  __m256d trade_time_distance = Int64ToDouble(_mm256_sub_epi64(
+      _mm256_loadu_si256((const __m256i *)(store->trade_time + row)),
+      _mm256_set1_epi64x(target->trade_time)));
+  __m256d fixed_rate_distance =
+      _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(store->fixed_rate + row)),
+                    _mm256_set1_pd((double)target->fixed_rate));
+  __m256d notional_distance =
+      _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(store->notional + row)),
+                    _mm256_set1_pd((double)target->notional));
+  __m256d res =
+      _mm256_mul_pd(_mm256_mul_pd(start_distance, start_distance),
+                    _mm256_set1_pd(target->start_weight));
+  res = _mm256_add_pd(
+      res, _mm256_mul_pd(_mm256_mul_pd(end_distance, end_distance),
+                         _mm256_set1_pd(target->end_weight)));
+  res = _mm256_add_pd(
+      res,
+      _mm256_mul_pd(_mm256_mul_pd(trade_time_distance, trade_time_distance),
+                    _mm256_set1_pd(target->trade_time_weight)));
+  res = _mm256_add_pd(
+      res,
+      _mm256_mul_pd(_mm256_mul_pd(fixed_rate_distance, fixed_rate_distance),
+                    _mm256_set1_pd(target->fixed_rate_weight)));
+  res = _mm256_add_pd(
+      res, _mm256_mul_pd(_mm256_mul_pd(notional_distance, notional_distance),
+                         _mm256_set1_pd(target->notional_weight)));
+  return res;
+}
+
+// Same contract as NearestRowScalar. Works on 8 rows per iteration, two
+// 4-wide vectors, keeping the per-lane minimum and its row in registers until
+// the final reduction.
+__attribute__((target("avx2"))) size_t NearestRowAVX2(
+    const SwapTarget *target, const SwapStore *store, size_t begin,
+    size_t end, double *nearest_distance) {
+  __m256d best_lo = _mm256_set1_pd(DBL_MAX);
+  __m256d best_hi = _mm256_set1_pd(DBL_MAX);
+  __m256i best_row_lo = _mm256_set1_epi64x(-1);
+  __m256i best_row_hi = _mm256_set1_epi64x(-1);
+  __m256i row_lo = _mm256_setr_epi64x(begin, begin + 1, begin + 2, begin + 3);
+  __m256i row_hi = _mm256_add_epi64(row_lo, _mm256_set1_epi64x(4));
+  const __m256i step = _mm256_set1_epi64x(8);
+  size_t row = begin;
+  for (; row + 8 <= end; row += 8) {
+    __m256d distance_lo = SwapRowDistance4(target, store, row);
+    __m256d distance_hi = SwapRowDistance4(target, store, row + 4);
+    __m256d closer_lo = _mm256_cmp_pd(distance_lo, best_lo, _CMP_LT_OQ);
+    __m256d closer_hi = _mm256_cmp_pd(distance_hi, best_hi, _CMP_LT_OQ);
+    best_lo = _mm256_blendv_pd(best_lo, distance_lo, closer_lo);
+    best_hi = _mm256_blendv_pd(best_hi, distance_hi, closer_hi);
+    best_row_lo = _mm256_castpd_si256(
+        _mm256_blendv_pd(_mm256_castsi256_pd(best_row_lo),
+                         _mm256_castsi256_pd(row_lo), closer_lo));
+    best_row_hi = _mm256_castpd_si256(
+        _mm256_blendv_pd(_mm256_castsi256_pd(best_row_hi),
+                         _mm256_castsi256_pd(row_hi), closer_hi));
+    row_lo = _mm256_add_epi64(row_lo, step);
+    row_hi = _mm256_add_epi64(row_hi, step);
+  }
+  double lane_best[8];
+  int64_t lane_row[8];
+  _mm256_storeu_pd(lane_best, best_lo);
+  _mm256_storeu_pd(lane_best + 4, best_hi);
+  _mm256_storeu_si256((__m256i *)lane_row, best_row_lo);
+  _mm256_storeu_si256((__m256i *)(lane_row + 4), best_row_hi);
+  double best = DBL_MAX;
+  size_t best_row = end;
+  for (int lane = 0; lane < 8; lane++) {
+    if (lane_row[lane] < 0) continue;
+    if (lane_best[lane] < best ||
+        (lane_best[lane] == best && (size_t)lane_row[lane] < best_row)) {
+      best = lane_best[lane];
+      best_row = lane_row[lane];
+    }
+  }
+  // leftover rows all come after the vectorised ones, so strict < keeps ties
+  // on the lowest row
+  double tail_best;
+  size_t tail_row = NearestRowScalar(target, store, row, end, &tail_best);
+  if (tail_row != end && tail_best < best) {
+    best = tail_best;
+    best_row = tail_row;
+  }
+  *nearest_distance = best;
+  return best_row;
+}
+
+// Same contract as DistancesScalar
+__attribute__((target("avx2"))) void DistancesAVX2(const SwapTarget *target,
+                                                   const SwapStore *store,
+                                                   size_t begin, size_t end,
+                                                   double *distances) {
+  size_t row = begin;
+  for (; row + 4 <= end; row += 4) {
+    _mm256_storeu_pd(distances + (row - begin),
+                     SwapRowDistance4(target, store, row));
+  }
+  for (; row < end; row++) {
+    distances[row - begin] = SwapRowDistance(target, store, row);
+  }
+}
+#endif
+
+typedef size_t (*NearestRowKernel)(const SwapTarget *target,
+                                   const SwapStore *store, size_t begin,
+                                   size_t end, double *nearest_distance);
+
+typedef void (*DistancesKernel)(const SwapTarget *target,
+                                const SwapStore *store, size_t begin,
+                                size_t end, double *distances);
+
+NearestRowKernel nearest_row_kernel = NearestRowScalar;
+DistancesKernel distances_kernel = DistancesScalar;
+
+// Pick the widest kernels the CPU we're running on supports
+void InitSearchKernels() {
+  nearest_row_kernel = NearestRowScalar;
+  distances_kernel = DistancesScalar;
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    nearest_row_kernel = NearestRowAVX2;
+    distances_kernel = DistancesAVX2;
+  }
+#endif
+}
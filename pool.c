@@ -0,0 +1,237 @@
+/*** Worker pool ***/
+// Persistent threads that split one job into tasks. The thread submitting the
+// job works on it too, as worker 0, so a pool of n workers has n - 1 threads.
+#include <pthread.h>
+
+typedef void (*WorkerTask)(void *job, size_t task_idx, size_t worker_idx);
+
+typedef struct WorkerPool {
+  size_t n_workers;
+  pthread_t *threads;
+  struct WorkerThreadArgs *thread_args;
+  pthread_mutex_t mutex;
+  pthread_cond_t job_ready;
+  pthread_cond_t job_done;
+  pthread_mutex_t submit_mutex;  // one job at a time
+  WorkerTask task;
+  void *job;
+  size_t n_tasks;
+  size_t next_task;  // claimed with atomic increments
+  size_t n_busy;
+  unsigned long generation;
+  int is_running;
+} WorkerPool;
+
+typedef struct WorkerThreadArgs {
+  WorkerPool *pool;
+  size_t worker_idx;
+} WorkerThreadArgs;
+
+void WorkerPoolRunTasks(WorkerPool *pool, size_t worker_idx) {
+  size_t task_idx;
+  while ((task_idx = __atomic_fetch_add(&pool->next_task, 1,
+                                        __ATOMIC_RELAXED)) < pool->n_tasks) {
+    pool->task(pool->job, task_idx, worker_idx);
+  }
+}
+
+void *WorkerPoolThread(void *arg) {
+  WorkerThreadArgs *args = arg;
+  WorkerPool *pool = args->pool;
+  unsigned long seen_generation = 0;
+  pthread_mutex_lock(&pool->mutex);
+  while (1) {
+    while (pool->is_running && pool->generation == seen_generation)
+      pthread_cond_wait(&pool->job_ready, &pool->mutex);
+    if (!pool->is_running) break;
+    seen_generation = pool->generation;
+    pthread_mutex_unlock(&pool->mutex);
+    WorkerPoolRunTasks(pool, args->worker_idx);
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->n_busy == 0) pthread_cond_signal(&pool->job_done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+void WorkerPoolInit(WorkerPool *pool, size_t n_workers) {
+  memset(pool, 0, sizeof(WorkerPool));
+  pool->n_workers = max(n_workers, 1);
+  pool->is_running = 1;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_mutex_init(&pool->submit_mutex, NULL);
+  pthread_cond_init(&pool->job_ready, NULL);
+  pthread_cond_init(&pool->job_done, NULL);
+  pool->threads = malloc(pool->n_workers * sizeof(pthread_t));
+  pool->thread_args = malloc(pool->n_workers * sizeof(WorkerThreadArgs));
+  if (!pool->threads || !pool->thread_args) Die("WorkerPoolInit - malloc");
+  for (size_t i = 1; i < pool->n_workers; i++) {
+    pool->thread_args[i].pool = pool;
+    pool->thread_args[i].worker_idx = i;
+    if (pthread_create(&pool->threads[i], NULL, WorkerPoolThread,
+                       &pool->thread_args[i]) != 0)
+      Die("WorkerPoolInit - pthread_create");
+  }
+}
+
+// Runs task(job, i, worker) for every i in [0, n_tasks) and returns once they
+// have all finished
+void WorkerPoolRun(WorkerPool *pool, WorkerTask task, void *job,
+                   size_t n_tasks) {
+  pthread_mutex_lock(&pool->submit_mutex);
+  pthread_mutex_lock(&pool->mutex);
+  pool->task = task;
+  pool->job = job;
+  pool->n_tasks = n_tasks;
+  pool->next_task = 0;
+  pool->n_busy = pool->n_workers - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->job_ready);
+  pthread_mutex_unlock(&pool->mutex);
+  WorkerPoolRunTasks(pool, 0);
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->n_busy > 0) pthread_cond_wait(&pool->job_done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+  pthread_mutex_unlock(&pool->submit_mutex);
+}
+
+void WorkerPoolFree(WorkerPool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->is_running = 0;
+  pthread_cond_broadcast(&pool->job_ready);
+  pthread_mutex_unlock(&pool->mutex);
+  for (size_t i = 1; i < pool->n_workers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+  free(pool->thread_args);
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_mutex_destroy(&pool->submit_mutex);
+  pthread_cond_destroy(&pool->job_ready);
+  pthread_cond_destroy(&pool->job_done);
+}
+
+/*** Partitioned search ***/
+// Each worker keeps its own top-K over the partitions it picks up, and the
+// caller merges them at the end. The union of exact per-partition top-Ks
+// holds the exact global top-K, so this returns the same matches as the
+// single-threaded search.
+typedef struct PartitionedSearch {
+  const SwapTarget *target;
+  const SwapStore *store;
+  const uint64_t *selected;
+  const KdTree *tree;
+  const size_t *subtrees;  // tasks [0, n_subtrees) search one subtree each
+  size_t n_subtrees;
+  size_t scan_begin;  // the other tasks scan [scan_begin, store->size)
+  size_t partition_size;
+  TopK *worker_top_k;
+} PartitionedSearch;
+
+void PartitionedSearchTask(void *job, size_t task_idx, size_t worker_idx) {
+  PartitionedSearch *search = job;
+  TopK *top_k = &search->worker_top_k[worker_idx];
+  if (task_idx < search->n_subtrees) {
+    size_t node_idx = search->subtrees[task_idx];
+    if (KdNodeDistance(search->target, &search->tree->nodes[node_idx]) <=
+        TopKBound(top_k))
+      KdTreeSearchNode(search->tree, node_idx, search->target, search->store,
+                       search->selected, top_k);
+    return;
+  }
+  size_t begin = search->scan_begin +
+                 (task_idx - search->n_subtrees) * search->partition_size;
+  size_t end = min(begin + search->partition_size, search->store->size);
+  TopKScanSelected(search->target, search->store, begin, end,
+                   search->selected, top_k);
+}
+
+// Subtrees to hand out as tasks: split the top of the tree until there are a
+// few per worker, so a subtree that gets pruned early doesn't leave a worker
+// idle. Returns the number written to subtrees.
+size_t KdTreeSubtrees(const KdTree *tree, size_t n_wanted, size_t *subtrees,
+                      size_t max_subtrees) {
+  if (tree->n_nodes == 0) return 0;
+  size_t n_subtrees = 1;
+  subtrees[0] = 0;
+  int split_any = 1;
+  while (n_subtrees < n_wanted && split_any) {
+    split_any = 0;
+    size_t n_current = n_subtrees;
+    for (size_t i = 0; i < n_current && n_subtrees < max_subtrees; i++) {
+      const KdNode *node = &tree->nodes[subtrees[i]];
+      if (node->left == 0) continue;
+      subtrees[i] = node->left;
+      subtrees[n_subtrees++] = node->right;
+      split_any = 1;
+    }
+  }
+  return n_subtrees;
+}
+
+void PartitionedSearchRun(WorkerPool *pool, PartitionedSearch *search,
+                          size_t n_tasks, TopK *top_k) {
+  search->worker_top_k = malloc(pool->n_workers * sizeof(TopK));
+  if (!search->worker_top_k) Die("PartitionedSearchRun - malloc");
+  for (size_t i = 0; i < pool->n_workers; i++) {
+    TopKInit(&search->worker_top_k[i], top_k->k);
+  }
+  WorkerPoolRun(pool, PartitionedSearchTask, search, n_tasks);
+  for (size_t i = 0; i < pool->n_workers; i++) {
+    TopK *worker_top_k = &search->worker_top_k[i];
+    for (size_t j = 0; j < worker_top_k->size; j++) {
+      TopKPush(top_k, worker_top_k->matches[j].row,
+               worker_top_k->matches[j].distance);
+    }
+    TopKFree(worker_top_k);
+  }
+  free(search->worker_top_k);
+}
+
+// TopKScanSelected over the whole store, one partition per task
+void ParallelTopKScan(WorkerPool *pool, size_t partition_size,
+                      const SwapTarget *target, const SwapStore *store,
+                      const uint64_t *selected, TopK *top_k) {
+  if (pool->n_workers == 1 || store->size <= partition_size) {
+    TopKScanSelected(target, store, 0, store->size, selected, top_k);
+    return;
+  }
+  PartitionedSearch search = {0};
+  search.target = target;
+  search.store = store;
+  search.selected = selected;
+  search.partition_size = partition_size;
+  size_t n_partitions = (store->size + partition_size - 1) / partition_size;
+  PartitionedSearchRun(pool, &search, n_partitions, top_k);
+}
+
+#define MAX_SUBTREES_PER_WORKER 8
+
+// KdTreeSearch with the top of the tree split across the workers
+void ParallelKdTreeSearch(WorkerPool *pool, size_t partition_size,
+                          const KdTree *tree, const SwapTarget *target,
+                          const SwapStore *store, const uint64_t *selected,
+                          TopK *top_k) {
+  if (pool->n_workers == 1 || store->size <= partition_size) {
+    KdTreeSearch(tree, target, store, selected, top_k);
+    return;
+  }
+  size_t max_subtrees = MAX_SUBTREES_PER_WORKER * pool->n_workers;
+  size_t *subtrees = malloc(max_subtrees * sizeof(size_t));
+  if (!subtrees) Die("ParallelKdTreeSearch - malloc");
+  PartitionedSearch search = {0};
+  search.target = target;
+  search.store = store;
+  search.selected = selected;
+  search.tree = tree;
+  search.subtrees = subtrees;
+  search.n_subtrees =
+      KdTreeSubtrees(tree, 4 * pool->n_workers, subtrees, max_subtrees);
+  search.scan_begin = tree->n_rows;
+  search.partition_size = partition_size;
+  size_t n_partitions =
+      (store->size - tree->n_rows + partition_size - 1) / partition_size;
+  PartitionedSearchRun(pool, &search, search.n_subtrees + n_partitions,
+                       top_k);
+  free(subtrees);
+}
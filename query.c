@@ -0,0 +1,222 @@
+/*** Search queries ***/
+// A query is a list like "Colname:Value;", with the column names of the .csv
+// header, plus the search options. Shared by the server and the client, which
+// parses queries itself when it talks the binary protocol.
+#include <float.h>
+
+#define MAX_TOP_K 100
+
+// Scan is the brute-force search the index has to agree with, Verify runs
+// both and logs any disagreement
+typedef enum SearchMode { SEARCH_INDEX, SEARCH_SCAN, SEARCH_VERIFY } SearchMode;
+
+// Execution time buckets of AGGREGATE requests
+typedef enum RollupLevel {
+  ROLLUP_HOUR,
+  ROLLUP_MINUTE,
+  N_ROLLUP_LEVELS
+} RollupLevel;
+
+// The numeric columns a query can bound, in the KdDim order
+typedef enum RangeField {
+  RANGE_START_DAY,
+  RANGE_END_DAY,
+  RANGE_TRADE_TIME,
+  RANGE_FIXED_RATE,
+  RANGE_NOTIONAL,
+  N_RANGE_FIELDS
+} RangeField;
+
+// Hard bounds, inclusive and in column units: rows outside them never match,
+// however near. Unbounded sides are at -DBL_MAX and DBL_MAX.
+typedef struct RangeFilter {
+  unsigned fields;  // a bit per RangeField with a bound
+  double min[N_RANGE_FIELDS];
+  double max[N_RANGE_FIELDS];
+} RangeFilter;
+
+typedef struct SearchQuery {
+  Swap swap;
+  size_t k;  // number of nearest swaps to send back
+  SearchMode mode;
+  RangeFilter range;
+  RollupLevel bucket;  // of an AGGREGATE request
+} SearchQuery;
+
+#define TOP_K_ATTR "K"
+#define SEARCH_MODE_ATTR "Mode"
+#define BUCKET_ATTR "Bucket"
+// "<Colname> Min:<value>;" and "<Colname> Max:<value>;" bound the column
+#define RANGE_MIN_SUFFIX " Min"
+#define RANGE_MAX_SUFFIX " Max"
+
+void RangeFilterInit(RangeFilter *range) {
+  range->fields = 0;
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    range->min[field] = -DBL_MAX;
+    range->max[field] = DBL_MAX;
+  }
+}
+
+// Sets the bound an attribute like "Notional Amount 1 Min" stands for,
+// returns 0 if it isn't one. A value that doesn't parse empties the range of
+// its column, so the query matches nothing rather than more than was asked.
+int SetRangeBound(RangeFilter *range, const char *attribute, char *value) {
+  char colname[64];
+  size_t size = strlen(attribute);
+  size_t suffix_size = strlen(RANGE_MIN_SUFFIX);
+  if (size <= suffix_size || size >= sizeof(colname)) return 0;
+  const char *suffix = attribute + size - suffix_size;
+  int is_min = strcmp(suffix, RANGE_MIN_SUFFIX) == 0;
+  if (!is_min && strcmp(suffix, RANGE_MAX_SUFFIX) != 0) return 0;
+  memcpy(colname, attribute, size - suffix_size);
+  colname[size - suffix_size] = '\0';
+  StringView text = ViewFromString(value);
+  int field;
+  double bound_value = 0;
+  int32_t day = 0;
+  int64_t seconds = 0;
+  int failed;
+  // parsed here rather than with AssignSwapValue, which would leave a bad
+  // value as a bound of 0
+  switch (EvaluateColname(colname)) {
+    case START_DATE:
+      field = RANGE_START_DAY;
+      failed = ParseEpochDay(text, &day) != 0;
+      bound_value = day;
+      break;
+    case END_DATE:
+      field = RANGE_END_DAY;
+      failed = ParseEpochDay(text, &day) != 0;
+      bound_value = day;
+      break;
+    case TRADE_TIME:
+      field = RANGE_TRADE_TIME;
+      failed = ParseEpochSeconds(text, &seconds) != 0;
+      bound_value = (double)seconds;
+      break;
+    case FIXED_RATE:
+      field = RANGE_FIXED_RATE;
+      failed = text.size == 0 || ParseNumber(text, &bound_value) != 0;
+      bound_value = (float)bound_value;
+      break;
+    case NOTIONAL:
+      field = RANGE_NOTIONAL;
+      failed = text.size == 0 || ParseNumber(text, &bound_value) != 0;
+      bound_value = (float)bound_value;
+      break;
+    default:
+      return 0;
+  }
+  range->fields |= 1u << field;
+  if (failed) {
+    range->min[field] = DBL_MAX;
+    range->max[field] = -DBL_MAX;
+  } else if (is_min) {
+    range->min[field] = bound_value;
+  } else {
+    range->max[field] = bound_value;
+  }
+  return 1;
+}
+
+// Copy [begin, end) into output without surrounding whitespace, returns 0 if
+// it doesn't fit
+int CopyTrimmed(char *output, size_t output_size, const char *begin,
+                const char *end) {
+  while (begin < end && isspace((unsigned char)*begin)) begin++;
+  while (end > begin && isspace((unsigned char)end[-1])) end--;
+  if ((size_t)(end - begin) >= output_size) return 0;
+  memcpy(output, begin, end - begin);
+  output[end - begin] = '\0';
+  return 1;
+}
+
+// Expect a list to be passed in like "Colname:Value;", with the column names
+// of the .csv header, plus an optional "K:<n>;", range bounds and options
+SearchQuery QueryFromInputLine(const char *input_line) {
+  SearchQuery query = {0};
+  query.k = 1;
+  RangeFilterInit(&query.range);
+  char attribute_buffer[64];
+  char value_buffer[64];
+  const char *begin = input_line;
+  while (*begin != '\0') {
+    const char *end = strchr(begin, ';');
+    if (end == NULL) end = begin + strlen(begin);
+    const char *separator = memchr(begin, ':', end - begin);
+    if (separator != NULL &&
+        CopyTrimmed(attribute_buffer, sizeof(attribute_buffer), begin,
+                    separator) &&
+        CopyTrimmed(value_buffer, sizeof(value_buffer), separator + 1, end)) {
+      if (strcmp(attribute_buffer, TOP_K_ATTR) == 0) {
+        long k = strtol(value_buffer, NULL, 10);
+        query.k = min(max(k, 1), MAX_TOP_K);
+      } else if (strcmp(attribute_buffer, SEARCH_MODE_ATTR) == 0) {
+        if (strcmp(value_buffer, "Scan") == 0) {
+          query.mode = SEARCH_SCAN;
+        } else if (strcmp(value_buffer, "Verify") == 0) {
+          query.mode = SEARCH_VERIFY;
+        } else {
+          query.mode = SEARCH_INDEX;
+        }
+      } else if (strcmp(attribute_buffer, BUCKET_ATTR) == 0) {
+        query.bucket = strcmp(value_buffer, "Minute") == 0 ? ROLLUP_MINUTE
+                                                           : ROLLUP_HOUR;
+      } else if (!SetRangeBound(&query.range, attribute_buffer,
+                                value_buffer)) {
+        AssignSwapValue(&query.swap, EvaluateColname(attribute_buffer),
+                        value_buffer);
+      }
+    }
+    begin = (*end == ';') ? end + 1 : end;
+  }
+  return query;
+}
+
+// "LOOKUP <id> <id>...": the live trades with those Dissemination IDs, ids
+// separated by spaces or commas
+#define LOOKUP_KEYWORD "LOOKUP"
+
+// Parses up to max_ids ids from the line after LOOKUP_KEYWORD, returns how
+// many there were
+size_t IdsFromLookupLine(const char *line, long *ids, size_t max_ids) {
+  const char *cursor = line + strlen(LOOKUP_KEYWORD);
+  size_t n_ids = 0;
+  while (n_ids < max_ids) {
+    while (*cursor == ' ' || *cursor == ',' || *cursor == '\t') cursor++;
+    if (!isdigit((unsigned char)*cursor)) break;
+    char *id_end;
+    ids[n_ids++] = strtol(cursor, &id_end, 10);
+    cursor = id_end;
+  }
+  return n_ids;
+}
+
+// "AGGREGATE <query>": the count, total notional and notional-weighted fixed
+// rate of the live trades by execution time bucket, ref rate and tenor. The
+// query's "Execution Timestamp Min:" and "Max:" bounds give the window,
+// "Bucket:Minute" or "Bucket:Hour" (the default) the bucket size, and a ref
+// rate set in it keeps to that ref rate. A window of more buckets than
+// MAX_AGGREGATE_BUCKETS (a week of minutes) keeps its most recent ones.
+#define AGGREGATE_KEYWORD "AGGREGATE"
+
+// Tenor buckets by the days from Effective to Expiration Date, each up to
+// halfway to the next standard tenor
+typedef struct TenorBucket {
+  const char *name;
+  int32_t max_days;
+} TenorBucket;
+
+#define N_TENOR_BUCKETS 12
+const TenorBucket tenor_buckets[N_TENOR_BUCKETS] = {
+    {"1M", 60},    {"3M", 136},   {"6M", 273},   {"1Y", 547},
+    {"2Y", 912},   {"3Y", 1460},  {"5Y", 2191},  {"7Y", 3104},
+    {"10Y", 4565}, {"15Y", 6391}, {"20Y", 9131}, {"30Y", INT32_MAX}};
+
+uint8_t TenorBucketOf(int32_t start_day, int32_t end_day) {
+  int32_t days = end_day - start_day;
+  uint8_t tenor = 0;
+  while (days > tenor_buckets[tenor].max_days) tenor++;
+  return tenor;
+}
@@ -0,0 +1,127 @@
+/*** Request queue ***/
+// Bounded multi-producer multi-consumer queue of pointers, lock-free on the
+// hot path: each slot carries a sequence number telling producers and
+// consumers whose turn it is (Vyukov's ring buffer), so pushes and pops only
+// contend on a compare-and-swap of the head or tail. Consumers that find it
+// empty sleep on a condition variable, which producers only touch when
+// somebody is asleep.
+#include <stddef.h>
+
+#define QUEUE_CACHE_LINE 64
+
+typedef struct QueueSlot {
+  size_t sequence;
+  void *item;
+} QueueSlot;
+
+typedef struct RequestQueue {
+  QueueSlot *slots;
+  size_t mask;  // capacity - 1, the capacity being a power of 2
+  char pad_0[QUEUE_CACHE_LINE];
+  size_t tail;  // next slot to push to
+  char pad_1[QUEUE_CACHE_LINE];
+  size_t head;  // next slot to pop from
+  char pad_2[QUEUE_CACHE_LINE];
+  size_t n_sleeping;
+  int is_closed;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+} RequestQueue;
+
+// Room for at least depth items
+void RequestQueueInit(RequestQueue *queue, size_t depth) {
+  memset(queue, 0, sizeof(RequestQueue));
+  size_t capacity = 2;
+  while (capacity < depth) capacity *= 2;
+  queue->slots = malloc(capacity * sizeof(QueueSlot));
+  if (!queue->slots) Die("RequestQueueInit - malloc");
+  for (size_t i = 0; i < capacity; i++) queue->slots[i].sequence = i;
+  queue->mask = capacity - 1;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+}
+
+void RequestQueueFree(RequestQueue *queue) {
+  free(queue->slots);
+  pthread_mutex_destroy(&queue->mutex);
+  pthread_cond_destroy(&queue->not_empty);
+}
+
+// Returns 0 on success, -1 when the queue is full
+int RequestQueuePush(RequestQueue *queue, void *item) {
+  size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+  QueueSlot *slot;
+  while (1) {
+    slot = &queue->slots[tail & queue->mask];
+    size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == tail) {
+      if (__atomic_compare_exchange_n(&queue->tail, &tail, tail + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if ((ptrdiff_t)(sequence - tail) < 0) {
+      // the consumer of the last lap hasn't freed this slot yet
+      return -1;
+    } else {
+      tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    }
+  }
+  slot->item = item;
+  __atomic_store_n(&slot->sequence, tail + 1, __ATOMIC_RELEASE);
+  // pairs with the sleeper's increment before it checks the queue again
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&queue->n_sleeping, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&queue->mutex);
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+  }
+  return 0;
+}
+
+// Returns 0 with the oldest item, -1 when the queue is empty
+int RequestQueueTryPop(RequestQueue *queue, void **item) {
+  size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+  QueueSlot *slot;
+  while (1) {
+    slot = &queue->slots[head & queue->mask];
+    size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == head + 1) {
+      if (__atomic_compare_exchange_n(&queue->head, &head, head + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if ((ptrdiff_t)(sequence - (head + 1)) < 0) {
+      return -1;
+    } else {
+      head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    }
+  }
+  *item = slot->item;
+  // free for the producer one lap ahead
+  __atomic_store_n(&slot->sequence, head + queue->mask + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Waits for an item. Returns -1 once the queue is closed and empty.
+int RequestQueuePop(RequestQueue *queue, void **item) {
+  while (RequestQueueTryPop(queue, item) != 0) {
+    pthread_mutex_lock(&queue->mutex);
+    __atomic_fetch_add(&queue->n_sleeping, 1, __ATOMIC_SEQ_CST);
+    // a push that missed the increment is seen here
+    int is_empty = RequestQueueTryPop(queue, item) != 0;
+    if (is_empty && !queue->is_closed)
+      pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    __atomic_fetch_sub(&queue->n_sleeping, 1, __ATOMIC_SEQ_CST);
+    int is_closed = queue->is_closed;
+    pthread_mutex_unlock(&queue->mutex);
+    if (!is_empty) return 0;
+    if (is_closed) return -1;
+  }
+  return 0;
+}
+
+// Wakes every consumer; pops fail once the remaining items are taken
+void RequestQueueClose(RequestQueue *queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->is_closed = 1;
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_mutex_unlock(&queue->mutex);
+}
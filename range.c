@@ -0,0 +1,228 @@
+/*** Range indexes ***/
+// Serve the hard bounds of queries (see RangeFilter). Every bounded column
+// has a sorted index, its rows by increasing value, so the rows within the
+// column's bounds are one run of it, found by binary search. When the
+// narrowest run is a small part of the store, its rows are scored directly:
+// the cost follows the window, not the book. Wider bounds become a selection
+// instead, with zone maps (the min and max of every column over each block of
+// RANGE_ZONE_ROWS rows) ruling whole blocks in or out before any of their
+// rows is looked at. Built after the k-d tree has reordered the rows, so a
+// block holds nearby values and most blocks go one way or the other.
+#define RANGE_ZONE_ROWS 1024     // a multiple of 64, so zones are whole words
+#define RANGE_NARROW_FRACTION 16  // runs under 1/16th of the store are narrow
+
+typedef struct RangeIndex {
+  size_t n_rows;                     // the indexes cover rows [0, n_rows)
+  uint32_t *sorted[N_RANGE_FIELDS];  // rows by increasing value
+  double *zone_min[N_RANGE_FIELDS];  // one per zone
+  double *zone_max[N_RANGE_FIELDS];
+} RangeIndex;
+
+// Rows of a sorted index that are within their column's bounds
+typedef struct RangeRun {
+  const uint32_t *rows;  // NULL when nothing is bounded
+  size_t n_rows;
+} RangeRun;
+
+// How a zone's values sit with respect to the bounds
+typedef enum ZoneOverlap {
+  ZONE_OUTSIDE,
+  ZONE_PARTIAL,
+  ZONE_INSIDE
+} ZoneOverlap;
+
+typedef struct RangeEntry {
+  double value;
+  uint32_t row;
+} RangeEntry;
+
+static inline double RangeValue(const SwapStore *store, size_t row,
+                                int field) {
+  return KdKey(store, row, field);  // RangeField follows the KdDim order
+}
+
+size_t RangeZones(size_t n_rows) {
+  return (n_rows + RANGE_ZONE_ROWS - 1) / RANGE_ZONE_ROWS;
+}
+
+int CompareRangeEntries(const void *a, const void *b) {
+  const RangeEntry *entry_a = a;
+  const RangeEntry *entry_b = b;
+  if (entry_a->value != entry_b->value)
+    return entry_a->value < entry_b->value ? -1 : 1;
+  return (entry_a->row > entry_b->row) - (entry_a->row < entry_b->row);
+}
+
+// Builds the indexes over every row currently in the store, which mustn't be
+// reordered after
+void RangeIndexBuild(RangeIndex *index, const SwapStore *store) {
+  memset(index, 0, sizeof(RangeIndex));
+  index->n_rows = store->size;
+  size_t n_zones = RangeZones(store->size);
+  RangeEntry *entries = malloc(max(store->size, 1) * sizeof(RangeEntry));
+  if (!entries) Die("RangeIndexBuild - malloc");
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    index->sorted[field] = malloc(max(store->size, 1) * sizeof(uint32_t));
+    index->zone_min[field] = malloc(max(n_zones, 1) * sizeof(double));
+    index->zone_max[field] = malloc(max(n_zones, 1) * sizeof(double));
+    if (!index->sorted[field] || !index->zone_min[field] ||
+        !index->zone_max[field])
+      Die("RangeIndexBuild - malloc");
+    for (size_t row = 0; row < store->size; row++) {
+      entries[row].value = RangeValue(store, row, field);
+      entries[row].row = row;
+    }
+    for (size_t zone = 0; zone < n_zones; zone++) {
+      size_t begin = zone * RANGE_ZONE_ROWS;
+      size_t end = min(begin + RANGE_ZONE_ROWS, store->size);
+      double zone_min = entries[begin].value, zone_max = entries[begin].value;
+      for (size_t row = begin + 1; row < end; row++) {
+        zone_min = min(zone_min, entries[row].value);
+        zone_max = max(zone_max, entries[row].value);
+      }
+      index->zone_min[field][zone] = zone_min;
+      index->zone_max[field][zone] = zone_max;
+    }
+    qsort(entries, store->size, sizeof(RangeEntry), CompareRangeEntries);
+    for (size_t i = 0; i < store->size; i++) {
+      index->sorted[field][i] = entries[i].row;
+    }
+  }
+  free(entries);
+}
+
+void RangeIndexFree(RangeIndex *index) {
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    free(index->sorted[field]);
+    free(index->zone_min[field]);
+    free(index->zone_max[field]);
+  }
+  memset(index, 0, sizeof(RangeIndex));
+}
+
+static inline int RangeFilterMatches(const RangeFilter *filter,
+                                     const SwapStore *store, size_t row) {
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    if (!(filter->fields & (1u << field))) continue;
+    double value = RangeValue(store, row, field);
+    if (value < filter->min[field] || value > filter->max[field]) return 0;
+  }
+  return 1;
+}
+
+// Position in the sorted index of field of the first value at or past bound
+// (strictly past it with past_equal)
+size_t RangeIndexSearch(const RangeIndex *index, const SwapStore *store,
+                        int field, double bound, int past_equal) {
+  size_t begin = 0, end = index->n_rows;
+  while (begin < end) {
+    size_t middle = begin + (end - begin) / 2;
+    double value = RangeValue(store, index->sorted[field][middle], field);
+    if (value < bound || (past_equal && value == bound)) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
+
+// The shortest run among the bounded columns
+RangeRun RangeIndexNarrowest(const RangeIndex *index,
+                             const RangeFilter *filter,
+                             const SwapStore *store) {
+  RangeRun run = {NULL, 0};
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    if (!(filter->fields & (1u << field))) continue;
+    size_t begin = RangeIndexSearch(index, store, field, filter->min[field], 0);
+    size_t end = RangeIndexSearch(index, store, field, filter->max[field], 1);
+    end = max(begin, end);
+    if (!run.rows || end - begin < run.n_rows) {
+      run.rows = index->sorted[field] + begin;
+      run.n_rows = end - begin;
+    }
+  }
+  return run;
+}
+
+// Whether scoring the run, and the rows appended past the indexes, beats
+// going through a selection
+int RangeRunIsNarrow(const RangeRun *run, const RangeIndex *index,
+                     const SwapStore *store) {
+  return run->rows &&
+         run->n_rows + (store->size - index->n_rows) <=
+             store->size / RANGE_NARROW_FRACTION;
+}
+
+static inline void RangeScoreRow(const RangeFilter *filter,
+                                 const SwapTarget *target,
+                                 const SwapStore *store,
+                                 const uint64_t *selected, size_t row,
+                                 TopK *top_k) {
+  if (selected && !((selected[row / 64] >> (row % 64)) & 1)) return;
+  if (!RangeFilterMatches(filter, store, row)) return;
+  double distance = SwapRowDistance(target, store, row);
+  if (distance <= TopKBound(top_k)) TopKPush(top_k, row, distance);
+}
+
+// Fills top_k with the nearest rows of the run, and of the rows past the
+// indexes, within the bounds and selected (all rows if NULL)
+void RangeRunScan(const RangeRun *run, const RangeIndex *index,
+                  const RangeFilter *filter, const SwapTarget *target,
+                  const SwapStore *store, const uint64_t *selected,
+                  TopK *top_k) {
+  for (size_t i = 0; i < run->n_rows; i++) {
+    RangeScoreRow(filter, target, store, selected, run->rows[i], top_k);
+  }
+  for (size_t row = index->n_rows; row < store->size; row++) {
+    RangeScoreRow(filter, target, store, selected, row, top_k);
+  }
+}
+
+ZoneOverlap RangeZoneOverlap(const RangeIndex *index,
+                             const RangeFilter *filter, size_t zone) {
+  ZoneOverlap overlap = ZONE_INSIDE;
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    if (!(filter->fields & (1u << field))) continue;
+    double zone_min = index->zone_min[field][zone];
+    double zone_max = index->zone_max[field][zone];
+    if (zone_max < filter->min[field] || zone_min > filter->max[field])
+      return ZONE_OUTSIDE;
+    if (zone_min < filter->min[field] || zone_max > filter->max[field])
+      overlap = ZONE_PARTIAL;
+  }
+  return overlap;
+}
+
+// Clears the rows of [begin, end) outside the bounds out of selected
+void RangeSelectRows(const RangeFilter *filter, const SwapStore *store,
+                     uint64_t *selected, size_t begin, size_t end) {
+  for (size_t row = begin; row < end; row++) {
+    uint64_t bit = (uint64_t)1 << (row % 64);
+    if ((selected[row / 64] & bit) && !RangeFilterMatches(filter, store, row))
+      selected[row / 64] &= ~bit;
+  }
+}
+
+// Clears the rows of the store outside the bounds out of selected (see
+// CategoryIndexSelect), a zone at a time where the zone maps allow. NULL,
+// every row, stays NULL when nothing is bounded.
+uint64_t *RangeIndexSelect(const RangeIndex *index, const RangeFilter *filter,
+                           const SwapStore *store, uint64_t *selected) {
+  if (filter->fields == 0) return selected;
+  if (!selected) selected = BitmapAllRows(store->size);
+  size_t n_zones = RangeZones(index->n_rows);
+  for (size_t zone = 0; zone < n_zones; zone++) {
+    size_t begin = zone * RANGE_ZONE_ROWS;
+    size_t end = min(begin + RANGE_ZONE_ROWS, index->n_rows);
+    ZoneOverlap overlap = RangeZoneOverlap(index, filter, zone);
+    if (overlap == ZONE_INSIDE) continue;
+    if (overlap == ZONE_OUTSIDE && end % 64 == 0) {
+      memset(selected + begin / 64, 0, (end - begin) / 64 * sizeof(uint64_t));
+    } else {
+      RangeSelectRows(filter, store, selected, begin, end);
+    }
+  }
+  RangeSelectRows(filter, store, selected, index->n_rows, store->size);
+  return selected;
+}
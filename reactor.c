@@ -0,0 +1,442 @@
+/*** Event loop ***/
+// One thread multiplexes every client over non-blocking sockets: epoll,
+// edge-triggered, where we have it (Linux) and poll() elsewhere. Each
+// connection buffers what it has read until a whole request is in, and what
+// is left to send until the socket takes it, so a slow client only ever holds
+// up itself. Several loops can serve the same listening socket from their own
+// threads; requests can be answered elsewhere and the responses handed back
+// with EventLoopComplete.
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAVE_EPOLL
+#endif
+
+#define IO_READ_SIZE 4096
+#define MAX_EPOLL_EVENTS 256
+#define MAX_REQUEST_SIZE (1 << 20)  // bytes buffered waiting for one request
+
+typedef struct IOBuffer {
+  char *data;
+  size_t size;
+  size_t capacity;
+} IOBuffer;
+
+void IOBufferReserve(IOBuffer *buffer, size_t extra) {
+  if (buffer->size + extra <= buffer->capacity) return;
+  size_t new_capacity = max(2 * buffer->capacity, buffer->size + extra);
+  buffer->data = realloc(buffer->data, new_capacity);
+  if (!buffer->data) Die("IOBufferReserve - realloc");
+  buffer->capacity = new_capacity;
+}
+
+void IOBufferAppend(IOBuffer *buffer, const char *data, size_t size) {
+  IOBufferReserve(buffer, size);
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+// Drops the first n bytes
+void IOBufferConsume(IOBuffer *buffer, size_t n) {
+  memmove(buffer->data, buffer->data + n, buffer->size - n);
+  buffer->size -= n;
+}
+
+void IOBufferFree(IOBuffer *buffer) {
+  free(buffer->data);
+  memset(buffer, 0, sizeof(IOBuffer));
+}
+
+typedef struct Connection {
+  int fd;
+  unsigned long id;  // tells a reused descriptor from the one answered
+  IOBuffer input;
+  IOBuffer output;
+  size_t n_sent;        // bytes of output already written
+  size_t n_pending;     // responses being prepared elsewhere
+  int at_eof;           // the peer has stopped sending
+  int close_when_sent;  // no more requests, close once they're answered
+  int keep_alive;       // set by the handler: more requests may follow
+  int protocol;         // the handler's, 0 until it sets it
+} Connection;
+
+// A response prepared off the loop's thread, waiting to be sent
+typedef struct Completion {
+  int fd;
+  unsigned long connection_id;
+  IOBuffer output;
+  struct Completion *next;
+} Completion;
+
+typedef struct EventLoop EventLoop;
+
+// Called with what a connection has read so far. Returns the size of the
+// complete request at the front of its input, 0 when more has to be read
+// first (at_eof: nothing more will come). The response is either appended to
+// the connection's output, or prepared elsewhere: the handler then counts it
+// in n_pending and hands it over with EventLoopComplete. The connection is
+// closed after the first response unless the handler sets keep_alive; it can
+// also refuse the input by setting close_when_sent and returning 0.
+typedef size_t (*RequestHandler)(EventLoop *loop, Connection *connection);
+
+struct EventLoop {
+  int listen_fd;
+#ifdef HAVE_EPOLL
+  int epoll_fd;
+#else
+  struct pollfd *poll_fds;
+#endif
+  int wake_fds[2];  // a pipe: a byte written wakes the loop up
+  Connection **connections;  // by file descriptor
+  size_t max_fd;             // size of connections
+  size_t n_connections;
+  unsigned long next_connection_id;
+  pthread_mutex_t completions_mutex;
+  Completion *completions;
+  RequestHandler handler;
+  void *context;  // for the handler
+  int is_running;
+};
+
+int SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Non-blocking listening socket on port, -1 on failure
+int ListenOn(int port, int backlog) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock == -1) return -1;
+  int enable = 1;
+  // restarting shouldn't have to wait for the old connections' TIME_WAIT
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = INADDR_ANY;
+  address.sin_port = htons(port);
+  if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(sock, backlog) < 0 || SetNonBlocking(sock) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+#ifdef HAVE_EPOLL
+int EventLoopWatch(EventLoop *loop, int fd, uint32_t events) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+#endif
+
+void EventLoopInit(EventLoop *loop, int listen_fd, RequestHandler handler,
+                   void *context) {
+  memset(loop, 0, sizeof(EventLoop));
+  loop->listen_fd = listen_fd;
+  loop->handler = handler;
+  loop->context = context;
+  loop->is_running = 1;
+  // a client hanging up mid-response is an error on send, not a signal
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe(loop->wake_fds) < 0 || SetNonBlocking(loop->wake_fds[0]) < 0 ||
+      SetNonBlocking(loop->wake_fds[1]) < 0)
+    Die("EventLoopInit - pipe");
+  pthread_mutex_init(&loop->completions_mutex, NULL);
+#ifdef HAVE_EPOLL
+  loop->epoll_fd = epoll_create1(0);
+  if (loop->epoll_fd < 0) Die("EventLoopInit - epoll_create1");
+  uint32_t listen_events = EPOLLIN | EPOLLET;
+#ifdef EPOLLEXCLUSIVE
+  // with several loops on the socket, wake one of them per connection
+  listen_events |= EPOLLEXCLUSIVE;
+#endif
+  if (EventLoopWatch(loop, listen_fd, listen_events) < 0 ||
+      EventLoopWatch(loop, loop->wake_fds[0], EPOLLIN | EPOLLET) < 0)
+    Die("EventLoopInit - epoll_ctl");
+#endif
+}
+
+// Safe from any thread
+void EventLoopWake(EventLoop *loop) {
+  char byte = 0;
+  // a full pipe already has the loop woken up
+  if (write(loop->wake_fds[1], &byte, 1) < 0 && errno != EAGAIN)
+    perror("EventLoopWake - write");
+}
+
+// Makes EventLoopRun return, safe from any thread
+void EventLoopStop(EventLoop *loop) {
+  __atomic_store_n(&loop->is_running, 0, __ATOMIC_RELEASE);
+  EventLoopWake(loop);
+}
+
+int EventLoopIsRunning(EventLoop *loop) {
+  return __atomic_load_n(&loop->is_running, __ATOMIC_ACQUIRE);
+}
+
+// Hands a response prepared for a connection back to its loop, which takes
+// the output buffer over. Safe from any thread.
+void EventLoopComplete(EventLoop *loop, int fd, unsigned long connection_id,
+                       IOBuffer *output) {
+  Completion *completion = malloc(sizeof(Completion));
+  if (!completion) Die("EventLoopComplete - malloc");
+  completion->fd = fd;
+  completion->connection_id = connection_id;
+  completion->output = *output;
+  memset(output, 0, sizeof(IOBuffer));
+  pthread_mutex_lock(&loop->completions_mutex);
+  completion->next = loop->completions;
+  loop->completions = completion;
+  pthread_mutex_unlock(&loop->completions_mutex);
+  EventLoopWake(loop);
+}
+
+void EventLoopClose(EventLoop *loop, Connection *connection) {
+  // closing the descriptor also takes it out of the epoll set
+  close(connection->fd);
+  loop->connections[connection->fd] = NULL;
+  loop->n_connections--;
+  IOBufferFree(&connection->input);
+  IOBufferFree(&connection->output);
+  free(connection);
+}
+
+void EventLoopAdd(EventLoop *loop, int fd) {
+  if ((size_t)fd >= loop->max_fd) {
+    size_t new_max_fd = max(2 * loop->max_fd, (size_t)fd + 1);
+    loop->connections =
+        realloc(loop->connections, new_max_fd * sizeof(Connection *));
+    if (!loop->connections) Die("EventLoopAdd - realloc");
+    memset(loop->connections + loop->max_fd, 0,
+           (new_max_fd - loop->max_fd) * sizeof(Connection *));
+    loop->max_fd = new_max_fd;
+  }
+  Connection *connection = calloc(1, sizeof(Connection));
+  if (!connection) Die("EventLoopAdd - calloc");
+  connection->fd = fd;
+  connection->id = loop->next_connection_id++;
+  loop->connections[fd] = connection;
+  loop->n_connections++;
+#ifdef HAVE_EPOLL
+  // both directions once and for all: edge-triggered, we're told about each
+  // new batch of input and each time the send buffer frees up
+  if (EventLoopWatch(loop, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) < 0)
+    EventLoopClose(loop, connection);
+#endif
+}
+
+// Takes every pending connection
+void EventLoopAccept(EventLoop *loop) {
+  while (1) {
+    int fd = accept(loop->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      // EAGAIN once the backlog is empty; on running out of descriptors the
+      // rest wait in the backlog until the next connection comes in
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+      return;
+    }
+    int enable = 1;
+    // responses go out in one piece, don't hold them back for more
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (SetNonBlocking(fd) < 0) {
+      close(fd);
+      continue;
+    }
+    EventLoopAdd(loop, fd);
+  }
+}
+
+// Sends until the output is out or the socket is full. Returns -1 if the
+// connection failed.
+int ConnectionFlush(Connection *connection) {
+  IOBuffer *output = &connection->output;
+  while (connection->n_sent < output->size) {
+    ssize_t n_sent = send(connection->fd, output->data + connection->n_sent,
+                          output->size - connection->n_sent, 0);
+    if (n_sent < 0) {
+      if (errno == EINTR) continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    connection->n_sent += n_sent;
+  }
+  output->size = connection->n_sent = 0;
+  return 0;
+}
+
+// Reads until the socket is drained or MAX_REQUEST_SIZE bytes are waiting.
+// Returns -1 if the connection failed, 1 if it stopped on a full buffer.
+int ConnectionFill(Connection *connection) {
+  while (!connection->at_eof && connection->input.size < MAX_REQUEST_SIZE) {
+    IOBufferReserve(&connection->input, IO_READ_SIZE);
+    IOBuffer *input = &connection->input;
+    ssize_t n_read = read(connection->fd, input->data + input->size,
+                          input->capacity - input->size);
+    if (n_read < 0) {
+      if (errno == EINTR) continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (n_read == 0) connection->at_eof = 1;
+    input->size += n_read;
+  }
+  return connection->at_eof ? 0 : 1;
+}
+
+// Sends what it can, and closes the connection once its response is out
+void EventLoopFlush(EventLoop *loop, Connection *connection) {
+  if (ConnectionFlush(connection) < 0 ||
+      (connection->close_when_sent && connection->n_pending == 0 &&
+       connection->output.size == 0))
+    EventLoopClose(loop, connection);
+}
+
+// Hands the complete requests at the front of the input to the handler
+void EventLoopHandle(EventLoop *loop, Connection *connection) {
+  while (!connection->close_when_sent && connection->input.size > 0) {
+    size_t request_size = loop->handler(loop, connection);
+    if (request_size == 0) break;
+    IOBufferConsume(&connection->input, request_size);
+    // without keep_alive, closing is how the client knows the response ended
+    if (!connection->keep_alive) connection->close_when_sent = 1;
+  }
+}
+
+// Reads, answers the requests that are complete and sends what it can
+void EventLoopService(EventLoop *loop, Connection *connection) {
+  int fill_result = 1;
+  while (!connection->close_when_sent && fill_result == 1) {
+    // on a full buffer, the rest is read once requests have made room
+    size_t input_size = connection->input.size;
+    fill_result = ConnectionFill(connection);
+    if (fill_result < 0) {
+      EventLoopClose(loop, connection);
+      return;
+    }
+    EventLoopHandle(loop, connection);
+    if (fill_result == 1 && connection->input.size >= input_size) break;
+  }
+  if (!connection->close_when_sent &&
+      (connection->at_eof || connection->input.size >= MAX_REQUEST_SIZE)) {
+    if (connection->input.size > 0) {
+      // hung up halfway through a request, or sent more than one can be
+      EventLoopClose(loop, connection);
+      return;
+    }
+    // done sending requests, close once they are answered
+    connection->close_when_sent = 1;
+  }
+  EventLoopFlush(loop, connection);
+}
+
+// Sends the responses handed back since the last wake up
+void EventLoopDeliver(EventLoop *loop) {
+  char bytes[64];
+  while (read(loop->wake_fds[0], bytes, sizeof(bytes)) > 0) continue;
+  pthread_mutex_lock(&loop->completions_mutex);
+  Completion *completion = loop->completions;
+  loop->completions = NULL;
+  pthread_mutex_unlock(&loop->completions_mutex);
+  while (completion) {
+    Completion *next = completion->next;
+    Connection *connection = (size_t)completion->fd < loop->max_fd
+                                 ? loop->connections[completion->fd]
+                                 : NULL;
+    if (connection && connection->id == completion->connection_id) {
+      IOBufferAppend(&connection->output, completion->output.data,
+                     completion->output.size);
+      connection->n_pending--;
+      EventLoopFlush(loop, connection);
+    }
+    IOBufferFree(&completion->output);
+    free(completion);
+    completion = next;
+  }
+}
+
+#ifdef HAVE_EPOLL
+void EventLoopWait(EventLoop *loop) {
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  int n_events = epoll_wait(loop->epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+  if (n_events < 0) {
+    if (errno != EINTR) Die("EventLoopWait - epoll_wait");
+    return;
+  }
+  for (int i = 0; i < n_events && EventLoopIsRunning(loop); i++) {
+    int fd = events[i].data.fd;
+    if (fd == loop->listen_fd) {
+      EventLoopAccept(loop);
+    } else if (fd == loop->wake_fds[0]) {
+      EventLoopDeliver(loop);
+    } else if (loop->connections[fd]) {
+      EventLoopService(loop, loop->connections[fd]);
+    }
+  }
+}
+#else
+// Level-triggered: only ask for POLLOUT while there is something to send
+void EventLoopWait(EventLoop *loop) {
+  loop->poll_fds = realloc(loop->poll_fds,
+                           (loop->n_connections + 2) * sizeof(struct pollfd));
+  if (!loop->poll_fds) Die("EventLoopWait - realloc");
+  size_t n_fds = 0;
+  loop->poll_fds[n_fds].fd = loop->listen_fd;
+  loop->poll_fds[n_fds++].events = POLLIN;
+  loop->poll_fds[n_fds].fd = loop->wake_fds[0];
+  loop->poll_fds[n_fds++].events = POLLIN;
+  for (size_t fd = 0; fd < loop->max_fd; fd++) {
+    Connection *connection = loop->connections[fd];
+    if (!connection) continue;
+    loop->poll_fds[n_fds].fd = fd;
+    loop->poll_fds[n_fds++].events =
+        (connection->close_when_sent ? 0 : POLLIN) |
+        (connection->output.size > 0 ? POLLOUT : 0);
+  }
+  if (poll(loop->poll_fds, n_fds, -1) < 0) {
+    if (errno != EINTR) Die("EventLoopWait - poll");
+    return;
+  }
+  for (size_t i = 2; i < n_fds && EventLoopIsRunning(loop); i++) {
+    if (loop->poll_fds[i].revents != 0)
+      EventLoopService(loop, loop->connections[loop->poll_fds[i].fd]);
+  }
+  if (loop->poll_fds[1].revents & POLLIN) EventLoopDeliver(loop);
+  if (EventLoopIsRunning(loop) && (loop->poll_fds[0].revents & POLLIN))
+    EventLoopAccept(loop);
+}
+#endif
+
+// Serves until EventLoopStop
+void EventLoopRun(EventLoop *loop) {
+  while (EventLoopIsRunning(loop)) EventLoopWait(loop);
+}
+
+// Closes every connection. The listening socket belongs to the caller, and
+// nothing may call EventLoopComplete any more.
+void EventLoopFree(EventLoop *loop) {
+  for (size_t fd = 0; fd < loop->max_fd; fd++) {
+    if (loop->connections[fd]) EventLoopClose(loop, loop->connections[fd]);
+  }
+  free(loop->connections);
+  while (loop->completions) {
+    Completion *next = loop->completions->next;
+    IOBufferFree(&loop->completions->output);
+    free(loop->completions);
+    loop->completions = next;
+  }
+  pthread_mutex_destroy(&loop->completions_mutex);
+  close(loop->wake_fds[0]);
+  close(loop->wake_fds[1]);
+#ifdef HAVE_EPOLL
+  close(loop->epoll_fd);
+#else
+  free(loop->poll_fds);
+#endif
+}
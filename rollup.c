@@ -0,0 +1,344 @@
+/*** Rollups ***/
+// Count, total notional and notional-weighted fixed rate of the live trades
+// by execution time bucket (an hour and a minute, see RollupLevel), ref rate
+// and tenor bucket, for AGGREGATE requests. They follow the trades as they go
+// live, are cancelled or are corrected (see SwapBookApplyEvents). Only the
+// buckets trades went into are kept, in an open addressing hash table (as in
+// idindex.c) that the tail thread updates while requests read it, under the
+// mutex. A timeline per level lists those buckets in time order, with the
+// ref rates and tenors each has keys for, so a request only probes the keys
+// there are in its window rather than every one it could hold. Trades
+// without an execution time are left out.
+#include <pthread.h>
+
+#define MIN_ROLLUP_TABLE_SIZE 1024
+#define MAX_AGGREGATE_BUCKETS 10080  // a week of minutes
+#define ROLLUP_NO_KEY UINT64_MAX     // never a key, see RollupKey
+
+const int64_t rollup_seconds[N_ROLLUP_LEVELS] = {60 * 60, 60};
+
+typedef struct RollupStats {
+  int64_t count;
+  double notional;
+  double rate_notional;  // sum of fixed rate * notional
+} RollupStats;
+
+typedef struct RollupSlot {
+  uint64_t key;  // ROLLUP_NO_KEY for an empty slot
+  RollupStats stats;
+} RollupSlot;
+
+// A time bucket with keys, and a bit per ref rate and tenor it has one for
+// (see RollupComboBit)
+typedef struct RollupBucketKeys {
+  int64_t bucket;
+  uint64_t combos;
+} RollupBucketKeys;
+
+typedef struct RollupTimeline {
+  RollupBucketKeys *buckets;  // by bucket
+  size_t size;
+  size_t capacity;
+} RollupTimeline;
+
+typedef struct Rollups {
+  pthread_mutex_t mutex;
+  RollupSlot *slots;  // NULL until initialised
+  size_t mask;        // table size - 1
+  size_t n_keys;
+  int64_t min_time;  // of every trade added, they bound open windows
+  int64_t max_time;
+  RollupTimeline timelines[N_ROLLUP_LEVELS];
+  int has_timelines;  // new keys go in the timelines, see RollupsBuild
+} Rollups;
+
+// A bucket of an AGGREGATE answer
+typedef struct RollupRow {
+  int64_t bucket_start;
+  uint8_t ref_rate;
+  uint8_t tenor;
+  RollupStats stats;
+} RollupRow;
+
+static inline int64_t RollupBucket(int64_t time, RollupLevel level) {
+  int64_t bucket = time / rollup_seconds[level];
+  return bucket * rollup_seconds[level] > time ? bucket - 1 : bucket;
+}
+
+// The level takes 4 bits and is never 15, so no key is ROLLUP_NO_KEY
+static inline uint64_t RollupKey(RollupLevel level, int64_t bucket,
+                                 uint8_t ref_rate, uint8_t tenor) {
+  return (uint64_t)bucket << 16 | (uint64_t)level << 12 |
+         (uint64_t)ref_rate << 4 | tenor;
+}
+
+// The ref rates requests can ask for times the tenors fit in 64 bits. Keys of
+// other ref rates have no bit, as no request reads them.
+static inline uint64_t RollupComboBit(uint8_t ref_rate, uint8_t tenor) {
+  size_t combo = (size_t)ref_rate * N_TENOR_BUCKETS + tenor;
+  return combo < 64 ? (uint64_t)1 << combo : 0;
+}
+
+void RollupsAllocTable(Rollups *rollups, size_t size) {
+  rollups->slots = malloc(size * sizeof(RollupSlot));
+  if (!rollups->slots) Die("RollupsAllocTable - malloc");
+  memset(rollups->slots, 0, size * sizeof(RollupSlot));
+  for (size_t slot = 0; slot < size; slot++) {
+    rollups->slots[slot].key = ROLLUP_NO_KEY;
+  }
+  rollups->mask = size - 1;
+  rollups->n_keys = 0;
+}
+
+void RollupsInit(Rollups *rollups) {
+  if (pthread_mutex_init(&rollups->mutex, NULL) != 0)
+    Die("RollupsInit - pthread_mutex_init");
+  RollupsAllocTable(rollups, MIN_ROLLUP_TABLE_SIZE);
+  rollups->min_time = INT64_MAX;
+  rollups->max_time = INT64_MIN;
+}
+
+void RollupsFree(Rollups *rollups) {
+  if (!rollups->slots) return;
+  pthread_mutex_destroy(&rollups->mutex);
+  free(rollups->slots);
+  for (int level = 0; level < N_ROLLUP_LEVELS; level++) {
+    free(rollups->timelines[level].buckets);
+  }
+  memset(rollups, 0, sizeof(Rollups));
+}
+
+void RollupTimelineReserve(RollupTimeline *timeline, size_t size) {
+  if (size <= timeline->capacity) return;
+  timeline->capacity = max(2 * timeline->capacity, max(size, (size_t)64));
+  timeline->buckets = realloc(timeline->buckets,
+                              timeline->capacity * sizeof(RollupBucketKeys));
+  if (!timeline->buckets) Die("RollupTimelineReserve - realloc");
+}
+
+// Adds a key to the timeline. Trades mostly come in time order, so the
+// bucket is looked for from the end, and is mostly the last one or new.
+void RollupTimelineAdd(RollupTimeline *timeline, int64_t bucket,
+                       uint64_t combo_bit) {
+  size_t idx = timeline->size;
+  while (idx > 0 && timeline->buckets[idx - 1].bucket > bucket) idx--;
+  if (idx > 0 && timeline->buckets[idx - 1].bucket == bucket) {
+    timeline->buckets[idx - 1].combos |= combo_bit;
+    return;
+  }
+  RollupTimelineReserve(timeline, timeline->size + 1);
+  memmove(&timeline->buckets[idx + 1], &timeline->buckets[idx],
+          (timeline->size - idx) * sizeof(RollupBucketKeys));
+  timeline->buckets[idx].bucket = bucket;
+  timeline->buckets[idx].combos = combo_bit;
+  timeline->size++;
+}
+
+// First entry of the timeline at or after bucket
+size_t RollupTimelineFind(const RollupTimeline *timeline, int64_t bucket) {
+  size_t lo = 0, hi = timeline->size;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (timeline->buckets[mid].bucket < bucket) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int CompareRollupBuckets(const void *a, const void *b) {
+  const RollupBucketKeys *keys_a = a;
+  const RollupBucketKeys *keys_b = b;
+  return (keys_a->bucket > keys_b->bucket) - (keys_a->bucket < keys_b->bucket);
+}
+
+// The timelines of every key in the table, sorted once rather than kept in
+// order one key at a time, as the rows of a book come in any order
+void RollupsBuildTimelines(Rollups *rollups) {
+  for (size_t slot = 0; slot <= rollups->mask; slot++) {
+    uint64_t key = rollups->slots[slot].key;
+    if (key == ROLLUP_NO_KEY) continue;
+    RollupTimeline *timeline = &rollups->timelines[key >> 12 & 0xf];
+    RollupTimelineReserve(timeline, timeline->size + 1);
+    RollupBucketKeys *keys = &timeline->buckets[timeline->size++];
+    keys->bucket = (int64_t)key >> 16;
+    keys->combos = RollupComboBit(key >> 4 & 0xff, key & 0xf);
+  }
+  for (int level = 0; level < N_ROLLUP_LEVELS; level++) {
+    RollupTimeline *timeline = &rollups->timelines[level];
+    qsort(timeline->buckets, timeline->size, sizeof(RollupBucketKeys),
+          CompareRollupBuckets);
+    // one entry per bucket
+    size_t n_buckets = 0;
+    for (size_t i = 0; i < timeline->size; i++) {
+      if (n_buckets > 0 &&
+          timeline->buckets[n_buckets - 1].bucket ==
+              timeline->buckets[i].bucket) {
+        timeline->buckets[n_buckets - 1].combos |=
+            timeline->buckets[i].combos;
+      } else {
+        timeline->buckets[n_buckets++] = timeline->buckets[i];
+      }
+    }
+    timeline->size = n_buckets;
+  }
+  rollups->has_timelines = 1;
+}
+
+// The stats of key, NULL if it has none. The caller holds the mutex.
+const RollupStats *RollupsFind(const Rollups *rollups, uint64_t key) {
+  size_t slot = IdHash((long)key) & rollups->mask;
+  for (;; slot = (slot + 1) & rollups->mask) {
+    const RollupSlot *this_slot = &rollups->slots[slot];
+    if (this_slot->key == key) return &this_slot->stats;
+    if (this_slot->key == ROLLUP_NO_KEY) return NULL;
+  }
+}
+
+// The stats of key, inserted if it isn't there yet. The caller holds the
+// mutex, and makes sure there is room.
+RollupStats *RollupsSlot(Rollups *rollups, uint64_t key) {
+  size_t slot = IdHash((long)key) & rollups->mask;
+  for (;; slot = (slot + 1) & rollups->mask) {
+    RollupSlot *this_slot = &rollups->slots[slot];
+    if (this_slot->key == key) return &this_slot->stats;
+    if (this_slot->key == ROLLUP_NO_KEY) {
+      this_slot->key = key;
+      rollups->n_keys++;
+      return &this_slot->stats;
+    }
+  }
+}
+
+void RollupsGrow(Rollups *rollups) {
+  RollupSlot *slots = rollups->slots;
+  size_t size = rollups->mask + 1;
+  RollupsAllocTable(rollups, 2 * size);
+  for (size_t slot = 0; slot < size; slot++) {
+    if (slots[slot].key != ROLLUP_NO_KEY)
+      *RollupsSlot(rollups, slots[slot].key) = slots[slot].stats;
+  }
+  free(slots);
+}
+
+// Adds row of the store to its buckets, or takes it back out of them with a
+// sign of -1. The caller holds the mutex.
+void RollupsAddRow(Rollups *rollups, const SwapStore *store, size_t row,
+                   int sign) {
+  int64_t time = store->trade_time[row];
+  if (time == 0) return;
+  uint8_t tenor = TenorBucketOf(store->start_day[row], store->end_day[row]);
+  double notional = store->notional[row];
+  double rate_notional = notional * store->fixed_rate[row];
+  for (int level = 0; level < N_ROLLUP_LEVELS; level++) {
+    if (2 * (rollups->n_keys + 1) > rollups->mask + 1) RollupsGrow(rollups);
+    int64_t bucket = RollupBucket(time, level);
+    uint64_t key = RollupKey(level, bucket, store->ref_rate[row], tenor);
+    size_t n_keys = rollups->n_keys;
+    RollupStats *stats = RollupsSlot(rollups, key);
+    if (rollups->n_keys > n_keys && rollups->has_timelines)
+      RollupTimelineAdd(&rollups->timelines[level], bucket,
+                        RollupComboBit(store->ref_rate[row], tenor));
+    stats->count += sign;
+    // exact zeros once the bucket is empty again
+    stats->notional =
+        stats->count == 0 ? 0 : stats->notional + sign * notional;
+    stats->rate_notional =
+        stats->count == 0 ? 0 : stats->rate_notional + sign * rate_notional;
+  }
+  if (sign > 0) {
+    rollups->min_time = min(rollups->min_time, time);
+    rollups->max_time = max(rollups->max_time, time);
+  }
+}
+
+// Starts the rollups over, with rows [0, n_rows) of the store as the live
+// trades
+void RollupsBuild(Rollups *rollups, const SwapStore *store, size_t n_rows) {
+  RollupsFree(rollups);
+  RollupsInit(rollups);
+  for (size_t row = 0; row < n_rows; row++) {
+    RollupsAddRow(rollups, store, row, 1);
+  }
+  RollupsBuildTimelines(rollups);
+}
+
+// Adds (sign 1) or takes out (sign -1) a live trade, alongside RollupsQuery
+void RollupsUpdate(Rollups *rollups, const SwapStore *store, size_t row,
+                   int sign) {
+  pthread_mutex_lock(&rollups->mutex);
+  RollupsAddRow(rollups, store, row, sign);
+  pthread_mutex_unlock(&rollups->mutex);
+}
+
+// The non-empty buckets within the query's window, by time then ref rate and
+// tenor, into *rows (malloc'd, NULL when there are none). The window is cut
+// to the trades there are, and to its last MAX_AGGREGATE_BUCKETS buckets, so
+// an open window shows the most recent trades. Returns the number of rows.
+size_t RollupsQuery(const Rollups *rollups, const SearchQuery *query,
+                    RollupRow **rows) {
+  // the mutex is all that changes
+  pthread_mutex_t *mutex = (pthread_mutex_t *)&rollups->mutex;
+  RollupLevel level = query->bucket;
+  const RangeFilter *range = &query->range;
+  int is_bounded = range->fields & (1u << RANGE_TRADE_TIME);
+  int n_ref_rates = category_n_values[CATEGORY_REF_RATE];
+  // out of range values pin nothing, as in CategoryIndexSelect
+  int pinned_ref_rate =
+      (int)query->swap.ref_rate < n_ref_rates ? (int)query->swap.ref_rate : 0;
+  uint64_t wanted_combos = UINT64_MAX;
+  if (pinned_ref_rate != 0) {
+    wanted_combos = 0;
+    for (int tenor = 0; tenor < N_TENOR_BUCKETS; tenor++) {
+      wanted_combos |= RollupComboBit(pinned_ref_rate, tenor);
+    }
+  }
+  size_t n_rows = 0, capacity = 0;
+  *rows = NULL;
+  // an empty window (see SetRangeBound) is out of int64_t range
+  if (is_bounded &&
+      range->min[RANGE_TRADE_TIME] > range->max[RANGE_TRADE_TIME])
+    return 0;
+  pthread_mutex_lock(mutex);
+  int64_t begin = rollups->min_time;
+  int64_t end = rollups->max_time;
+  if (is_bounded && range->min[RANGE_TRADE_TIME] > begin)
+    begin = (int64_t)range->min[RANGE_TRADE_TIME];
+  if (is_bounded && range->max[RANGE_TRADE_TIME] < end)
+    end = (int64_t)range->max[RANGE_TRADE_TIME];
+  int64_t first_bucket = RollupBucket(begin, level);
+  int64_t last_bucket = RollupBucket(end, level);
+  if (begin > end) last_bucket = first_bucket - 1;
+  first_bucket = max(first_bucket, last_bucket - MAX_AGGREGATE_BUCKETS + 1);
+  const RollupTimeline *timeline = &rollups->timelines[level];
+  for (size_t idx = RollupTimelineFind(timeline, first_bucket);
+       idx < timeline->size && timeline->buckets[idx].bucket <= last_bucket;
+       idx++) {
+    int64_t bucket = timeline->buckets[idx].bucket;
+    // the bits go by ref rate then tenor
+    uint64_t combos = timeline->buckets[idx].combos & wanted_combos;
+    while (combos != 0) {
+      int combo = __builtin_ctzll(combos);
+      combos &= combos - 1;
+      uint8_t ref_rate = combo / N_TENOR_BUCKETS;
+      uint8_t tenor = combo % N_TENOR_BUCKETS;
+      const RollupStats *stats =
+          RollupsFind(rollups, RollupKey(level, bucket, ref_rate, tenor));
+      if (!stats || stats->count == 0) continue;
+      if (n_rows == capacity) {
+        capacity = max(2 * capacity, (size_t)64);
+        *rows = realloc(*rows, capacity * sizeof(RollupRow));
+        if (!*rows) Die("RollupsQuery - realloc");
+      }
+      RollupRow *this_row = &(*rows)[n_rows++];
+      this_row->bucket_start = bucket * rollup_seconds[level];
+      this_row->ref_rate = ref_rate;
+      this_row->tenor = tenor;
+      this_row->stats = *stats;
+    }
+  }
+  pthread_mutex_unlock(mutex);
+  return n_rows;
+}
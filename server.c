@@ -1,116 +1,36 @@
 /*** Includes ***/
+#define _GNU_SOURCE
 #include <netinet/in.h>
 #include <stdio.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "common.c"
+#include "query.c"
+#include "csv.c"
+#include "store.c"
+#include "kernel.c"
+#include "tokenize.c"
+#include "topk.c"
+#include "bitmap.c"
+#include "kdtree.c"
+#include "range.c"
+#include "idindex.c"
+#include "rollup.c"
+#include "book.c"
+#include "pool.c"
+#include "ingest.c"
+#include "snapshot.c"
+#include "batch.c"
+#include "queue.c"
+#include "frame.c"
+#include "wire.c"
+#include "reactor.c"
+#include "cache.c"
+#include "tail.c"
 #define global static
 #define local_persist static
 
-typedef struct SwapList {
-  size_t size;
-  Swap *contents;
-} SwapList;
-
-double TmDateDistance(const struct tm *tm_1, const struct tm *tm_2) {
-  double year_distance = abs(tm_1->tm_year - tm_2->tm_year) * 365;
-  double month_distance = abs(tm_1->tm_mon - tm_2->tm_mon) * 30;
-  double day_distance = abs(tm_1->tm_mday - tm_2->tm_mday);
-  return year_distance + month_distance + day_distance;
-}
-
-double TmDatetimeDistance(const struct tm *tm_1, const struct tm *tm_2) {
-  double day_distance = TmDateDistance(tm_1, tm_2) * 24 * 60 * 60;
-  double hour_distance = abs(tm_1->tm_hour - tm_2->tm_hour) * 60 * 60;
-  double minute_distance = abs(tm_1->tm_min - tm_2->tm_min) * 60;
-  double second_distance = abs(tm_1->tm_sec - tm_2->tm_sec);
-  return day_distance + hour_distance + minute_distance + second_distance;
-}
-
-typedef struct SwapDistanceCoordinates {
-  double start_distance;
-  double start_weight;
-  double end_distance;
-  double end_weight;
-  double trade_time_distance;
-  double trade_time_weight;
-  double fixed_rate_distance;
-  double fixed_rate_weight;
-  double notional_distance;
-  double notional_weight;
-  double ref_rate_distance;
-  double ref_rate_weight;
-  double fixed_freq_distance;
-  double fixed_freq_weight;
-  double float_freq_distance;
-  double float_freq_weight;
-} SwapDistanceCoordinates;
-
-SwapDistanceCoordinates GetSwapDistanceCoordinates(const Swap swap_1,
-                                                   const Swap swap_2) {
-  SwapDistanceCoordinates swap_distance;
-  swap_distance.start_distance =
-      TmDateDistance(&(swap_1.start_date), &(swap_2.start_date));
-  swap_distance.end_distance =
-      TmDateDistance(&(swap_1.end_date), &(swap_2.end_date));
-  swap_distance.trade_time_distance =
-      TmDatetimeDistance(&(swap_1.trade_time), &(swap_2.trade_time));
-  swap_distance.fixed_rate_distance =
-      abs(swap_1.fixed_rate - swap_2.fixed_rate);
-  swap_distance.notional_distance = abs(swap_1.notional - swap_2.notional);
-  swap_distance.ref_rate_distance =
-      (swap_1.ref_rate == swap_2.ref_rate) ? 0 : 1;
-  swap_distance.fixed_freq_distance =
-      (swap_1.fixed_pay_freq == swap_2.fixed_pay_freq) ? 0 : 1;
-  swap_distance.float_freq_distance =
-      (swap_1.float_pay_freq == swap_2.float_pay_freq) ? 0 : 1;
-  return swap_distance;
-}
-
-void InitSwapDistanceCoordinatesWeights(
-    SwapDistanceCoordinates *swap_distance, double start_weight,
-    double end_weight, double trade_time_weight, double fixed_rate_weight,
-    double notional_weight, double ref_rate_weight, double fixed_freq_weight,
-    double float_freq_weight) {
-  swap_distance->start_weight = start_weight;
-  swap_distance->end_weight = end_weight;
-  swap_distance->trade_time_weight = trade_time_weight;
-  swap_distance->fixed_rate_weight = fixed_rate_weight;
-  swap_distance->notional_weight = notional_weight;
-  swap_distance->ref_rate_weight = ref_rate_weight;
-  swap_distance->fixed_freq_weight = fixed_freq_weight;
-  swap_distance->float_freq_weight = float_freq_weight;
-}
-
-double L2Distance(SwapDistanceCoordinates swap_distance) {
-  return swap_distance.start_distance * swap_distance.start_distance *
-             swap_distance.start_weight +
-         swap_distance.end_distance * swap_distance.end_distance *
-             swap_distance.end_weight +
-         swap_distance.trade_time_distance * swap_distance.trade_time_distance *
-             swap_distance.trade_time_weight +
-         swap_distance.fixed_rate_distance * swap_distance.fixed_rate_distance *
-             swap_distance.fixed_rate_weight +
-         swap_distance.notional_distance * swap_distance.notional_distance *
-             swap_distance.notional_weight;
-}
-
-double L1Distance(SwapDistanceCoordinates swap_distance) {
-  return swap_distance.start_distance * swap_distance.start_weight +
-         swap_distance.end_distance * swap_distance.end_distance +
-         swap_distance.trade_time_distance * swap_distance.trade_time_weight +
-         swap_distance.fixed_rate_distance * swap_distance.fixed_rate_distance +
-         swap_distance.notional_distance * swap_distance.notional_weight;
-}
-
-void InitSwapDistanceCoordinatesDefaultWeights(
-    SwapDistanceCoordinates *distance_struct) {
-  InitSwapDistanceCoordinatesWeights(distance_struct, 1.0 / 365.0, 1.0 / 365.0,
-                                     1.0 / (365.0 * 24 * 60 * 60), 100,
-                                     1.0 / (10000000), 0, 0, 0);
-}
-
 /*** Parsing utils ***/
 Swap ListStringToSwap(const char *input, size_t input_size) {
   // Expect a list to be passed in like "Colname:Value;"
@@ -145,232 +65,1158 @@ Swap ListStringToSwap(const char *input, size_t input_size) {
   return swap;
 }
 
-void SwapToListString(StringBuffer *output_string, Swap *swap_p) {
-  char value_buffer[64];
-  sprintf(value_buffer, "ID:%ld;", swap_p->id);
-  StringAppend(output_string, value_buffer);
-  StringAppend(output_string, "StartDate:");
-  DateFromTm(value_buffer, swap_p->start_date);
-  StringAppend(output_string, value_buffer);
-  StringAppend(output_string, ";");
-  StringAppend(output_string, "EndDate:");
-  DateFromTm(value_buffer, swap_p->end_date);
-  StringAppend(output_string, value_buffer);
-  StringAppend(output_string, ";");
-  sprintf(value_buffer, "FixedRate:%lf;", swap_p->fixed_rate);
-  StringAppend(output_string, value_buffer);
-  sprintf(value_buffer, "Notional:%lf;", swap_p->notional);
-  StringAppend(output_string, value_buffer);
-  switch (swap_p->ref_rate) {
-    case USSOFR:
-      StringAppend(output_string, "RefRate:USSOFR;");
-      break;
-    case USLIBOR:
-      StringAppend(output_string, "RefRate:USLIBOR;");
-      break;
-    case USCPI:
-      StringAppend(output_string, "RefRate:USCPI");
-      break;
-    case USSTERM:
-      StringAppend(output_string, "RefRate:USTERM");
-      break;
-    case REF_RATE_ERROR:
-      StringAppend(output_string, "RefRate:ERROR");
-      break;
-  }
-  sprintf(value_buffer, "FixedFreq:%d;", swap_p->fixed_pay_freq);
-  StringAppend(output_string, value_buffer);
-  sprintf(value_buffer, "FloatFreq:%d;", swap_p->float_pay_freq);
-  StringAppend(output_string, value_buffer);
-}
-
-Swap *GetNearestSwapL2(Swap swap, Swap *swap_list, size_t swap_list_size) {
-  SwapDistanceCoordinates distance_struct = {0};
-  InitSwapDistanceCoordinatesWeights(
-      &distance_struct,
-      (swap.start_date.tm_year == 0 ? 0 : 1),  // start_weight
-      (swap.end_date.tm_year == 0 ? 0 : 1),    // end_weight
-      (swap.trade_time.tm_year == 0 ? 0 : 1),  // trade_time_weight
-      (swap.fixed_rate == 0 ? 0 : 1), (swap.notional == 0 ? 0 : 1),
-      (swap.ref_rate == REF_RATE_ERROR ? 0 : 1000000),
-      (swap.fixed_pay_freq == PAY_FREQ_ERROR ? 0 : 1000000),
-      (swap.float_pay_freq == PAY_FREQ_ERROR ? 0 : 1000000));
-  double this_distance = 1000000000;
-  double nearest_distance = this_distance;
-  size_t nearest_idx = 0;
-  for (size_t i = 0; i < swap_list_size; i++) {
-    SwapDistanceCoordinates distance_struct =
-        GetSwapDistanceCoordinates(swap, swap_list[i]);
-    this_distance = L2Distance(distance_struct);
-    if (this_distance < nearest_distance) {
-      nearest_distance = this_distance;
-      nearest_idx = i;
-    }
-  }
-  return &swap_list[nearest_idx];
+// Returns the row of the store closest to swap
+size_t GetNearestSwapL2(Swap swap, const SwapStore *store) {
+  SwapTarget target = SwapTargetFromSwap(&swap);
+  double nearest_distance;
+  size_t nearest_idx =
+      nearest_row_kernel(&target, store, 0, store->size, &nearest_distance);
+  return nearest_idx == store->size ? 0 : nearest_idx;
 }
 
-Swap SwapFromInputLine(const char *input_line) {
-  Swap swap = {0};
-  size_t begin_idx = 0;
-  size_t separator_idx = 0;
-  size_t end_idx = 0;
-  char attribute_buffer[64];
-  char value_buffer[64];
-  AttrToParse this_attribute;
-  while (end_idx++ < strlen(input_line)) {
-    if (input_line[end_idx] == ';') {
-      separator_idx = begin_idx;
-      while (input_line[separator_idx] != ':') {
-        separator_idx++;
-      }
-      strncpy(attribute_buffer, input_line + begin_idx,
-              separator_idx - begin_idx);
-      strncpy(value_buffer, input_line + separator_idx,
-              end_idx - separator_idx);
-      begin_idx = end_idx + 1;
-      this_attribute = EvaluateColname(attribute_buffer);
-      AssignSwapValue(&swap, this_attribute, value_buffer);
-    }
+// Brute-force search: fills top_k (initialised by the caller with the query's
+// k) with the nearest swaps among the selected rows (all rows if NULL), best
+// first
+void GetNearestSwapsL2(const SearchQuery *query, const SwapStore *store,
+                       const uint64_t *selected, TopK *top_k) {
+  SwapTarget target = SwapTargetFromSwap(&(query->swap));
+  TopKScanSelected(&target, store, 0, store->size, selected, top_k);
+  TopKSort(top_k);
+}
+
+SwapRecord SwapRecordFromRow(const SwapStore *store, size_t row,
+                             double distance) {
+  SwapRecord record = {store->id[row],
+                       store->start_day[row],
+                       store->end_day[row],
+                       store->trade_time[row],
+                       distance,
+                       store->fixed_rate[row],
+                       store->notional[row],
+                       store->ref_rate[row],
+                       store->fixed_pay_freq[row],
+                       store->float_pay_freq[row],
+                       store->currency[row],
+                       store->action_type[row],
+                       store->transaction_type[row],
+                       store->is_block_trade[row],
+                       store->venue[row]};
+  return record;
+}
+
+void RecordToText(IOBuffer *output, const SwapRecord *record) {
+  IOBufferReserve(output, MAX_RECORD_TEXT_SIZE);
+  int line_size = FormatSwapRecord(record, output->data + output->size,
+                                   MAX_RECORD_TEXT_SIZE);
+  output->size += min((size_t)line_size, MAX_RECORD_TEXT_SIZE - 1);
+}
+
+// One line per match, best first
+void MatchesToText(IOBuffer *output, const SwapStore *store,
+                   const TopK *top_k) {
+  for (size_t i = 0; i < top_k->size; i++) {
+    SwapRecord record = SwapRecordFromRow(store, top_k->matches[i].row,
+                                          top_k->matches[i].distance);
+    RecordToText(output, &record);
   }
-  return swap;
 }
 
-/*** Server functions ***/
-void HandleSearchConnection(int connection, int *is_running_p,
-                            SwapList swap_list) {
-  // Get input
-  char buffer[512];
-  memset(buffer, 0, sizeof(buffer));
-  read(connection, buffer, sizeof(buffer));
-  const char *kill_signal = "kill";
-  if (strcmp(buffer, kill_signal) == 0) {
-    *is_running_p = 0;
-  }
-  printf("%s", buffer);
-  Swap input_swap = {0};
-  SwapFromInputLine(buffer);
-  Swap *nearest_swap =
-      GetNearestSwapL2(input_swap, swap_list.contents, swap_list.size);
-  StringBuffer response;
-  StringInit(&response);
-  SwapToListString(&response, nearest_swap);
-  send(connection, response.string, response.length, 0);
+// The match count, then a packed record per match, best first
+void MatchesToBinary(IOBuffer *output, const SwapStore *store,
+                     const TopK *top_k) {
+  IOBufferReserve(output, sizeof(uint32_t) + top_k->size * SWAP_RECORD_SIZE);
+  char *out = output->data + output->size;
+  WireWriteUint32(out, top_k->size);
+  out += sizeof(uint32_t);
+  for (size_t i = 0; i < top_k->size; i++) {
+    SwapRecord record = SwapRecordFromRow(store, top_k->matches[i].row,
+                                          top_k->matches[i].distance);
+    EncodeSwapRecord(&record, out);
+    out += SWAP_RECORD_SIZE;
+  }
+  output->size = out - output->data;
 }
 
+/*** Server functions ***/
 typedef struct Colnames {
   size_t max_colname_len;
+  size_t max_n_colnames;
   size_t n_colnames;
   char *contents;
+  ColumnPlan plan;
 } Colnames;
 
+// Takes the column names, and the plan to parse lines with, from the csv
+// header line
+void ReadColnames(Colnames *colnames, StringView header) {
+  memset(colnames->contents, 0,
+         colnames->max_n_colnames * colnames->max_colname_len);
+  colnames->n_colnames = ParseLine(colnames->contents, header.data,
+                                   header.size, colnames->max_colname_len);
+  ColumnPlanFree(&colnames->plan);
+  colnames->plan = ColumnPlanBuild(colnames->contents, colnames->n_colnames,
+                                   colnames->max_colname_len);
+}
+
 typedef struct StartupContext {
   Colnames colnames;
-  SwapList swap_list;
+  SwapBook *book;  // see AcquireBook
+  pthread_mutex_t book_mutex;
+  WorkerPool worker_pool;
+  size_t partition_size;
+  const char *filename;  // the csv the swaps come from
+  size_t file_offset;    // bytes of it in the store
+  int follow_file;       // keep loading the lines appended to it
+  size_t data_version;   // goes up once new rows are visible
+  ResponseCache cache;   // of data_version
 } StartupContext;
 
-StartupContext LoadSwapsFromFile(const char *filename,
-                           int max_n_cols, int chunk_size, int max_colname_len,
-                           int max_n_loaded_swaps) {
+// The book a query should read from, until it hands it back with ReleaseBook.
+// A book that has been replaced meanwhile is freed once the last query using
+// it is done, so queries never wait on the compaction.
+SwapBook *AcquireBook(StartupContext *context) {
+  pthread_mutex_lock(&context->book_mutex);
+  SwapBook *book = context->book;
+  book->n_readers++;
+  pthread_mutex_unlock(&context->book_mutex);
+  return book;
+}
+
+void ReleaseBook(StartupContext *context, SwapBook *book) {
+  pthread_mutex_lock(&context->book_mutex);
+  int is_done = --book->n_readers == 0 && book != context->book;
+  pthread_mutex_unlock(&context->book_mutex);
+  if (is_done) {
+    SwapBookFree(book);
+    free(book);
+  }
+}
+
+void ReplaceBook(StartupContext *context, SwapBook *book) {
+  pthread_mutex_lock(&context->book_mutex);
+  SwapBook *old_book = context->book;
+  context->book = book;
+  int is_done = old_book->n_readers == 0;
+  pthread_mutex_unlock(&context->book_mutex);
+  if (is_done) {
+    SwapBookFree(old_book);
+    free(old_book);
+  }
+}
+
+int SameMatches(const TopK *top_k_1, const TopK *top_k_2) {
+  if (top_k_1->size != top_k_2->size) return 0;
+  for (size_t i = 0; i < top_k_1->size; i++) {
+    if (top_k_1->matches[i].row != top_k_2->matches[i].row ||
+        top_k_1->matches[i].distance != top_k_2->matches[i].distance)
+      return 0;
+  }
+  return 1;
+}
+
+// Nearest swaps through the k-d tree, or the brute-force scan depending on the
+// query's mode, split across pool. Categorical values set in the query are
+// hard filters, as are its range bounds, and only live trades match.
+void SearchNearestSwaps(const SearchQuery *query, StartupContext *context,
+                        const SwapBook *book, WorkerPool *pool, TopK *top_k) {
+  SwapStore store = PublishedStore(book);
+  CategoryFilter filter = CategoryFilterFromSwap(&(query->swap));
+  uint64_t *selected =
+      CategoryIndexSelect(&book->category_index, &filter, &store);
+  selected = DropDeadRows(book, &store, selected);
+  SwapTarget target = SwapTargetFromSwap(&(query->swap));
+  const RangeIndex *ranges = &book->range_index;
+  RangeRun run = {NULL, 0};
+  if (query->mode != SEARCH_SCAN)
+    run = RangeIndexNarrowest(ranges, &query->range, &store);
+  int is_narrow = RangeRunIsNarrow(&run, ranges, &store);
+  if (is_narrow) {
+    // cheaper than going over the selection, however few rows it keeps
+    RangeRunScan(&run, ranges, &query->range, &target, &store, selected,
+                 top_k);
+  } else {
+    selected = RangeIndexSelect(ranges, &query->range, &store, selected);
+    if (query->mode == SEARCH_SCAN) {
+      ParallelTopKScan(pool, context->partition_size, &target, &store,
+                       selected, top_k);
+    } else {
+      ParallelKdTreeSearch(pool, context->partition_size, &book->kd_tree,
+                           &target, &store, selected, top_k);
+    }
+  }
+  TopKSort(top_k);
+  if (query->mode == SEARCH_VERIFY) {
+    if (is_narrow)
+      selected = RangeIndexSelect(ranges, &query->range, &store, selected);
+    TopK scan_top_k;
+    TopKInit(&scan_top_k, query->k);
+    GetNearestSwapsL2(query, &store, selected, &scan_top_k);
+    if (!SameMatches(top_k, &scan_top_k)) {
+      log("Verify: k-d tree and scan results differ\n");
+      printf("Verify: k-d tree and scan results differ\n");
+    }
+    TopKFree(&scan_top_k);
+  }
+  free(selected);
+}
+
+#define BATCH_KEYWORD "BATCH"
+#define KILL_SIGNAL "kill"
+#define STATS_KEYWORD "STATS"  // answered with the response cache counters
+#define MAX_QUERY_SIZE 511  // what the old single 512-byte read took
+
+// Size of the complete request at the front of input, 0 while it's still
+// coming in. A query, a lookup or an aggregate is one line; a batch is a
+// "BATCH <n>" line followed by n query lines. A request is also complete once
+// the peer stops sending or it reaches its size limit.
+size_t SearchRequestSize(const char *input, size_t input_size, int at_eof) {
+  size_t keyword_size = strlen(BATCH_KEYWORD);
+  int is_batch = input_size > keyword_size &&
+                 strncmp(input, BATCH_KEYWORD, keyword_size) == 0;
+  int is_lookup = input_size > strlen(LOOKUP_KEYWORD) &&
+                  strncmp(input, LOOKUP_KEYWORD, strlen(LOOKUP_KEYWORD)) == 0;
+  size_t max_size =
+      is_batch || is_lookup ? MAX_REQUEST_SIZE : MAX_QUERY_SIZE;
+  size_t n_lines_wanted = 1;
+  if (is_batch) {
+    // the header says how many lines follow
+    if (!memchr(input, '\n', input_size)) return at_eof ? input_size : 0;
+    size_t n_queries = strtoul(input + keyword_size, NULL, 10);
+    n_lines_wanted += min(n_queries, MAX_BATCH_SIZE);
+  }
+  size_t n_lines = 0;
+  const char *cursor = input;
+  const char *input_end = input + min(input_size, max_size);
+  while (cursor < input_end &&
+         (cursor = memchr(cursor, '\n', input_end - cursor))) {
+    cursor++;
+    if (++n_lines == n_lines_wanted) return cursor - input;
+  }
+  if (input_size >= max_size) return max_size;
+  return at_eof ? input_size : 0;
+}
+
+// Answers the queries together, in one pass over the store, into top_k (one
+// per query, initialised here)
+void AnswerBatch(const SearchQuery *queries, size_t n_queries,
+                 const SwapBook *book, WorkerPool *pool, TopK *top_k) {
+  SwapStore store = PublishedStore(book);
+  SwapTarget *targets = calloc(n_queries, sizeof(SwapTarget));
+  uint64_t **selected = calloc(n_queries, sizeof(uint64_t *));
+  if (n_queries > 0 && (!targets || !selected)) Die("AnswerBatch - calloc");
+  for (size_t i = 0; i < n_queries; i++) {
+    targets[i] = SwapTargetFromSwap(&(queries[i].swap));
+    CategoryFilter filter = CategoryFilterFromSwap(&(queries[i].swap));
+    selected[i] = CategoryIndexSelect(&book->category_index, &filter, &store);
+    selected[i] = DropDeadRows(book, &store, selected[i]);
+    selected[i] = RangeIndexSelect(&book->range_index, &queries[i].range,
+                                   &store, selected[i]);
+    TopKInit(&top_k[i], queries[i].k);
+  }
+  BatchTopKScan(pool, targets, selected, n_queries, &store, top_k);
+  for (size_t i = 0; i < n_queries; i++) free(selected[i]);
+  free(selected);
+  free(targets);
+}
+
+// The response holds a "Query:<i>;" line for each query of the batch in
+// order, followed by its matches
+void HandleBatchRequest(char *request, const SwapBook *book,
+                        WorkerPool *pool, IOBuffer *output) {
+  size_t n_queries = strtoul(request + strlen(BATCH_KEYWORD), NULL, 10);
+  n_queries = min(n_queries, MAX_BATCH_SIZE);
+  if (n_queries == 0) return;
+  SearchQuery *queries = calloc(n_queries, sizeof(SearchQuery));
+  TopK *top_k = calloc(n_queries, sizeof(TopK));
+  if (!queries || !top_k) Die("HandleBatchRequest - calloc");
+  char *line = strchr(request, '\n');
+  size_t n_parsed = 0;
+  while (line != NULL && n_parsed < n_queries) {
+    line++;
+    char *line_end = strchr(line, '\n');
+    if (line_end != NULL) *line_end = '\0';
+    queries[n_parsed++] = QueryFromInputLine(line);
+    line = line_end;
+  }
+  AnswerBatch(queries, n_parsed, book, pool, top_k);
+
+  char header[64];
+  for (size_t i = 0; i < n_parsed; i++) {
+    int header_size = sprintf(header, "Query:%zu;\n", i);
+    IOBufferAppend(output, header, header_size);
+    MatchesToText(output, &book->store, &top_k[i]);
+    TopKFree(&top_k[i]);
+  }
+  free(top_k);
+  free(queries);
+}
+
+// A line per requested id that is a live trade, in the order asked
+void AnswerLookupRequest(const char *request, const SwapBook *book,
+                         IOBuffer *output) {
+  // every id takes at least a digit and a separator
+  size_t max_ids = strlen(request) / 2 + 1;
+  long *ids = malloc(max_ids * sizeof(long));
+  if (!ids) Die("AnswerLookupRequest - malloc");
+  size_t n_ids = IdsFromLookupLine(request, ids, max_ids);
+  for (size_t i = 0; i < n_ids; i++) {
+    size_t row = SwapBookFind(book, ids[i]);
+    if (row == ID_NOT_FOUND) continue;
+    SwapRecord record = SwapRecordFromRow(&book->store, row, 0);
+    RecordToText(output, &record);
+  }
+  free(ids);
+}
+
+int IsLookupRequest(const char *request) {
+  return strncmp(request, LOOKUP_KEYWORD, strlen(LOOKUP_KEYWORD)) == 0;
+}
+
+AggregateRecord AggregateRecordFromRollup(const RollupRow *row) {
+  const RollupStats *stats = &row->stats;
+  AggregateRecord record = {
+      row->bucket_start, stats->count, stats->notional,
+      stats->notional != 0 ? stats->rate_notional / stats->notional : 0,
+      row->ref_rate, row->tenor};
+  return record;
+}
+
+// A line per bucket of the window with live trades in it, see RollupsQuery
+void AnswerAggregateRequest(const char *request, const SwapBook *book,
+                            IOBuffer *output) {
+  SearchQuery query = QueryFromInputLine(request + strlen(AGGREGATE_KEYWORD));
+  RollupRow *rows;
+  size_t n_rows = RollupsQuery(&book->rollups, &query, &rows);
+  for (size_t i = 0; i < n_rows; i++) {
+    AggregateRecord record = AggregateRecordFromRollup(&rows[i]);
+    IOBufferReserve(output, MAX_RECORD_TEXT_SIZE);
+    int line_size = FormatAggregateRecord(
+        &record, output->data + output->size, MAX_RECORD_TEXT_SIZE);
+    output->size += min((size_t)line_size, MAX_RECORD_TEXT_SIZE - 1);
+  }
+  free(rows);
+}
+
+int IsAggregateRequest(const char *request) {
+  return strncmp(request, AGGREGATE_KEYWORD, strlen(AGGREGATE_KEYWORD)) == 0;
+}
+
+int IsStatsRequest(const char *request) {
+  return strncmp(request, STATS_KEYWORD, strlen(STATS_KEYWORD)) == 0;
+}
+
+void AnswerStatsRequest(StartupContext *context, IOBuffer *output) {
+  CacheStats stats = ResponseCacheStats(&context->cache);
+  char line[160];
+  int line_size = snprintf(
+      line, sizeof(line),
+      "CacheHits:%zu;CacheMisses:%zu;CacheEntries:%zu;DataVersion:%zu;\n",
+      stats.n_hits, stats.n_misses, stats.n_entries,
+      __atomic_load_n(&context->data_version, __ATOMIC_ACQUIRE));
+  IOBufferAppend(output, line, min((size_t)line_size, sizeof(line) - 1));
+}
+
+// Appends the response to a complete, null-terminated request to output
+void AnswerSearchRequest(char *request, StartupContext *context,
+                         const SwapBook *book, WorkerPool *pool,
+                         IOBuffer *output) {
+  if (strncmp(request, BATCH_KEYWORD, strlen(BATCH_KEYWORD)) == 0) {
+    HandleBatchRequest(request, book, pool, output);
+    return;
+  }
+  if (IsLookupRequest(request)) {
+    AnswerLookupRequest(request, book, output);
+    return;
+  }
+  if (IsAggregateRequest(request)) {
+    AnswerAggregateRequest(request, book, output);
+    return;
+  }
+  if (IsStatsRequest(request)) {
+    AnswerStatsRequest(context, output);
+    return;
+  }
+  SearchQuery query = QueryFromInputLine(request);
+  TopK top_k;
+  TopKInit(&top_k, query.k);
+  SearchNearestSwaps(&query, context, book, pool, &top_k);
+  MatchesToText(output, &book->store, &top_k);
+  TopKFree(&top_k);
+}
+
+int IsBinaryLookupRequest(const char *request, size_t request_size) {
+  return request_size >= sizeof(uint32_t) &&
+         (WireReadUint32(request) & BINARY_LOOKUP_FLAG);
+}
+
+// A binary lookup: each id answered with its live trade or no match. Ids past
+// the end of the payload are dropped.
+void AnswerBinaryLookupRequest(const char *request, size_t request_size,
+                               const SwapBook *book, IOBuffer *output) {
+  size_t n_ids = WireReadUint32(request) & ~BINARY_LOOKUP_FLAG;
+  n_ids = min(n_ids, (request_size - sizeof(uint32_t)) / LOOKUP_ID_SIZE);
+  IOBufferReserve(output, sizeof(uint32_t) +
+                              n_ids * (sizeof(uint32_t) + SWAP_RECORD_SIZE));
+  char *out = output->data + output->size;
+  WireWriteUint32(out, n_ids);
+  out += sizeof(uint32_t);
+  const char *packed = request + sizeof(uint32_t);
+  for (size_t i = 0; i < n_ids; i++) {
+    size_t row = SwapBookFind(book, WireReadInt64(packed + i * LOOKUP_ID_SIZE));
+    WireWriteUint32(out, row != ID_NOT_FOUND);
+    out += sizeof(uint32_t);
+    if (row == ID_NOT_FOUND) continue;
+    SwapRecord record = SwapRecordFromRow(&book->store, row, 0);
+    EncodeSwapRecord(&record, out);
+    out += SWAP_RECORD_SIZE;
+  }
+  output->size = out - output->data;
+}
+
+int IsBinaryAggregateRequest(const char *request, size_t request_size) {
+  return request_size >= sizeof(uint32_t) &&
+         (WireReadUint32(request) & BINARY_AGGREGATE_FLAG);
+}
+
+// A binary AGGREGATE: the bucket count, then a packed aggregate per bucket.
+// Without a whole packed query, there are no buckets.
+void AnswerBinaryAggregateRequest(const char *request, size_t request_size,
+                                  const SwapBook *book, IOBuffer *output) {
+  RollupRow *rows = NULL;
+  size_t n_rows = 0;
+  if (request_size >= sizeof(uint32_t) + BINARY_QUERY_SIZE) {
+    SearchQuery query = DecodeBinaryQuery(request + sizeof(uint32_t));
+    n_rows = RollupsQuery(&book->rollups, &query, &rows);
+  }
+  IOBufferReserve(output, sizeof(uint32_t) + n_rows * AGGREGATE_RECORD_SIZE);
+  char *out = output->data + output->size;
+  WireWriteUint32(out, n_rows);
+  out += sizeof(uint32_t);
+  for (size_t i = 0; i < n_rows; i++) {
+    AggregateRecord record = AggregateRecordFromRollup(&rows[i]);
+    EncodeAggregateRecord(&record, out);
+    out += AGGREGATE_RECORD_SIZE;
+  }
+  output->size = out - output->data;
+  free(rows);
+}
+
+// Same for a binary protocol request (see wire.c). Queries past the end of the
+// payload or MAX_BATCH_SIZE are dropped; the response counts the ones answered.
+void AnswerBinaryRequest(const char *request, size_t request_size,
+                         StartupContext *context, const SwapBook *book,
+                         WorkerPool *pool, IOBuffer *output) {
+  // text, as it is too short to hold a packed query
+  if (request_size < sizeof(uint32_t) + BINARY_QUERY_SIZE &&
+      IsStatsRequest(request)) {
+    AnswerStatsRequest(context, output);
+    return;
+  }
+  if (IsBinaryLookupRequest(request, request_size)) {
+    AnswerBinaryLookupRequest(request, request_size, book, output);
+    return;
+  }
+  if (IsBinaryAggregateRequest(request, request_size)) {
+    AnswerBinaryAggregateRequest(request, request_size, book, output);
+    return;
+  }
+  size_t n_queries = 0;
+  if (request_size >= sizeof(uint32_t)) {
+    n_queries = WireReadUint32(request);
+    n_queries = min(n_queries,
+                    (request_size - sizeof(uint32_t)) / BINARY_QUERY_SIZE);
+    n_queries = min(n_queries, MAX_BATCH_SIZE);
+  }
+  char count[sizeof(uint32_t)];
+  WireWriteUint32(count, n_queries);
+  IOBufferAppend(output, count, sizeof(count));
+  if (n_queries == 0) return;
+  const char *packed = request + sizeof(uint32_t);
+  SearchQuery *queries = malloc(n_queries * sizeof(SearchQuery));
+  TopK *top_k = malloc(n_queries * sizeof(TopK));
+  if (!queries || !top_k) Die("AnswerBinaryRequest - malloc");
+  for (size_t i = 0; i < n_queries; i++) {
+    queries[i] = DecodeBinaryQuery(packed + i * BINARY_QUERY_SIZE);
+  }
+  if (n_queries == 1) {
+    TopKInit(&top_k[0], queries[0].k);
+    SearchNearestSwaps(&queries[0], context, book, pool, &top_k[0]);
+  } else {
+    AnswerBatch(queries, n_queries, book, pool, top_k);
+  }
+  for (size_t i = 0; i < n_queries; i++) {
+    MatchesToBinary(output, &book->store, &top_k[i]);
+    TopKFree(&top_k[i]);
+  }
+  free(top_k);
+  free(queries);
+}
+
+// Loads up to max_n_loaded_swaps swaps from the csv file into the store of
+// the context's book, parsing across the context's worker pool. A file that
+// is followed is only loaded up to its last complete line, the rest is still
+// being written.
+void LoadSwapsFromFile(StartupContext *context, const char *filename,
+                       int max_n_cols, int max_colname_len,
+                       size_t max_n_loaded_swaps) {
   Colnames colnames = {0};
-  SwapList swap_list = {0};
-  swap_list.contents = malloc(max_n_loaded_swaps * sizeof(Swap));
-  colnames.contents = malloc(max_n_cols * max_colname_len);
+  SwapStore swap_store;
+  SwapStoreInit(&swap_store, max_n_loaded_swaps);
+  // zeroed so that cells past the last header evaluate to PARSE_ERROR
+  colnames.contents = calloc(max_n_cols, max_colname_len);
+  if (!colnames.contents) Die("LoadSwapsFromFile - calloc");
   colnames.max_colname_len = max_colname_len;
-  char line_buffer[chunk_size];
-  FILE *handler = fopen(filename, "r");
-  if (handler) {
+  colnames.max_n_colnames = max_n_cols;
+  MappedFile file;
+  if (MapFile(&file, filename) == 0) {
+    StringView body = MappedFileView(&file);
+    if (context->follow_file)
+      body.size = CompleteLinesSize(body.data, body.size);
     // get column names
-    int line_size = ReadLine(handler, line_buffer, chunk_size);
-    colnames.n_colnames =
-        ParseLine(colnames.contents, line_buffer, line_size, max_colname_len);
-    // read swaps into array
-    int n_loaded_swaps = 0;
-    for (int i = 0; i < max_n_loaded_swaps; i++) {
-      line_size = ReadLine(handler, line_buffer, chunk_size);
-      if (line_size == 0) {
-        break;
-      }
-      n_loaded_swaps = i + 1;
-      swap_list.contents[i] = SwapFromCSVLine(
-          line_buffer, line_size, colnames.contents, max_colname_len);
-    }
-    printf("%d swaps loaded\n", n_loaded_swaps);
-    swap_list.size = n_loaded_swaps;
+    ReadColnames(&colnames, NextLine(&body));
+    // read swaps into the store, straight out of the mapping
+    size_t n_loaded_swaps =
+        IngestCSVBody(&context->worker_pool, body, &colnames.plan, &swap_store);
+    printf("%zu swaps loaded\n", n_loaded_swaps);
+    ReportBadCells(filename);
+    context->file_offset = body.data + body.size - file.data;
+    UnmapFile(&file);
   }
-  fclose(handler);
-  StartupContext startup_context;
-  startup_context.colnames = colnames;
-  startup_context.swap_list = swap_list;
-  return startup_context;
+  context->colnames = colnames;
+  context->book->store = swap_store;
 }
 
-StartupContext LoadFileOnStartup() {
+// Points the book's store and indexes at a mapped snapshot, returns 0 on
+// success and -1 when there is no usable snapshot
+int LoadSnapshot(StartupContext *context, const char *snapshot_filename,
+                 const SnapshotSource *source, int max_n_cols,
+                 int max_colname_len) {
+  SwapBook *book = context->book;
+  const char *mapped_colnames;
+  size_t colnames_size;
+  if (SnapshotMap(snapshot_filename, source, &book->snapshot,
+                  &mapped_colnames, &colnames_size, &book->store,
+                  &book->kd_tree, &book->category_index,
+                  &book->range_index) != 0)
+    return -1;
+  if (colnames_size != (size_t)max_n_cols * max_colname_len) {
+    // written with other column limits
+    UnmapFile(&book->snapshot);
+    SwapStoreFree(&book->store);
+    memset(&book->kd_tree, 0, sizeof(KdTree));
+    memset(&book->category_index, 0, sizeof(CategoryIndex));
+    memset(&book->range_index, 0, sizeof(RangeIndex));
+    return -1;
+  }
+  Colnames colnames = {0};
+  colnames.contents = malloc(colnames_size);
+  if (!colnames.contents) Die("LoadSnapshot - malloc");
+  memcpy(colnames.contents, mapped_colnames, colnames_size);
+  colnames.max_colname_len = max_colname_len;
+  colnames.max_n_colnames = max_n_cols;
+  for (size_t col = 0; col < (size_t)max_n_cols; col++) {
+    if (colnames.contents[col * max_colname_len] != '\0')
+      colnames.n_colnames = col + 1;
+  }
+  colnames.plan = ColumnPlanBuild(colnames.contents, colnames.n_colnames,
+                                  max_colname_len);
+  context->colnames = colnames;
+  return 0;
+}
+
+// Applies the rows of the book's store as events, in place, and indexes the
+// live trades. Returns the book to query: book itself or, when trades were
+// cancelled or corrected, a compacted copy, book being freed then.
+SwapBook *IndexLoadedBook(SwapBook *book) {
+  SwapBookTrackRows(book, 0);
+  SwapBookApplyEvents(book, 0, book->store.size, NULL);
+  if (book->n_dead == 0) {
+    SwapBookIndex(book);
+    return book;
+  }
+  printf("%zu swaps cancelled or corrected\n", book->n_dead);
+  SwapBook *compacted = SwapBookCompact(book, book->store.size);
+  SwapBookFree(book);
+  free(book);
+  return compacted;
+}
+
+// Loads the csv into the context's book, from the snapshot when it is up to
+// date and writing it otherwise. Needs the worker pool to be running.
+void LoadBook(StartupContext *context, const char *filename,
+              const char *snapshot_filename) {
   int max_n_cols = 80;
-  int chunk_size = 2048;
   int max_colname_len = 64;
-  int max_n_loaded_swaps = 1000;
-  const char *filename = "/Users/aionfeehan/Desktop/DTCC/sofr_swaps.csv";
-  StartupContext startup_context =
-      LoadSwapsFromFile(filename, max_n_cols, chunk_size,
-                        max_colname_len, max_n_loaded_swaps);
-  return startup_context;
-}
-
-int LaunchServer(int port_no, int queue_size) {
-  StartupContext context = LoadFileOnStartup();
-  int is_running = 1;
-
-  // Create a socket
-  int sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock == -1) Die("LaunchServer - socket");
-  struct linger lin;
-  lin.l_onoff = 0;
-  lin.l_linger = 0;
-  setsockopt(sock, SOL_SOCKET, SO_LINGER, (const char *)&lin, sizeof(int));
-  struct sockaddr_in address;
-
-  memset(&address, 0, sizeof(address));
-  address.sin_family = AF_INET;
-  address.sin_addr.s_addr = INADDR_ANY;
-  address.sin_port = htons(port_no);
-
-  // bind
-  struct sockaddr *address_p = (struct sockaddr *)&address;
-  size_t address_size = sizeof(address);
-  if (bind(sock, address_p, address_size) < 0) Die("LaunchServer - bind");
-
-  // Start listening
-  if (listen(sock, queue_size) < 0) Die("LaunchServer - listen");
-
-  while (is_running != 0) {
-    // Open connection
-    int connection =
-        accept(sock, (struct sockaddr *)&address, (socklen_t *)&address_size);
-    if (connection < 0) Die("LaunchServer - accept");
-    HandleSearchConnection(
-        connection, &is_running, context.swap_list);
-    close(connection);
-  }
-
-  close(sock);
+  size_t max_n_loaded_swaps = SWAP_STORE_MAX_ROWS;
+  context->filename = filename;
+  context->book = calloc(1, sizeof(SwapBook));
+  if (!context->book) Die("LoadBook - calloc");
+  SwapBook *book = context->book;
+  SnapshotSource source;
+  int has_source =
+      SnapshotSourceFromFile(&source, filename, max_n_loaded_swaps) == 0;
+  if (has_source && LoadSnapshot(context, snapshot_filename, &source,
+                                 max_n_cols, max_colname_len) == 0) {
+    printf("%zu swaps loaded from snapshot\n", book->store.size);
+    context->file_offset = source.size;
+    SwapBookTrackRows(book, book->store.size);
+    PublishRows(book, book->store.size);
+    return;
+  }
+  LoadSwapsFromFile(context, filename, max_n_cols, max_colname_len,
+                    max_n_loaded_swaps);
+  book = context->book = IndexLoadedBook(book);
+  // not when part of the file was left for later, or it has grown since
+  if (has_source && context->file_offset == source.size &&
+      SnapshotWrite(snapshot_filename, &source, context->colnames.contents,
+                    (size_t)max_n_cols * max_colname_len, &book->store,
+                    &book->kd_tree, &book->category_index,
+                    &book->range_index) != 0)
+    fprintf(stderr, "Could not write snapshot %s\n", snapshot_filename);
+}
+
+void LoadFileOnStartup(StartupContext *context) {
+  LoadBook(context, "/Users/aionfeehan/Desktop/DTCC/sofr_swaps.csv",
+           "/Users/aionfeehan/Desktop/DTCC/sofr_swaps.snapshot");
+}
+
+typedef struct ServerConfig {
+  int serve;  // run the server rather than the one-off sample query
+  int port_no;
+  int queue_size;  // listen backlog
+  size_t n_threads;       // loading and search threads
+  size_t partition_size;  // rows per search task
+  size_t n_io_threads;    // event loops reading requests and sending responses
+  size_t n_search_workers;  // requests answered at once, sharing n_threads
+  size_t request_queue_depth;
+  int tail;  // load the lines appended to the csv while serving
+  size_t cache_size;  // responses kept, see ResponseCache
+} ServerConfig;
+
+ServerConfig DefaultServerConfig() {
+  ServerConfig config;
+  config.serve = 0;
+  config.port_no = 9999;
+  config.queue_size = SOMAXCONN;
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  config.n_threads = n_cpus > 0 ? n_cpus : 1;
+  // 16K rows of the scored columns is about 450KB, which stays in L2
+  config.partition_size = 16384;
+  // parsing and sending are cheap next to searching
+  config.n_io_threads = max(config.n_threads / 8, 1);
+  // under load, answering requests side by side beats splitting each one
+  config.n_search_workers = config.n_threads;
+  config.request_queue_depth = 1024;
+  config.tail = 0;
+  config.cache_size = 4096;
+  return config;
+}
+
+void PrintUsage(const char *program_name) {
+  fprintf(stderr,
+          "usage: %s [--serve] [--tail] [--port N] [--queue-size N] "
+          "[--threads N] [--partition-size ROWS] [--io-threads N] "
+          "[--search-workers N] [--request-queue-depth N] "
+          "[--cache-size N]\n",
+          program_name);
+}
+
+ServerConfig ParseServerArgs(int argc, char **argv) {
+  ServerConfig config = DefaultServerConfig();
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (strcmp(arg, "--serve") == 0) {
+      config.serve = 1;
+      continue;
+    }
+    if (strcmp(arg, "--tail") == 0) {
+      config.tail = 1;
+      continue;
+    }
+    if (value == NULL || strtol(value, NULL, 10) <= 0) {
+      PrintUsage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+    if (strcmp(arg, "--port") == 0) {
+      config.port_no = strtol(value, NULL, 10);
+    } else if (strcmp(arg, "--queue-size") == 0) {
+      config.queue_size = strtol(value, NULL, 10);
+    } else if (strcmp(arg, "--threads") == 0) {
+      config.n_threads = strtol(value, NULL, 10);
+    } else if (strcmp(arg, "--partition-size") == 0) {
+      config.partition_size = strtol(value, NULL, 10);
+    } else if (strcmp(arg, "--io-threads") == 0) {
+      config.n_io_threads = strtol(value, NULL, 10);
+    } else if (strcmp(arg, "--search-workers") == 0) {
+      config.n_search_workers = strtol(value, NULL, 10);
+    } else if (strcmp(arg, "--request-queue-depth") == 0) {
+      config.request_queue_depth = strtol(value, NULL, 10);
+    } else if (strcmp(arg, "--cache-size") == 0) {
+      config.cache_size = strtol(value, NULL, 10);
+    } else {
+      PrintUsage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+    i++;
+  }
+  return config;
+}
+
+void StartWorkers(StartupContext *context, const ServerConfig *config) {
+  WorkerPoolInit(&context->worker_pool, config->n_threads);
+  pthread_mutex_init(&context->book_mutex, NULL);
+  context->partition_size = config->partition_size;
+  context->follow_file = config->tail;
+  ResponseCacheInit(&context->cache, config->cache_size);
+}
+
+void FreeStartupContext(StartupContext *context) {
+  WorkerPoolFree(&context->worker_pool);
+  SwapBookFree(context->book);
+  free(context->book);
+  pthread_mutex_destroy(&context->book_mutex);
+  ResponseCacheFree(&context->cache);
+  ColumnPlanFree(&context->colnames.plan);
+  free(context->colnames.contents);
+}
+
+/*** Serving ***/
+// IO threads each run an event loop on the shared listening socket. Complete
+// requests go on a queue drained by the search workers, which send the
+// responses back to the loop that read them. Each search worker splits its
+// requests across its own share of the threads. When the queue is full, the
+// IO thread answers the request itself: clients slow down rather than fail.
+typedef struct SearchServer SearchServer;
+
+typedef struct IOThread {
+  SearchServer *server;
+  EventLoop loop;
+  WorkerPool pool;  // for the requests it answers itself
+  pthread_t thread;
+} IOThread;
+
+typedef struct SearchWorker {
+  SearchServer *server;
+  WorkerPool pool;
+  pthread_t thread;
+} SearchWorker;
+
+struct SearchServer {
+  StartupContext *context;
+  int listen_fd;
+  RequestQueue queue;
+  size_t n_io_threads;
+  IOThread *io_threads;  // the first runs on the launching thread
+  size_t n_search_workers;
+  SearchWorker *search_workers;
+};
+
+// How a connection talks, decided on its first byte
+typedef enum WireProtocol {
+  PROTOCOL_UNKNOWN,
+  PROTOCOL_TEXT,    // one request, answered by the text before hanging up
+  PROTOCOL_FRAMED,  // any number of requests, each in a frame, see frame.c
+  PROTOCOL_BINARY,  // framed, with queries and matches packed, see wire.c
+} WireProtocol;
+
+typedef struct SearchJob {
+  EventLoop *loop;  // where the response goes
+  int fd;
+  unsigned long connection_id;
+  WireProtocol protocol;
+  uint32_t request_id;  // framed protocols only
+  char *request;        // null-terminated
+  size_t request_size;
+} SearchJob;
+
+void SearchServerStop(SearchServer *server) {
+  for (size_t i = 0; i < server->n_io_threads; i++) {
+    EventLoopStop(&server->io_threads[i].loop);
+  }
+}
+
+// The protocol, then the packed query: queries that parse the same share it,
+// however they were written
+#define CACHE_KEY_SIZE (1 + BINARY_QUERY_SIZE)
+
+// Fills key with the canonical form of a single query, returns 0 for requests
+// that aren't cached: batches, lookups, aggregates, STATS and Verify queries,
+// whose point is the comparison they log
+int CacheKeyFromRequest(const SearchJob *job, char *key) {
+  SearchQuery query;
+  if (job->protocol == PROTOCOL_BINARY) {
+    if (job->request_size < sizeof(uint32_t) + BINARY_QUERY_SIZE ||
+        WireReadUint32(job->request) != 1)
+      return 0;
+    query = DecodeBinaryQuery(job->request + sizeof(uint32_t));
+  } else {
+    const char *request = job->request;
+    if (strncmp(request, BATCH_KEYWORD, strlen(BATCH_KEYWORD)) == 0 ||
+        IsLookupRequest(request) || IsAggregateRequest(request) ||
+        IsStatsRequest(request))
+      return 0;
+    query = QueryFromInputLine(request);
+  }
+  if (query.mode == SEARCH_VERIFY) return 0;
+  key[0] = job->protocol == PROTOCOL_BINARY;
+  EncodeBinaryQuery(&query, key + 1);
+  return 1;
+}
+
+// The response to the job's request into output, which starts empty, from
+// the cache when it has it
+void AnswerSearchJob(const SearchJob *job, StartupContext *context,
+                     WorkerPool *pool, IOBuffer *output) {
+  int is_framed = job->protocol != PROTOCOL_TEXT;
+  size_t header_size = is_framed ? FRAME_HEADER_SIZE : 0;
+  if (is_framed) {
+    // the header goes in front once the payload size is known
+    IOBufferReserve(output, FRAME_HEADER_SIZE);
+    output->size = FRAME_HEADER_SIZE;
+  }
+  char key[CACHE_KEY_SIZE];
+  int is_cached = CacheKeyFromRequest(job, key);
+  // read before the book, so that a response is never kept under a version
+  // newer than the data it was answered from
+  size_t version = __atomic_load_n(&context->data_version, __ATOMIC_ACQUIRE);
+  if (!is_cached ||
+      !ResponseCacheGet(&context->cache, key, CACHE_KEY_SIZE, version,
+                        output)) {
+    SwapBook *book = AcquireBook(context);
+    if (job->protocol == PROTOCOL_BINARY) {
+      AnswerBinaryRequest(job->request, job->request_size, context, book,
+                          pool, output);
+    } else {
+      AnswerSearchRequest(job->request, context, book, pool, output);
+    }
+    ReleaseBook(context, book);
+    if (is_cached)
+      ResponseCachePut(&context->cache, key, CACHE_KEY_SIZE, version,
+                       output->data + header_size, output->size - header_size);
+  }
+  if (is_framed) {
+    FrameHeader header = {output->size - FRAME_HEADER_SIZE, job->request_id};
+    WriteFrameHeader(output->data, &header);
+  }
+}
+
+void RunSearchJob(SearchJob *job, StartupContext *context, WorkerPool *pool) {
+  IOBuffer output = {0};
+  AnswerSearchJob(job, context, pool, &output);
+  EventLoopComplete(job->loop, job->fd, job->connection_id, &output);
+  free(job->request);
+  free(job);
+}
+
+void *SearchWorkerThread(void *arg) {
+  SearchWorker *worker = arg;
+  void *job;
+  while (RequestQueuePop(&worker->server->queue, &job) == 0) {
+    RunSearchJob(job, worker->server->context, &worker->pool);
+  }
+  return NULL;
+}
+
+// RequestHandler of the IO threads
+size_t HandleSearchRequest(EventLoop *loop, Connection *connection) {
+  IOThread *io_thread = loop->context;
+  SearchServer *server = io_thread->server;
+  const char *input = connection->input.data;
+  if (connection->protocol == PROTOCOL_UNKNOWN) {
+    connection->protocol = input[0] == 0 ? PROTOCOL_FRAMED : PROTOCOL_TEXT;
+    connection->keep_alive = connection->protocol == PROTOCOL_FRAMED;
+  }
+  FrameHeader header = {0, 0};
+  size_t request_size, payload_offset = 0;
+  if (connection->protocol != PROTOCOL_TEXT) {
+    request_size = ReadFrame(input, connection->input.size, &header);
+    if (header.payload_size > MAX_REQUEST_SIZE - FRAME_HEADER_SIZE) {
+      // would never fit in the input buffer
+      connection->close_when_sent = 1;
+      return 0;
+    }
+    payload_offset = FRAME_HEADER_SIZE;
+  } else {
+    request_size =
+        SearchRequestSize(input, connection->input.size, connection->at_eof);
+  }
+  if (request_size == 0) return 0;
+  // the parsers want a null-terminated copy
+  size_t payload_size = request_size - payload_offset;
+  char *request = malloc(payload_size + 1);
+  if (!request) Die("HandleSearchRequest - malloc");
+  memcpy(request, input + payload_offset, payload_size);
+  request[payload_size] = '\0';
+  StringView line = {request, payload_size};
+  line = NextLine(&line);
+  int is_binary = connection->protocol == PROTOCOL_BINARY;
+  int is_lookup = is_binary ? IsBinaryLookupRequest(request, payload_size)
+                            : IsLookupRequest(request);
+  int is_packed =
+      is_binary && (is_lookup ||
+                    payload_size >= sizeof(uint32_t) + BINARY_QUERY_SIZE);
+  // too short to hold a packed query, so binary connections can send it too
+  if (!is_packed && ViewEquals(line, KILL_SIGNAL)) {
+    SearchServerStop(server);
+    free(request);
+    return request_size;
+  }
+  if (connection->protocol != PROTOCOL_TEXT && !is_packed &&
+      (ViewEquals(line, BINARY_PROTOCOL_REQUEST) ||
+       ViewEquals(line, TEXT_PROTOCOL_REQUEST))) {
+    // switches the requests after this one, and is echoed back as the ack
+    connection->protocol = ViewEquals(line, BINARY_PROTOCOL_REQUEST)
+                               ? PROTOCOL_BINARY
+                               : PROTOCOL_FRAMED;
+    char ack_header[FRAME_HEADER_SIZE];
+    FrameHeader ack = {line.size, header.request_id};
+    WriteFrameHeader(ack_header, &ack);
+    IOBufferAppend(&connection->output, ack_header, FRAME_HEADER_SIZE);
+    IOBufferAppend(&connection->output, line.data, line.size);
+    free(request);
+    return request_size;
+  }
+  SearchJob *job = malloc(sizeof(SearchJob));
+  if (!job) Die("HandleSearchRequest - malloc");
+  job->loop = loop;
+  job->fd = connection->fd;
+  job->connection_id = connection->id;
+  job->protocol = connection->protocol;
+  job->request_id = header.request_id;
+  job->request = request;
+  job->request_size = payload_size;
+  connection->n_pending++;
+  // a lookup is a few hash probes, less than the hand-off to a search worker
+  if (is_lookup || RequestQueuePush(&server->queue, job) != 0)
+    RunSearchJob(job, server->context, &io_thread->pool);
+  return request_size;
+}
+
+void *IOThreadRun(void *arg) {
+  IOThread *io_thread = arg;
+  EventLoopRun(&io_thread->loop);
+  return NULL;
+}
+
+// Threads per search worker, out of config->n_threads
+size_t SearchWorkerThreads(const ServerConfig *config) {
+  return max(config->n_threads / config->n_search_workers, 1);
+}
+
+void SearchServerInit(SearchServer *server, StartupContext *context,
+                      const ServerConfig *config, int listen_fd) {
+  memset(server, 0, sizeof(SearchServer));
+  server->context = context;
+  server->listen_fd = listen_fd;
+  RequestQueueInit(&server->queue, config->request_queue_depth);
+  server->n_io_threads = config->n_io_threads;
+  server->n_search_workers = config->n_search_workers;
+  server->io_threads = calloc(server->n_io_threads, sizeof(IOThread));
+  server->search_workers =
+      calloc(server->n_search_workers, sizeof(SearchWorker));
+  if (!server->io_threads || !server->search_workers)
+    Die("SearchServerInit - calloc");
+  for (size_t i = 0; i < server->n_search_workers; i++) {
+    SearchWorker *worker = &server->search_workers[i];
+    worker->server = server;
+    WorkerPoolInit(&worker->pool, SearchWorkerThreads(config));
+    if (pthread_create(&worker->thread, NULL, SearchWorkerThread, worker) != 0)
+      Die("SearchServerInit - pthread_create");
+  }
+  for (size_t i = 0; i < server->n_io_threads; i++) {
+    IOThread *io_thread = &server->io_threads[i];
+    io_thread->server = server;
+    WorkerPoolInit(&io_thread->pool, 1);
+    EventLoopInit(&io_thread->loop, listen_fd, HandleSearchRequest,
+                  io_thread);
+  }
+}
+
+// Serves until a kill request comes in
+void SearchServerRun(SearchServer *server) {
+  for (size_t i = 1; i < server->n_io_threads; i++) {
+    if (pthread_create(&server->io_threads[i].thread, NULL, IOThreadRun,
+                       &server->io_threads[i]) != 0)
+      Die("SearchServerRun - pthread_create");
+  }
+  EventLoopRun(&server->io_threads[0].loop);
+  for (size_t i = 1; i < server->n_io_threads; i++) {
+    pthread_join(server->io_threads[i].thread, NULL);
+  }
+}
+
+void SearchServerFree(SearchServer *server) {
+  // the workers finish what's queued; the loops drop those responses
+  RequestQueueClose(&server->queue);
+  for (size_t i = 0; i < server->n_search_workers; i++) {
+    pthread_join(server->search_workers[i].thread, NULL);
+    WorkerPoolFree(&server->search_workers[i].pool);
+  }
+  for (size_t i = 0; i < server->n_io_threads; i++) {
+    EventLoopFree(&server->io_threads[i].loop);
+    WorkerPoolFree(&server->io_threads[i].pool);
+  }
+  free(server->search_workers);
+  free(server->io_threads);
+  RequestQueueFree(&server->queue);
+  close(server->listen_fd);
+}
+
+/*** Live tail ***/
+// With --tail, a thread follows the csv and loads the lines appended to it
+// while the server runs. It parses them into the store rows past the
+// published ones, through its own copy of the store (same columns, its own
+// size and committed capacity), stages them as events, then publishes them
+// (see SwapBookPublishEvents). Queries never wait on it, but may see an
+// append in part: its rows before their ids and rollups, or a corrected
+// trade next to its correction, never neither. The new rows aren't in the
+// k-d tree or the category bitmaps, the searches scan them instead (see
+// KdTreeSearch and CategoryIndexSelect) until the book is compacted, which
+// this thread does too. A file that is replaced or truncated is loaded again
+// into a new book.
+typedef struct TailIngest {
+  StartupContext *context;
+  SwapStore store;  // the loading side of the store of the context's book
+  FileTail tail;
+  IOBuffer lines;
+  pthread_t thread;
+} TailIngest;
+
+// Cached responses are stale once the rows a query sees have changed
+void BumpDataVersion(StartupContext *context) {
+  __atomic_store_n(&context->data_version, context->data_version + 1,
+                   __ATOMIC_RELEASE);
+}
+
+// The file was created, replaced or truncated since it was loaded: its lines
+// go in a new book, which takes the place of the old one rather than being
+// appended to it, as they may well repeat its rows
+void TailReloadFile(TailIngest *ingest, StringView body) {
+  StartupContext *context = ingest->context;
+  if (body.size > 0) ReadColnames(&context->colnames, NextLine(&body));
+  SwapBook *book = calloc(1, sizeof(SwapBook));
+  if (!book) Die("TailReloadFile - calloc");
+  SwapStoreInit(&book->store, SWAP_STORE_MAX_ROWS);
+  IngestCSVBody(&context->worker_pool, body, &context->colnames.plan,
+                &book->store);
+  ReportBadCells(context->filename);
+  book = IndexLoadedBook(book);
+  ReplaceBook(context, book);
+  ingest->store = book->store;
+  BumpDataVersion(context);
+  printf("Reloaded %zu live swaps from %s\n", ingest->store.size,
+         context->filename);
+}
+
+// Loads the complete lines appended since the last call, returns the number
+// of swaps added (none when the file is reloaded, see TailReloadFile)
+size_t TailIngestLines(TailIngest *ingest) {
+  StartupContext *context = ingest->context;
+  size_t lines_offset;
+  StringView body = FileTailRead(&ingest->tail, &ingest->lines, &lines_offset);
+  // read from the start again, while we have rows: even an empty file
+  // replaces them
+  if (lines_offset == 0 && (body.size > 0 || ingest->store.size > 0)) {
+    TailReloadFile(ingest, body);
+    return 0;
+  }
+  if (body.size == 0) return 0;
+  // only this thread replaces the book
+  SwapBook *book = context->book;
+  size_t first_row = ingest->store.size;
+  size_t n_added = IngestCSVBody(&context->worker_pool, body,
+                                 &context->colnames.plan, &ingest->store);
+  StagedEvents staged;
+  SwapBookApplyEvents(book, first_row, ingest->store.size, &staged);
+  SwapBookPublishEvents(book, &staged);
+  ReportBadCells(context->filename);
+  if (SwapBookWantsCompaction(book, ingest->store.size)) {
+    ReplaceBook(context, SwapBookCompact(book, ingest->store.size));
+    ingest->store = context->book->store;
+    printf("Compacted to %zu live swaps\n", ingest->store.size);
+  }
+  // only now can every query see the new rows
+  BumpDataVersion(context);
+  return n_added;
+}
+
+void *TailIngestThread(void *arg) {
+  TailIngest *ingest = arg;
+  do {
+    size_t n_added = TailIngestLines(ingest);
+    if (n_added > 0)
+      printf("%zu swaps appended from %s\n", n_added,
+             ingest->context->filename);
+  } while (FileTailWait(&ingest->tail) == 0);
+  return NULL;
+}
+
+// Follows the file from where the startup load stopped. Uses the context's
+// worker pool, which the search workers don't.
+void TailIngestStart(TailIngest *ingest, StartupContext *context) {
+  memset(ingest, 0, sizeof(TailIngest));
+  ingest->context = context;
+  ingest->store = context->book->store;
+  FileTailInit(&ingest->tail, context->filename, context->file_offset);
+  if (pthread_create(&ingest->thread, NULL, TailIngestThread, ingest) != 0)
+    Die("TailIngestStart - pthread_create");
+}
+
+void TailIngestStop(TailIngest *ingest) {
+  FileTailStop(&ingest->tail);
+  pthread_join(ingest->thread, NULL);
+  FileTailFree(&ingest->tail);
+  IOBufferFree(&ingest->lines);
+}
+
+int LaunchServer(const ServerConfig *config) {
+  InitSearchKernels();
+  InitCSVKernels();
+  StartupContext context = {0};
+  StartWorkers(&context, config);
+  LoadFileOnStartup(&context);
+  int sock = ListenOn(config->port_no, config->queue_size);
+  if (sock < 0) Die("LaunchServer - listen");
+  SearchServer server;
+  SearchServerInit(&server, &context, config, sock);
+  printf("Serving on port %d: %zu IO threads, %zu search workers of %zu "
+         "threads, request queue of %zu\n",
+         config->port_no, config->n_io_threads, config->n_search_workers,
+         SearchWorkerThreads(config), server.queue.mask + 1);
+  TailIngest ingest;
+  if (config->tail) TailIngestStart(&ingest, &context);
+  SearchServerRun(&server);
+  if (config->tail) TailIngestStop(&ingest);
+  SearchServerFree(&server);
+  FreeStartupContext(&context);
 
   return 0;
 }
 
-int main() {
-  // int port_no = 9999;
-  // int queue_size = 10;
-  // LaunchServer(port_no, queue_size);
-  StartupContext context = LoadFileOnStartup();
-  Swap input_swap = {0};
-  const char *buffer = "Notional Amount 1:250000000;Ref Rate:USSOFR TERM;";
-  SwapFromInputLine(buffer);
-  Swap *nearest_swap =
-      GetNearestSwapL2(input_swap, context.swap_list.contents, context.swap_list.size);
-  StringBuffer response;
-  StringInit(&response);
-  SwapToListString(&response, nearest_swap);
-  printf("%s\n", response.string);
+// the tests include this file for everything but main
+#ifndef SERVER_NO_MAIN
+int main(int argc, char **argv) {
+  ServerConfig config = ParseServerArgs(argc, argv);
+  if (config.serve) return LaunchServer(&config);
+  InitSearchKernels();
+  InitCSVKernels();
+  StartupContext context = {0};
+  StartWorkers(&context, &config);
+  LoadFileOnStartup(&context);
+  const char *buffer = "Notional Amount 1:250000000;Ref Rate:USSOFR TERM;K:5;";
+  SearchQuery query = QueryFromInputLine(buffer);
+  TopK top_k;
+  TopKInit(&top_k, query.k);
+  SearchNearestSwaps(&query, &context, context.book, &context.worker_pool,
+                    &top_k);
+  IOBuffer response = {0};
+  MatchesToText(&response, &context.book->store, &top_k);
+  fwrite(response.data, 1, response.size, stdout);
+  printf("\n");
+  IOBufferFree(&response);
+  TopKFree(&top_k);
+  FreeStartupContext(&context);
   return 0;
 }
+#endif
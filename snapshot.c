@@ -0,0 +1,273 @@
+/*** Binary snapshots ***/
+// The parsed store and its indexes, written after a CSV load so that the
+// next start can map them back instead of reparsing. The file is a header
+// followed by sections (column names, store columns, k-d tree nodes, category
+// bitmaps, range indexes and zone maps), each starting on a SNAPSHOT_ALIGN
+// boundary so that the loaded structures can point straight into the
+// mapping. The alignment is a page on every platform we run on (16K on arm64
+// macOS): store columns are mapped page by page over the start of their arena
+// ranges, which keeps them growable.
+#define SNAPSHOT_MAGIC "SWAPSNAP"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_ALIGN 16384
+#define SNAPSHOT_FIRST_COLUMN 1  // sections after the column names
+#define MAX_SNAPSHOT_SECTIONS \
+  (1 + SWAP_STORE_N_COLUMNS + 1 + N_CATEGORY_FIELDS * MAX_CATEGORY_VALUES + \
+   3 * N_RANGE_FIELDS)
+
+// What the snapshot was built from. A snapshot only matches the same file
+// (size and modification time) loaded with the same row cap.
+typedef struct SnapshotSource {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t max_rows;
+} SnapshotSource;
+
+typedef struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t kd_node_size;  // catches layout changes without a version bump
+  uint32_t n_sections;
+  SnapshotSource source;
+  uint64_t colnames_size;
+  uint64_t n_rows;
+  uint64_t kd_n_nodes;
+  uint64_t kd_n_rows;
+  uint64_t file_size;
+  uint64_t checksum;  // of every section, see SnapshotChecksum
+} SnapshotHeader;
+
+typedef struct SnapshotSection {
+  void **data;
+  size_t size;
+} SnapshotSection;
+
+// Source identity of a file, -1 if it can't be stat'ed
+int SnapshotSourceFromFile(SnapshotSource *source, const char *filename,
+                           size_t max_rows) {
+  struct stat file_stat;
+  if (stat(filename, &file_stat) < 0) return -1;
+  source->size = file_stat.st_size;
+  source->mtime = file_stat.st_mtime;
+  source->max_rows = max_rows;
+  return 0;
+}
+
+size_t SnapshotAlign(size_t offset) {
+  return (offset + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+// FNV-1a over 64-bit words, the last partial word padded with zeros
+uint64_t SnapshotChecksum(uint64_t checksum, const void *data, size_t size) {
+  const char *bytes = data;
+  size_t n_words = size / 8;
+  for (size_t i = 0; i < n_words; i++) {
+    uint64_t word;
+    memcpy(&word, bytes + 8 * i, 8);
+    checksum = (checksum ^ word) * 0x100000001b3ULL;
+  }
+  if (size % 8 != 0) {
+    uint64_t word = 0;
+    memcpy(&word, bytes + 8 * n_words, size % 8);
+    checksum = (checksum ^ word) * 0x100000001b3ULL;
+  }
+  return checksum;
+}
+
+// The sections in file order, sized from the counts already set in store,
+// tree and indexes. Returns the number of sections.
+size_t SnapshotSections(SnapshotSection *sections, char **colnames,
+                        size_t colnames_size, SwapStore *store, KdTree *tree,
+                        CategoryIndex *index, RangeIndex *ranges) {
+  size_t n = 0;
+  size_t n_rows = store->size;
+#define SNAPSHOT_SECTION(pointer, section_size)  \
+  do {                                           \
+    sections[n].data = (void **)&(pointer);      \
+    sections[n].size = (section_size);           \
+    n++;                                         \
+  } while (0)
+  SNAPSHOT_SECTION(*colnames, colnames_size);
+  // store columns from SNAPSHOT_FIRST_COLUMN on, in arena order
+  SwapColumn columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(store, columns);
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    SNAPSHOT_SECTION(*columns[i].data, n_rows * columns[i].elem_size);
+  }
+  SNAPSHOT_SECTION(tree->nodes, tree->n_nodes * sizeof(KdNode));
+  for (int field = 0; field < N_CATEGORY_FIELDS; field++) {
+    for (int value = 0; value < category_n_values[field]; value++) {
+      SNAPSHOT_SECTION(index->bitmaps[field][value],
+                       (BITMAP_WORDS(index->n_rows) + 1) * sizeof(uint64_t));
+    }
+  }
+  size_t n_zones = RangeZones(ranges->n_rows);
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    SNAPSHOT_SECTION(ranges->sorted[field], ranges->n_rows * sizeof(uint32_t));
+    SNAPSHOT_SECTION(ranges->zone_min[field], n_zones * sizeof(double));
+    SNAPSHOT_SECTION(ranges->zone_max[field], n_zones * sizeof(double));
+  }
+#undef SNAPSHOT_SECTION
+  return n;
+}
+
+// Writes the snapshot next to its final name and renames it into place, so a
+// crash mid-write never leaves a truncated snapshot behind. Returns 0 on
+// success, -1 on failure.
+int SnapshotWrite(const char *filename, const SnapshotSource *source,
+                  const char *colnames, size_t colnames_size,
+                  const SwapStore *store, const KdTree *tree,
+                  const CategoryIndex *index, const RangeIndex *ranges) {
+  char tmp_filename[4096];
+  if (snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename) >=
+      (int)sizeof(tmp_filename))
+    return -1;
+  // the sections are only read from
+  SnapshotSection sections[MAX_SNAPSHOT_SECTIONS];
+  char *colnames_p = (char *)colnames;
+  size_t n_sections =
+      SnapshotSections(sections, &colnames_p, colnames_size,
+                       (SwapStore *)store, (KdTree *)tree,
+                       (CategoryIndex *)index, (RangeIndex *)ranges);
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(SnapshotHeader));
+  memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+  header.version = SNAPSHOT_VERSION;
+  header.header_size = sizeof(SnapshotHeader);
+  header.kd_node_size = sizeof(KdNode);
+  header.n_sections = n_sections;
+  header.source = *source;
+  header.colnames_size = colnames_size;
+  header.n_rows = store->size;
+  header.kd_n_nodes = tree->n_nodes;
+  header.kd_n_rows = tree->n_rows;
+  header.checksum = 0xcbf29ce484222325ULL;
+  FILE *handler = fopen(tmp_filename, "wb");
+  if (!handler) return -1;
+  static const char padding[SNAPSHOT_ALIGN] = {0};
+  size_t offset = SnapshotAlign(sizeof(SnapshotHeader));
+  int failed = fseek(handler, offset, SEEK_SET) != 0;
+  for (size_t i = 0; i < n_sections && !failed; i++) {
+    const void *data = *sections[i].data;
+    size_t size = sections[i].size;
+    size_t padded_size = SnapshotAlign(size);
+    header.checksum = SnapshotChecksum(header.checksum, data, size);
+    failed = (size > 0 && fwrite(data, 1, size, handler) != size) ||
+             fwrite(padding, 1, padded_size - size, handler) !=
+                 padded_size - size;
+    offset += padded_size;
+  }
+  header.file_size = offset;
+  failed = failed || fseek(handler, 0, SEEK_SET) != 0 ||
+           fwrite(&header, sizeof(SnapshotHeader), 1, handler) != 1;
+  failed = (fclose(handler) != 0) || failed;
+  if (failed || rename(tmp_filename, filename) != 0) {
+    remove(tmp_filename);
+    return -1;
+  }
+  return 0;
+}
+
+// Maps the column sections of the snapshot over the start of the store's
+// arena ranges, returns 0 on success
+int SnapshotMapColumns(const char *filename, const size_t *offsets,
+                       SwapStore *store) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return -1;
+  SwapColumn columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(store, columns);
+  int failed = 0;
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS && !failed; i++) {
+    size_t size = SnapshotAlign(store->size * columns[i].elem_size);
+    if (size == 0) continue;
+    void *column = mmap(*columns[i].data, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED, fd, offsets[i]);
+    failed = column == MAP_FAILED;
+  }
+  close(fd);
+  return failed ? -1 : 0;
+}
+
+// Maps a snapshot. The store gets a fresh arena (of source->max_rows rows)
+// with the column pages mapped from the file, colnames, tree and indexes point
+// into the whole-file mapping. Fails (-1, nothing mapped) when the file is
+// missing, from another version, built from a different source or corrupt.
+// The mappings are private and writable: pages that get written to are
+// copied and never reach the file.
+int SnapshotMap(const char *filename, const SnapshotSource *source,
+                MappedFile *file, const char **colnames, size_t *colnames_size,
+                SwapStore *store, KdTree *tree, CategoryIndex *index,
+                RangeIndex *ranges) {
+  if (MapFileWithAccess(file, filename, PROT_READ | PROT_WRITE,
+                        MADV_WILLNEED) != 0)
+    return -1;
+  SnapshotHeader header;
+  if (file->size < sizeof(SnapshotHeader)) {
+    UnmapFile(file);
+    return -1;
+  }
+  memcpy(&header, file->data, sizeof(SnapshotHeader));
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, 8) != 0 ||
+      header.version != SNAPSHOT_VERSION ||
+      header.header_size != sizeof(SnapshotHeader) ||
+      header.kd_node_size != sizeof(KdNode) ||
+      header.file_size != file->size ||
+      header.source.size != source->size ||
+      header.source.mtime != source->mtime ||
+      header.source.max_rows != source->max_rows ||
+      header.n_rows > source->max_rows) {
+    UnmapFile(file);
+    return -1;
+  }
+  // point everything into the file mapping first, to check the sections
+  SwapStore mapped_store;
+  memset(&mapped_store, 0, sizeof(SwapStore));
+  memset(tree, 0, sizeof(KdTree));
+  memset(index, 0, sizeof(CategoryIndex));
+  memset(ranges, 0, sizeof(RangeIndex));
+  mapped_store.size = header.n_rows;
+  tree->n_nodes = tree->capacity = header.kd_n_nodes;
+  tree->n_rows = header.kd_n_rows;
+  index->n_rows = header.n_rows;
+  ranges->n_rows = header.n_rows;
+  char *colnames_p = NULL;
+  SnapshotSection sections[MAX_SNAPSHOT_SECTIONS];
+  size_t n_sections = SnapshotSections(sections, &colnames_p,
+                                       header.colnames_size, &mapped_store,
+                                       tree, index, ranges);
+  size_t offsets[MAX_SNAPSHOT_SECTIONS];
+  uint64_t checksum = 0xcbf29ce484222325ULL;
+  size_t offset = SnapshotAlign(sizeof(SnapshotHeader));
+  int failed = n_sections != header.n_sections;
+  for (size_t i = 0; i < n_sections && !failed; i++) {
+    size_t size = sections[i].size;
+    if (offset + size > file->size) {
+      failed = 1;
+      break;
+    }
+    offsets[i] = offset;
+    *sections[i].data = (char *)file->data + offset;
+    checksum = SnapshotChecksum(checksum, *sections[i].data, size);
+    offset += SnapshotAlign(size);
+  }
+  failed = failed || offset != file->size || checksum != header.checksum;
+  if (!failed) {
+    SwapStoreInit(store, source->max_rows);
+    SwapStoreReserve(store, header.n_rows);
+    store->size = header.n_rows;
+    failed = SnapshotMapColumns(filename, &offsets[SNAPSHOT_FIRST_COLUMN],
+                                store) != 0;
+    if (failed) SwapStoreFree(store);
+  }
+  if (failed) {
+    memset(tree, 0, sizeof(KdTree));
+    memset(index, 0, sizeof(CategoryIndex));
+    memset(ranges, 0, sizeof(RangeIndex));
+    UnmapFile(file);
+    return -1;
+  }
+  *colnames = colnames_p;
+  *colnames_size = header.colnames_size;
+  return 0;
+}
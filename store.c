@@ -0,0 +1,170 @@
+/*** Columnar swap store ***/
+// One contiguous array per attribute, so the search path only pulls the
+// columns it actually scores through cache instead of whole Swap structs.
+// The columns are carved out of one reserved range of address space (the
+// arena), each with room for max_rows rows. Pages are committed a chunk of
+// rows at a time as the store grows, so appending never moves a row and
+// memory tracks the rows actually held rather than the reservation.
+#include <sys/mman.h>
+
+#define SWAP_STORE_MAX_ROWS ((size_t)1 << 28)
+#define SWAP_STORE_CHUNK_ROWS ((size_t)1 << 16)
+#define SWAP_STORE_N_COLUMNS 15
+
+typedef struct SwapStore {
+  size_t size;
+  size_t capacity;  // committed rows, a multiple of SWAP_STORE_CHUNK_ROWS
+  size_t max_rows;  // reserved rows
+  char *arena;
+  size_t arena_size;
+  long *id;
+  int32_t *start_day;   // days since 1970-01-01
+  int32_t *end_day;     // days since 1970-01-01
+  int64_t *trade_time;  // seconds since 1970-01-01T00:00:00
+  float *fixed_rate;
+  float *notional;
+  uint8_t *ref_rate;
+  uint8_t *fixed_pay_freq;
+  uint8_t *float_pay_freq;
+  uint8_t *currency;
+  uint8_t *action_type;
+  uint8_t *transaction_type;
+  uint8_t *is_block_trade;
+  uint8_t *venue;
+  long *original_id;
+} SwapStore;
+
+typedef struct SwapColumn {
+  void **data;
+  size_t elem_size;
+} SwapColumn;
+
+// Every column of the store, in arena order
+void SwapStoreColumns(SwapStore *store, SwapColumn *columns) {
+  SwapColumn all_columns[SWAP_STORE_N_COLUMNS] = {
+      {(void **)&store->id, sizeof(long)},
+      {(void **)&store->start_day, sizeof(int32_t)},
+      {(void **)&store->end_day, sizeof(int32_t)},
+      {(void **)&store->trade_time, sizeof(int64_t)},
+      {(void **)&store->fixed_rate, sizeof(float)},
+      {(void **)&store->notional, sizeof(float)},
+      {(void **)&store->ref_rate, 1},
+      {(void **)&store->fixed_pay_freq, 1},
+      {(void **)&store->float_pay_freq, 1},
+      {(void **)&store->currency, 1},
+      {(void **)&store->action_type, 1},
+      {(void **)&store->transaction_type, 1},
+      {(void **)&store->is_block_trade, 1},
+      {(void **)&store->venue, 1},
+      {(void **)&store->original_id, sizeof(long)}};
+  memcpy(columns, all_columns, sizeof(all_columns));
+}
+
+// Reserves room for max_rows rows without committing any memory
+void SwapStoreInit(SwapStore *store, size_t max_rows) {
+  memset(store, 0, sizeof(SwapStore));
+  store->max_rows = (max_rows + SWAP_STORE_CHUNK_ROWS - 1) /
+                    SWAP_STORE_CHUNK_ROWS * SWAP_STORE_CHUNK_ROWS;
+  SwapColumn columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(store, columns);
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    store->arena_size += store->max_rows * columns[i].elem_size;
+  }
+  if (store->arena_size == 0) return;
+  void *arena = mmap(NULL, store->arena_size, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (arena == MAP_FAILED) Die("SwapStoreInit - mmap");
+  store->arena = arena;
+  // every column starts on a chunk, hence page, boundary
+  size_t offset = 0;
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    *columns[i].data = store->arena + offset;
+    offset += store->max_rows * columns[i].elem_size;
+  }
+}
+
+// Commits memory for at least n_rows rows, existing rows stay where they are
+void SwapStoreReserve(SwapStore *store, size_t n_rows) {
+  if (n_rows <= store->capacity) return;
+  if (n_rows > store->max_rows) Die("SwapStoreReserve - store is full");
+  size_t new_capacity = (n_rows + SWAP_STORE_CHUNK_ROWS - 1) /
+                        SWAP_STORE_CHUNK_ROWS * SWAP_STORE_CHUNK_ROWS;
+  SwapColumn columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(store, columns);
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    char *column = *columns[i].data;
+    size_t elem_size = columns[i].elem_size;
+    if (mprotect(column + store->capacity * elem_size,
+                 (new_capacity - store->capacity) * elem_size,
+                 PROT_READ | PROT_WRITE) != 0)
+      Die("SwapStoreReserve - mprotect");
+  }
+  store->capacity = new_capacity;
+}
+
+void SwapStoreFree(SwapStore *store) {
+  if (store->arena_size > 0) munmap(store->arena, store->arena_size);
+  memset(store, 0, sizeof(SwapStore));
+}
+
+// Scatter a parsed swap into the columns of an existing row
+void SwapStoreSet(SwapStore *store, size_t row, const Swap *swap_p) {
+  store->id[row] = swap_p->id;
+  store->start_day[row] = swap_p->start_day;
+  store->end_day[row] = swap_p->end_day;
+  store->trade_time[row] = swap_p->trade_time;
+  store->fixed_rate[row] = swap_p->fixed_rate;
+  store->notional[row] = swap_p->notional;
+  store->ref_rate[row] = swap_p->ref_rate;
+  store->fixed_pay_freq[row] = swap_p->fixed_pay_freq;
+  store->float_pay_freq[row] = swap_p->float_pay_freq;
+  store->currency[row] = swap_p->currency;
+  store->action_type[row] = swap_p->action_type;
+  store->transaction_type[row] = swap_p->transaction_type;
+  store->is_block_trade[row] = swap_p->is_block_trade;
+  store->venue[row] = swap_p->venue;
+  store->original_id[row] = swap_p->original_id;
+}
+
+// Copies row from_row of from over row to_row of to, which may be the same
+// store
+void SwapStoreCopyRow(SwapStore *to, size_t to_row, SwapStore *from,
+                      size_t from_row) {
+  SwapColumn to_columns[SWAP_STORE_N_COLUMNS];
+  SwapColumn from_columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(to, to_columns);
+  SwapStoreColumns(from, from_columns);
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    size_t elem_size = to_columns[i].elem_size;
+    memcpy((char *)*to_columns[i].data + to_row * elem_size,
+           (char *)*from_columns[i].data + from_row * elem_size, elem_size);
+  }
+}
+
+// Returns the row the swap was written to
+size_t SwapStoreAppend(SwapStore *store, const Swap *swap_p) {
+  if (store->size == store->capacity) SwapStoreReserve(store, store->size + 1);
+  size_t row = store->size++;
+  SwapStoreSet(store, row, swap_p);
+  return row;
+}
+
+// Reorder the rows so that row i is the old row order[i]. Done in place one
+// column at a time, so the extra memory is a single column.
+void SwapStorePermute(SwapStore *store, const size_t *order) {
+  size_t n = store->size;
+  SwapColumn columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(store, columns);
+  char *old_column = malloc(n * sizeof(int64_t));
+  if (n > 0 && !old_column) Die("SwapStorePermute - malloc");
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    char *column = *columns[i].data;
+    size_t elem_size = columns[i].elem_size;
+    memcpy(old_column, column, n * elem_size);
+    for (size_t row = 0; row < n; row++) {
+      memcpy(column + row * elem_size, old_column + order[row] * elem_size,
+             elem_size);
+    }
+  }
+  free(old_column);
+}
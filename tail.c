@@ -0,0 +1,160 @@
+/*** Following a growing file ***/
+// The SDR file keeps getting lines appended during the day. A FileTail
+// remembers how far into the file it has read and hands out the complete
+// lines added since, leaving a line that is still being written for next
+// time. inotify says when the file changed where we have it (Linux); the
+// file is also checked on a timer, which is all there is elsewhere and
+// catches a file that is created or replaced. A file that shrinks or is
+// replaced by another one is read again from the start.
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#define HAVE_INOTIFY
+#endif
+
+#define TAIL_CHECK_INTERVAL_MS 1000
+
+typedef struct FileTail {
+  const char *filename;
+  size_t offset;  // bytes handed out so far
+  dev_t device;   // of the file being followed
+  ino_t inode;
+  int notify_fd;  // -1 without inotify
+  int watch;      // -1 while the file isn't watched
+  int stop_fds[2];
+} FileTail;
+
+// Size of the lines of data that are complete: up to and including the last
+// line break outside quotes
+size_t CompleteLinesSize(const char *data, size_t size) {
+  size_t complete_size = 0;
+  int open_quotes = 0;
+  const char *cursor = data;
+  const char *data_end = data + size;
+  const char *newline;
+  while (cursor < data_end &&
+         (newline = memchr(cursor, '\n', data_end - cursor))) {
+    open_quotes ^= QuoteParity(cursor, newline - cursor);
+    if (!open_quotes) complete_size = newline + 1 - data;
+    cursor = newline + 1;
+  }
+  return complete_size;
+}
+
+// Follows filename from offset, the bytes before it having been read already
+void FileTailInit(FileTail *tail, const char *filename, size_t offset) {
+  memset(tail, 0, sizeof(FileTail));
+  tail->filename = filename;
+  tail->offset = offset;
+  struct stat file_stat;
+  if (stat(filename, &file_stat) == 0) {
+    tail->device = file_stat.st_dev;
+    tail->inode = file_stat.st_ino;
+  }
+  if (pipe(tail->stop_fds) != 0) Die("FileTailInit - pipe");
+  tail->notify_fd = -1;
+  tail->watch = -1;
+#ifdef HAVE_INOTIFY
+  tail->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+void FileTailFree(FileTail *tail) {
+  if (tail->notify_fd >= 0) close(tail->notify_fd);
+  close(tail->stop_fds[0]);
+  close(tail->stop_fds[1]);
+}
+
+// Makes FileTailWait return -1, from any thread
+void FileTailStop(FileTail *tail) {
+  char byte = 0;
+  if (write(tail->stop_fds[1], &byte, 1) < 0) Die("FileTailStop - write");
+}
+
+#ifdef HAVE_INOTIFY
+// Drops the watch once the file it was on is gone, the next wait watches
+// whatever is at the path by then
+void FileTailDrainEvents(FileTail *tail) {
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t n_read;
+  while ((n_read = read(tail->notify_fd, events, sizeof(events))) > 0) {
+    for (char *cursor = events; cursor < events + n_read;) {
+      const struct inotify_event *event = (const struct inotify_event *)cursor;
+      if (event->wd == tail->watch &&
+          (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))) {
+        inotify_rm_watch(tail->notify_fd, tail->watch);
+        tail->watch = -1;
+      }
+      cursor += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+#endif
+
+// Waits until the file may have grown, or for the next timed check. Returns
+// -1 once stopped.
+int FileTailWait(FileTail *tail) {
+  struct pollfd fds[2];
+  int n_fds = 0;
+  fds[n_fds].fd = tail->stop_fds[0];
+  fds[n_fds++].events = POLLIN;
+#ifdef HAVE_INOTIFY
+  if (tail->notify_fd >= 0 && tail->watch < 0)
+    tail->watch = inotify_add_watch(
+        tail->notify_fd, tail->filename,
+        IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  if (tail->watch >= 0) {
+    fds[n_fds].fd = tail->notify_fd;
+    fds[n_fds++].events = POLLIN;
+  }
+#endif
+  if (poll(fds, n_fds, TAIL_CHECK_INTERVAL_MS) < 0 && errno != EINTR)
+    Die("FileTailWait - poll");
+  if (fds[0].revents) return -1;
+#ifdef HAVE_INOTIFY
+  if (n_fds > 1 && fds[1].revents) FileTailDrainEvents(tail);
+#endif
+  return 0;
+}
+
+// Reads the complete lines added since the last call into lines, and returns
+// them (empty when there are none yet). *lines_offset gets where they start
+// in the file, 0 when it is being read from the start again.
+StringView FileTailRead(FileTail *tail, IOBuffer *lines,
+                        size_t *lines_offset) {
+  StringView view = {lines->data, 0};
+  lines->size = 0;
+  *lines_offset = tail->offset;
+  int fd = open(tail->filename, O_RDONLY);
+  if (fd < 0) return view;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0) {
+    close(fd);
+    return view;
+  }
+  size_t file_size = file_stat.st_size;
+  if (file_stat.st_dev != tail->device || file_stat.st_ino != tail->inode ||
+      file_size < tail->offset) {
+    if (tail->offset > 0)
+      printf("%s was replaced, reading it from the start\n", tail->filename);
+    tail->device = file_stat.st_dev;
+    tail->inode = file_stat.st_ino;
+    tail->offset = 0;
+    *lines_offset = 0;
+  }
+  IOBufferReserve(lines, file_size - tail->offset);
+  while (lines->size < file_size - tail->offset) {
+    ssize_t n_read = pread(fd, lines->data + lines->size,
+                           file_size - tail->offset - lines->size,
+                           tail->offset + lines->size);
+    if (n_read < 0 && errno == EINTR) continue;
+    if (n_read <= 0) break;
+    lines->size += n_read;
+  }
+  close(fd);
+  view.data = lines->data;
+  view.size = CompleteLinesSize(lines->data, lines->size);
+  tail->offset += view.size;
+  return view;
+}
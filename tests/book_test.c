@@ -0,0 +1,163 @@
+// SwapBookApplyEvents: CANCEL and CORRECT events leave the same trades live,
+// under the same ids, whether they are applied in place on startup or as
+// tombstones by the tail, and after the book is compacted. A correction by
+// the tail takes its trade over only once it is published.
+#define MIN_INGEST_CHUNK_SIZE 64
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define FIRST_ID 900000000
+#define N_TRADES 8
+#define FIRST_FILLER_ID 2000
+#define N_FILLERS 1100  // enough unindexed rows to compact the book
+
+typedef struct TestEvent {
+  long id;
+  long original_id;  // 0 for none
+  const char *action;
+} TestEvent;
+
+// After trades [1, N_TRADES] are in, applied in this order
+const TestEvent test_events[] = {
+    {101, 1, "CORRECT"},
+    {102, 2, "CANCEL"},
+    {103, 2, "CORRECT"},  // of a cancelled trade
+    {105, 4, "CANCEL"},
+    {107, 5, "CORRECT"},
+    {108, 107, "CANCEL"},  // of a corrected trade, by its correction's id
+    {104, 9, "CANCEL"},    // before the trade it is about
+    {9, 0, "NEW"}};
+
+typedef struct TestTrade {
+  long id;
+  long row_id;  // Dissemination ID of the row SwapBookFind gives, 0 for none
+} TestTrade;
+
+const TestTrade test_trades[] = {
+    {1, 101}, {101, 101}, {2, 103}, {102, 0}, {103, 103}, {3, 3},
+    {4, 0},   {105, 0},   {5, 0},   {107, 0}, {108, 0},   {6, 6},
+    {7, 7},   {8, 8},     {9, 9},   {104, 0}};
+
+#define N_LIVE_TRADES 7
+
+void AppendTrades(IOBuffer *csv, uint64_t *state) {
+  for (long id = 1; id <= N_TRADES; id++) {
+    AppendTestCSVLine(csv, FIRST_ID + id, 0, "NEW", state);
+  }
+}
+
+void AppendEvents(IOBuffer *csv, uint64_t *state) {
+  for (size_t i = 0; i < sizeof(test_events) / sizeof(TestEvent); i++) {
+    const TestEvent *event = &test_events[i];
+    long original_id = event->original_id ? FIRST_ID + event->original_id : 0;
+    AppendTestCSVLine(csv, FIRST_ID + event->id, original_id, event->action,
+                      state);
+  }
+}
+
+void AppendFillers(IOBuffer *csv, uint64_t *state) {
+  for (long id = 0; id < N_FILLERS; id++) {
+    AppendTestCSVLine(csv, FIRST_ID + FIRST_FILLER_ID + id, 0, "NEW", state);
+  }
+}
+
+// The trades of test_trades, and n_fillers more, are live, and every live
+// row is found by its own id
+void CheckTrades(TestServer *server, size_t n_fillers) {
+  SwapBook *book = AcquireBook(&server->context);
+  SwapStore store = PublishedStore(book);
+  for (size_t i = 0; i < sizeof(test_trades) / sizeof(TestTrade); i++) {
+    const TestTrade *trade = &test_trades[i];
+    size_t row = SwapBookFind(book, FIRST_ID + trade->id);
+    if (trade->row_id == 0) {
+      CHECK(row == ID_NOT_FOUND);
+    } else {
+      CHECK(row != ID_NOT_FOUND && store.id[row] == FIRST_ID + trade->row_id);
+    }
+  }
+  size_t n_live = 0;
+  for (size_t row = 0; row < store.size; row++) {
+    if (!SwapBookIsLive(book, row)) continue;
+    n_live++;
+    CHECK(SwapBookFind(book, store.id[row]) == row);
+  }
+  CHECK(n_live == N_LIVE_TRADES + n_fillers);
+  CHECK(store.size - book->n_dead == n_live);
+  CHECK(RollupsCount(book) == (int64_t)n_live);
+  ReleaseBook(&server->context, book);
+}
+
+// The tail stages a correction, then publishes it: until then the trade is
+// found at its old row, and after, at the correction's
+void CheckStagedCorrection(TestServer *server, uint64_t *state) {
+  StartupContext *context = &server->context;
+  TailIngest *ingest = &server->ingest;
+  SwapBook *book = context->book;
+  size_t row = SwapBookFind(book, FIRST_ID + 1);
+  int64_t n_rollup_rows = RollupsCount(book);
+  CHECK(row != ID_NOT_FOUND);
+  IOBuffer csv = {0};
+  AppendTestCSVLine(&csv, FIRST_ID + 101, FIRST_ID + 1, "CORRECT", state);
+  StringView body = {csv.data, csv.size};
+  size_t first_row = ingest->store.size;
+  IngestCSVBody(&context->worker_pool, body, &context->colnames.plan,
+                &ingest->store);
+  StagedEvents staged;
+  SwapBookApplyEvents(book, first_row, ingest->store.size, &staged);
+  CHECK(SwapBookFind(book, FIRST_ID + 1) == row);
+  CHECK(SwapBookFind(book, FIRST_ID + 101) == ID_NOT_FOUND);
+  CHECK(RollupsCount(book) == n_rollup_rows);
+  SwapBookPublishEvents(book, &staged);
+  CHECK(!SwapBookIsLive(book, row));
+  CHECK(SwapBookFind(book, FIRST_ID + 1) == first_row);
+  CHECK(SwapBookFind(book, FIRST_ID + 101) == first_row);
+  CHECK(RollupsCount(book) == n_rollup_rows);
+  IOBufferFree(&csv);
+}
+
+int main() {
+  InitSearchKernels();
+  InitCSVKernels();
+  uint64_t state = 0x2545f4914f6cdd1dULL;
+  IOBuffer csv = {0};
+  TestServer server;
+
+  // in place, on startup
+  AppendText(&csv, test_csv_header);
+  AppendTrades(&csv, &state);
+  AppendEvents(&csv, &state);
+  TestServerStart(&server, "book_test", &csv);
+  CheckTrades(&server, 0);
+  TestServerStop(&server);
+
+  // as tombstones, by the tail, then compacted
+  csv.size = 0;
+  AppendText(&csv, test_csv_header);
+  AppendTrades(&csv, &state);
+  TestServerStart(&server, "book_test", &csv);
+  csv.size = 0;
+  AppendEvents(&csv, &state);
+  WriteTestFile(server.filename, &csv, 1);
+  TailIngestLines(&server.ingest);
+  CHECK(server.context.book->kd_tree.n_rows == N_TRADES);
+  CheckTrades(&server, 0);
+  csv.size = 0;
+  AppendFillers(&csv, &state);
+  WriteTestFile(server.filename, &csv, 1);
+  TailIngestLines(&server.ingest);
+  CHECK(server.context.book->n_dead == 0);
+  CheckTrades(&server, N_FILLERS);
+  TestServerStop(&server);
+
+  // a correction by the tail, looked up before and after it is published
+  csv.size = 0;
+  AppendText(&csv, test_csv_header);
+  AppendTrades(&csv, &state);
+  TestServerStart(&server, "book_test", &csv);
+  CheckStagedCorrection(&server, &state);
+  TestServerStop(&server);
+
+  IOBufferFree(&csv);
+  return CheckResult("book_test");
+}
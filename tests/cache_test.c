@@ -0,0 +1,141 @@
+// AnswerSearchJob: a cached response is served until the data changes, and
+// never after a tail append, a CANCEL, a CORRECT or a compaction. Text and
+// binary requests for the same query are kept apart.
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define FIRST_ID 700000000
+#define N_TRADES 50
+#define N_FILLERS 1100  // enough unindexed rows to compact the book
+#define TEST_QUERY "Notional Amount 1:250,000,000;Fixed Rate 2:0.03;K:100;"
+
+typedef struct TestRequest {
+  int protocol;
+  char *request;
+  size_t request_size;
+} TestRequest;
+
+TestRequest TextRequest(void) {
+  TestRequest request = {PROTOCOL_TEXT, NULL, strlen(TEST_QUERY "\n")};
+  request.request = malloc(request.request_size + 1);
+  if (!request.request) Die("TextRequest - malloc");
+  memcpy(request.request, TEST_QUERY "\n", request.request_size + 1);
+  return request;
+}
+
+// TEST_QUERY packed as the client sends it
+TestRequest BinaryRequest(void) {
+  TestRequest request = {PROTOCOL_BINARY, NULL,
+                         sizeof(uint32_t) + BINARY_QUERY_SIZE};
+  request.request = calloc(request.request_size + 1, 1);
+  if (!request.request) Die("BinaryRequest - calloc");
+  WireWriteUint32(request.request, 1);
+  SearchQuery query = QueryFromInputLine(TEST_QUERY);
+  EncodeBinaryQuery(&query, request.request + sizeof(uint32_t));
+  return request;
+}
+
+// Answers the request as a search worker would, checks that the response
+// is the one the book gives now, and returns whether it came from the cache
+int Ask(TestServer *server, const TestRequest *request) {
+  StartupContext *context = &server->context;
+  SearchJob job = {0};
+  job.protocol = request->protocol;
+  job.request = request->request;
+  job.request_size = request->request_size;
+  size_t n_hits = ResponseCacheStats(&context->cache).n_hits;
+  IOBuffer output = {0};
+  AnswerSearchJob(&job, context, &context->worker_pool, &output);
+  int is_hit = ResponseCacheStats(&context->cache).n_hits > n_hits;
+  IOBuffer fresh = {0};
+  SwapBook *book = AcquireBook(context);
+  if (request->protocol == PROTOCOL_BINARY) {
+    AnswerBinaryRequest(request->request, request->request_size, context,
+                        book, &context->worker_pool, &fresh);
+  } else {
+    AnswerSearchRequest(request->request, context, book,
+                        &context->worker_pool, &fresh);
+  }
+  ReleaseBook(context, book);
+  size_t header_size =
+      request->protocol == PROTOCOL_TEXT ? 0 : FRAME_HEADER_SIZE;
+  CHECK(output.size == header_size + fresh.size &&
+        memcmp(output.data + header_size, fresh.data, fresh.size) == 0);
+  IOBufferFree(&output);
+  IOBufferFree(&fresh);
+  return is_hit;
+}
+
+// Writes the lines at the end of the file and loads them as the tail would
+void Append(TestServer *server, IOBuffer *lines) {
+  WriteTestFile(server->filename, lines, 1);
+  TailIngestLines(&server->ingest);
+  lines->size = 0;
+}
+
+// After a change to the data, the request is answered again, then served
+// from the cache until the next change
+void CheckAnsweredAgain(TestServer *server, const TestRequest *request) {
+  CHECK(!Ask(server, request));
+  CHECK(Ask(server, request));
+}
+
+int main() {
+  InitSearchKernels();
+  InitCSVKernels();
+  uint64_t state = 0x6a09e667f3bcc909ULL;
+  IOBuffer csv = {0};
+  AppendText(&csv, test_csv_header);
+  for (long id = 0; id < N_TRADES; id++) {
+    AppendTestCSVLine(&csv, FIRST_ID + id, 0, "NEW", &state);
+  }
+  TestServer server;
+  TestServerStart(&server, "cache_test", &csv);
+  csv.size = 0;
+  TestRequest text = TextRequest();
+  TestRequest binary = BinaryRequest();
+
+  // the same query over both protocols, an entry each
+  CheckAnsweredAgain(&server, &text);
+  CheckAnsweredAgain(&server, &binary);
+  CHECK(ResponseCacheStats(&server.context.cache).n_entries == 2);
+  CHECK(Ask(&server, &text));
+
+  AppendTestCSVLine(&csv, FIRST_ID + N_TRADES, 0, "NEW", &state);
+  Append(&server, &csv);
+  CheckAnsweredAgain(&server, &text);
+  CheckAnsweredAgain(&server, &binary);
+
+  AppendTestCSVLine(&csv, FIRST_ID + N_TRADES + 1, FIRST_ID + N_TRADES,
+                    "CANCEL", &state);
+  Append(&server, &csv);
+  CheckAnsweredAgain(&server, &text);
+  CheckAnsweredAgain(&server, &binary);
+
+  AppendTestCSVLine(&csv, FIRST_ID + N_TRADES + 2, FIRST_ID, "CORRECT",
+                    &state);
+  Append(&server, &csv);
+  CheckAnsweredAgain(&server, &text);
+  CheckAnsweredAgain(&server, &binary);
+
+  const SwapBook *book = server.context.book;
+  for (long id = 0; id < N_FILLERS; id++) {
+    AppendTestCSVLine(&csv, FIRST_ID + N_TRADES + 3 + id, 0, "NEW", &state);
+  }
+  Append(&server, &csv);
+  CHECK(server.context.book != book);
+  CheckAnsweredAgain(&server, &text);
+  CheckAnsweredAgain(&server, &binary);
+
+  // nothing new in the file, nothing to answer again
+  Append(&server, &csv);
+  CHECK(Ask(&server, &text));
+  CHECK(Ask(&server, &binary));
+
+  free(text.request);
+  free(binary.request);
+  IOBufferFree(&csv);
+  TestServerStop(&server);
+  return CheckResult("cache_test");
+}
@@ -0,0 +1,188 @@
+/*** Test checks ***/
+// Included by every test program, after the code under test (see the test
+// target of the Makefile). A failed check prints where it is and fails the
+// program, the checks after it still run.
+#include <stdio.h>
+
+int n_failed_checks = 0;
+
+#define CHECK(condition)                                                 \
+  do {                                                                   \
+    if (!(condition)) {                                                  \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #condition);                                               \
+      n_failed_checks++;                                                 \
+    }                                                                    \
+  } while (0)
+
+// The exit status of a test program
+int CheckResult(const char *test_name) {
+  if (n_failed_checks > 0) {
+    printf("%s: %d checks failed\n", test_name, n_failed_checks);
+    return EXIT_FAILURE;
+  }
+  printf("%s: ok\n", test_name);
+  return EXIT_SUCCESS;
+}
+
+/*** Random swaps ***/
+// Seeded, so that a failure reproduces (xorshift64*)
+uint64_t TestRandom(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
+
+size_t TestRandomBelow(uint64_t *state, size_t n) {
+  return TestRandom(state) % n;
+}
+
+// A swap like the SDR ones, each coordinate one of n_values values, so a small
+// n_values makes for many duplicate coordinates
+Swap RandomSwap(uint64_t *state, size_t n_values) {
+  Swap swap = {0};
+  swap.start_day = 19000 + TestRandomBelow(state, n_values);
+  swap.end_day = swap.start_day + 30 * (1 + TestRandomBelow(state, n_values));
+  swap.trade_time = 1640995200 + 3571 * TestRandomBelow(state, n_values);
+  swap.fixed_rate = 0.01f + 0.0005f * TestRandomBelow(state, n_values);
+  swap.notional = 1e6f * (1 + TestRandomBelow(state, n_values));
+  swap.ref_rate = 1 + TestRandomBelow(state, 3);
+  swap.fixed_pay_freq = 1 + TestRandomBelow(state, 4);
+  swap.float_pay_freq = 1 + TestRandomBelow(state, 4);
+  swap.currency = 1;
+  swap.action_type = NEW;
+  swap.transaction_type = TRADE;
+  swap.is_block_trade = 1 + TestRandomBelow(state, 2);
+  swap.venue = 1 + TestRandomBelow(state, 2);
+  return swap;
+}
+
+// Appends n_rows random swaps, with ids following the row numbers
+void AppendRandomSwaps(SwapStore *store, size_t n_rows, size_t n_values,
+                       uint64_t *state) {
+  for (size_t i = 0; i < n_rows; i++) {
+    Swap swap = RandomSwap(state, n_values);
+    swap.id = 100000 + store->size;
+    SwapStoreAppend(store, &swap);
+  }
+}
+
+// A target among the random swaps, with each coordinate left out (a weight
+// of 0) about one time in three
+SwapTarget RandomTarget(uint64_t *state, size_t n_values) {
+  Swap swap = RandomSwap(state, n_values);
+  if (TestRandomBelow(state, 3) == 0) swap.start_day = 0;
+  if (TestRandomBelow(state, 3) == 0) swap.end_day = 0;
+  if (TestRandomBelow(state, 3) == 0) swap.trade_time = 0;
+  if (TestRandomBelow(state, 3) == 0) swap.fixed_rate = 0;
+  if (TestRandomBelow(state, 3) == 0) swap.notional = 0;
+  return SwapTargetFromSwap(&swap);
+}
+
+/*** Test csv files ***/
+const char test_csv_header[] =
+    "\"Dissemination ID\",\"Original Dissemination ID\",\"Action\","
+    "\"Execution Timestamp\",\"Effective Date\",\"Expiration Date\","
+    "\"Notional Amount 1\",\"Leg 1 - Floating Rate Index\","
+    "\"Fixed Rate 2\",\"Payment Frequency Period 1\","
+    "\"Payment Frequency Period 2\",\"Transaction Type\"\n";
+
+void AppendText(IOBuffer *buffer, const char *text) {
+  IOBufferAppend(buffer, text, strlen(text));
+}
+
+// A line of the test csv, with its values drawn from state. An original_id
+// of 0 is left empty.
+void AppendTestCSVLine(IOBuffer *csv, long id, long original_id,
+                       const char *action, uint64_t *state) {
+  const char *ref_rates[] = {"USD-SOFR-COMPOUND", "USD-LIBOR-BBA",
+                             "USA-CPI-U"};
+  const char *periods[] = {"1M", "3M", "6M", "1Y"};
+  char original[32] = "";
+  if (original_id != 0) snprintf(original, sizeof(original), "%ld", original_id);
+  char line[512];
+  snprintf(line, sizeof(line),
+           "\"%ld\",\"%s\",\"%s\",\"2022-09-%02zuT%02zu:%02zu:38\","
+           "\"2022-09-12\",\"20%02zu-09-07\",\"%zu,000,000\",\"%s\","
+           "\"0.0%03zu\",\"%s\",\"%s\",\"Trade\"\n",
+           id, original, action, 1 + TestRandomBelow(state, 28),
+           TestRandomBelow(state, 24), TestRandomBelow(state, 60),
+           23 + TestRandomBelow(state, 30), 1 + TestRandomBelow(state, 500),
+           ref_rates[TestRandomBelow(state, 3)], TestRandomBelow(state, 999),
+           periods[TestRandomBelow(state, 4)],
+           periods[TestRandomBelow(state, 4)]);
+  AppendText(csv, line);
+}
+
+// Writes contents over the file, or at its end with append
+void WriteTestFile(const char *filename, const IOBuffer *contents,
+                   int append) {
+  FILE *file = fopen(filename, append ? "a" : "w");
+  if (!file) Die("WriteTestFile - fopen");
+  if (fwrite(contents->data, 1, contents->size, file) != contents->size)
+    Die("WriteTestFile - fwrite");
+  fclose(file);
+}
+
+/*** Test server ***/
+// The context of a server loading filename on startup, with its tail
+// following the file from there. TailIngestLines loads what was written to
+// it since, as the tail thread would.
+typedef struct TestServer {
+  StartupContext context;
+  TailIngest ingest;
+  char filename[64];
+  char snapshot_filename[64];
+} TestServer;
+
+// Loads the csv in contents, written to a file of its own
+void TestServerStart(TestServer *server, const char *name,
+                     const IOBuffer *contents) {
+  memset(server, 0, sizeof(TestServer));
+  snprintf(server->filename, sizeof(server->filename), "/tmp/%s_%d.csv",
+           name, (int)getpid());
+  snprintf(server->snapshot_filename, sizeof(server->snapshot_filename),
+           "/tmp/%s_%d.snapshot", name, (int)getpid());
+  unlink(server->snapshot_filename);
+  WriteTestFile(server->filename, contents, 0);
+  ServerConfig config = DefaultServerConfig();
+  config.n_threads = 4;
+  config.tail = 1;
+  StartWorkers(&server->context, &config);
+  LoadBook(&server->context, server->filename, server->snapshot_filename);
+  TailIngest *ingest = &server->ingest;
+  ingest->context = &server->context;
+  ingest->store = server->context.book->store;
+  FileTailInit(&ingest->tail, server->filename,
+               server->context.file_offset);
+}
+
+void TestServerStop(TestServer *server) {
+  FileTailFree(&server->ingest.tail);
+  IOBufferFree(&server->ingest.lines);
+  FreeStartupContext(&server->context);
+  unlink(server->filename);
+  unlink(server->snapshot_filename);
+}
+
+// Number of live rows of the book with Dissemination ID id
+size_t LiveRowsWithId(const SwapBook *book, long id) {
+  SwapStore store = PublishedStore(book);
+  size_t n_rows = 0;
+  for (size_t row = 0; row < store.size; row++) {
+    if (store.id[row] == id && SwapBookIsLive(book, row)) n_rows++;
+  }
+  return n_rows;
+}
+
+// Number of live trades in the rollups
+int64_t RollupsCount(const SwapBook *book) {
+  SearchQuery query = QueryFromInputLine("");
+  RollupRow *rows;
+  size_t n_rows = RollupsQuery(&book->rollups, &query, &rows);
+  int64_t count = 0;
+  for (size_t i = 0; i < n_rows; i++) count += rows[i].stats.count;
+  free(rows);
+  return count;
+}
@@ -0,0 +1,101 @@
+// ReadFrame: a frame is read only once all of it has arrived, pipelined
+// frames one after the other, and HandleSearchRequest closes a connection
+// whose frame could never fit in its input buffer
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+const char *test_payloads[] = {"K:3;", "", "Notional Amount 1:1,000,000;K:50;",
+                               "LOOKUP 1 2 3"};
+
+#define N_PAYLOADS (sizeof(test_payloads) / sizeof(char *))
+
+// The frames of test_payloads back to back, request ids from 1
+void AppendFrames(IOBuffer *frames) {
+  for (size_t i = 0; i < N_PAYLOADS; i++) {
+    char header[FRAME_HEADER_SIZE];
+    FrameHeader frame_header = {strlen(test_payloads[i]), 1 + i};
+    WriteFrameHeader(header, &frame_header);
+    IOBufferAppend(frames, header, sizeof(header));
+    IOBufferAppend(frames, test_payloads[i], strlen(test_payloads[i]));
+  }
+}
+
+// Every prefix of the frames gives the ones it holds whole, in order, and
+// nothing for the one cut short
+void CheckPrefixes(const IOBuffer *frames) {
+  for (size_t size = 0; size <= frames->size; size++) {
+    size_t offset = 0, n_frames = 0, frame_size;
+    FrameHeader header;
+    while ((frame_size = ReadFrame(frames->data + offset, size - offset,
+                                   &header)) > 0) {
+      CHECK(n_frames < N_PAYLOADS && frame_size <= size - offset);
+      if (n_frames >= N_PAYLOADS || frame_size > size - offset) break;
+      const char *payload = test_payloads[n_frames];
+      CHECK(header.request_id == 1 + n_frames);
+      CHECK(header.payload_size == strlen(payload));
+      CHECK(frame_size == FRAME_HEADER_SIZE + strlen(payload));
+      CHECK(memcmp(frames->data + offset + FRAME_HEADER_SIZE, payload,
+                   strlen(payload)) == 0);
+      offset += frame_size;
+      n_frames++;
+    }
+    // the next frame is cut short
+    if (n_frames < N_PAYLOADS) {
+      size_t next_size = FRAME_HEADER_SIZE + strlen(test_payloads[n_frames]);
+      CHECK(size - offset < next_size);
+    }
+  }
+}
+
+// The header of a frame of payload_size, and the IO thread's answer to it,
+// on a connection of protocol (PROTOCOL_UNKNOWN for its first request)
+size_t HandleFrameHeader(uint32_t payload_size, int protocol,
+                         Connection *connection) {
+  IOThread io_thread;
+  memset(&io_thread, 0, sizeof(IOThread));
+  EventLoop loop;
+  memset(&loop, 0, sizeof(EventLoop));
+  loop.context = &io_thread;
+  memset(connection, 0, sizeof(Connection));
+  connection->protocol = protocol;
+  char header[FRAME_HEADER_SIZE];
+  FrameHeader frame_header = {payload_size, 7};
+  WriteFrameHeader(header, &frame_header);
+  IOBufferAppend(&connection->input, header, sizeof(header));
+  size_t request_size = HandleSearchRequest(&loop, connection);
+  IOBufferFree(&connection->input);
+  return request_size;
+}
+
+void CheckOversized(void) {
+  // the size is read whole, the frame is just not there yet
+  char header[FRAME_HEADER_SIZE];
+  FrameHeader frame_header = {UINT32_MAX, 7};
+  WriteFrameHeader(header, &frame_header);
+  FrameHeader read_header;
+  CHECK(ReadFrame(header, sizeof(header), &read_header) == 0);
+  CHECK(read_header.payload_size == UINT32_MAX);
+  CHECK(read_header.request_id == 7);
+  // past the first request, as the first byte of a size past 16MB isn't 0
+  Connection connection;
+  CHECK(HandleFrameHeader(UINT32_MAX, PROTOCOL_FRAMED, &connection) == 0);
+  CHECK(connection.close_when_sent);
+  CHECK(HandleFrameHeader(MAX_REQUEST_SIZE - FRAME_HEADER_SIZE + 1,
+                          PROTOCOL_UNKNOWN, &connection) == 0);
+  CHECK(connection.protocol == PROTOCOL_FRAMED);
+  CHECK(connection.close_when_sent);
+  // the largest frame that fits is waited for
+  CHECK(HandleFrameHeader(MAX_REQUEST_SIZE - FRAME_HEADER_SIZE,
+                          PROTOCOL_UNKNOWN, &connection) == 0);
+  CHECK(!connection.close_when_sent);
+}
+
+int main() {
+  IOBuffer frames = {0};
+  AppendFrames(&frames);
+  CheckPrefixes(&frames);
+  CheckOversized();
+  IOBufferFree(&frames);
+  return CheckResult("frame_test");
+}
@@ -0,0 +1,86 @@
+// KdTreeSearch and ParallelKdTreeSearch against the brute-force scan, which
+// they have to match exactly, ties and distances included
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define N_STORES 12
+#define N_TARGETS 40
+#define TEST_PARTITION_SIZE 256
+
+// A random half of the rows, or NULL for all of them
+uint64_t *RandomSelection(size_t n_rows, uint64_t *state) {
+  if (TestRandomBelow(state, 2) == 0) return NULL;
+  uint64_t *selected = calloc(BITMAP_WORDS(n_rows) + 1, sizeof(uint64_t));
+  if (!selected) Die("RandomSelection - calloc");
+  for (size_t row = 0; row < n_rows; row++) {
+    if (TestRandomBelow(state, 2) == 0)
+      selected[row / 64] |= (uint64_t)1 << (row % 64);
+  }
+  return selected;
+}
+
+void CheckTreeMatchesScan(const KdTree *tree, const SwapStore *store,
+                          WorkerPool *pool, size_t n_values,
+                          uint64_t *state) {
+  for (int i = 0; i < N_TARGETS; i++) {
+    SwapTarget target = RandomTarget(state, n_values);
+    // up to more matches than there are rows
+    size_t k = 1 + TestRandomBelow(state, i % 4 == 0 ? 2 * store->size + 1
+                                                     : MAX_TOP_K);
+    uint64_t *selected = RandomSelection(store->size, state);
+    TopK scan_top_k, tree_top_k, parallel_top_k;
+    TopKInit(&scan_top_k, k);
+    TopKInit(&tree_top_k, k);
+    TopKInit(&parallel_top_k, k);
+    TopKScanSelected(&target, store, 0, store->size, selected, &scan_top_k);
+    KdTreeSearch(tree, &target, store, selected, &tree_top_k);
+    ParallelKdTreeSearch(pool, TEST_PARTITION_SIZE, tree, &target, store,
+                         selected, &parallel_top_k);
+    CHECK(scan_top_k.size == min(k, store->size) || selected);
+    TopKSort(&scan_top_k);
+    TopKSort(&tree_top_k);
+    TopKSort(&parallel_top_k);
+    CHECK(SameMatches(&scan_top_k, &tree_top_k));
+    CHECK(SameMatches(&scan_top_k, &parallel_top_k));
+    TopKFree(&scan_top_k);
+    TopKFree(&tree_top_k);
+    TopKFree(&parallel_top_k);
+    free(selected);
+  }
+}
+
+int main() {
+  InitSearchKernels();
+  WorkerPool pool;
+  WorkerPoolInit(&pool, 4);
+  uint64_t state = 0x2545f4914f6cdd1dULL;
+  for (int i = 0; i < N_STORES; i++) {
+    // few values for many duplicate coordinates
+    size_t n_values = i % 3 == 0 ? 2 : (i % 3 == 1 ? 20 : 100000);
+    size_t n_rows = i < 3 ? 1 + i * 30 : 500 * i;
+    SwapStore store;
+    SwapStoreInit(&store, 2 * n_rows + 1);
+    AppendRandomSwaps(&store, n_rows, n_values, &state);
+    KdTree tree;
+    KdTreeBuild(&tree, &store);
+    CheckTreeMatchesScan(&tree, &store, &pool, n_values, &state);
+    // rows past the tree are scanned
+    AppendRandomSwaps(&store, 1 + n_rows / 2, n_values, &state);
+    CheckTreeMatchesScan(&tree, &store, &pool, n_values, &state);
+    KdTreeFree(&tree);
+    SwapStoreFree(&store);
+  }
+  // an empty tree, everything appended after it
+  SwapStore store;
+  SwapStoreInit(&store, 1000);
+  KdTree tree;
+  KdTreeBuild(&tree, &store);
+  CheckTreeMatchesScan(&tree, &store, &pool, 10, &state);
+  AppendRandomSwaps(&store, 700, 10, &state);
+  CheckTreeMatchesScan(&tree, &store, &pool, 10, &state);
+  KdTreeFree(&tree);
+  SwapStoreFree(&store);
+  WorkerPoolFree(&pool);
+  return CheckResult("kdtree_test");
+}
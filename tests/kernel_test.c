@@ -0,0 +1,56 @@
+// The AVX2 distance kernels against the scalar ones, which they have to agree
+// with bit for bit (see SwapRowDistance)
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define N_STORES 20
+#define N_TARGETS 50
+
+#ifdef HAVE_X86_KERNELS
+void CheckKernelsAgree(const SwapTarget *target, const SwapStore *store,
+                       size_t begin, size_t end) {
+  double scalar_distances[TOPK_BLOCK_SIZE] = {0};
+  double avx2_distances[TOPK_BLOCK_SIZE] = {0};
+  DistancesScalar(target, store, begin, end, scalar_distances);
+  DistancesAVX2(target, store, begin, end, avx2_distances);
+  CHECK(memcmp(scalar_distances, avx2_distances,
+               (end - begin) * sizeof(double)) == 0);
+  double scalar_nearest, avx2_nearest;
+  size_t scalar_row =
+      NearestRowScalar(target, store, begin, end, &scalar_nearest);
+  size_t avx2_row = NearestRowAVX2(target, store, begin, end, &avx2_nearest);
+  CHECK(scalar_row == avx2_row);
+  CHECK(memcmp(&scalar_nearest, &avx2_nearest, sizeof(double)) == 0);
+}
+#endif
+
+int main() {
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2")) {
+    printf("kernel_test: skipped, no AVX2\n");
+    return EXIT_SUCCESS;
+  }
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (int i = 0; i < N_STORES; i++) {
+    // few values for many ties, on which the lowest row has to win
+    size_t n_values = i % 2 == 0 ? 3 : 1000;
+    SwapStore store;
+    SwapStoreInit(&store, TOPK_BLOCK_SIZE);
+    AppendRandomSwaps(&store, TOPK_BLOCK_SIZE, n_values, &state);
+    for (int j = 0; j < N_TARGETS; j++) {
+      SwapTarget target = RandomTarget(&state, n_values);
+      // ranges of every length mod 8, to go through the leftover rows
+      size_t begin = TestRandomBelow(&state, 16);
+      size_t end = begin + TestRandomBelow(&state, TOPK_BLOCK_SIZE - begin);
+      CheckKernelsAgree(&target, &store, begin, end);
+      CheckKernelsAgree(&target, &store, 0, TOPK_BLOCK_SIZE);
+    }
+    SwapStoreFree(&store);
+  }
+#else
+  printf("kernel_test: skipped, no x86 kernels\n");
+#endif
+  return CheckResult("kernel_test");
+}
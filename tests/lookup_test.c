@@ -0,0 +1,117 @@
+// IdsFromLookupLine: ids separated by spaces, tabs or commas, up to the first
+// thing that isn't one, and no more than max_ids. A LOOKUP request answers
+// with the live trades among them, in the order asked.
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define FIRST_ID 500000000
+#define N_TRADES 10
+#define MAX_TEST_IDS 8
+
+typedef struct LookupCase {
+  const char *line;
+  size_t max_ids;
+  size_t n_ids;
+  long ids[MAX_TEST_IDS];
+} LookupCase;
+
+const LookupCase lookup_cases[] = {
+    {"LOOKUP 1 2 3", MAX_TEST_IDS, 3, {1, 2, 3}},
+    {"LOOKUP 1,2, 3\t4 ,5", MAX_TEST_IDS, 5, {1, 2, 3, 4, 5}},
+    {"LOOKUP 900000001 900000002\n", MAX_TEST_IDS, 2, {900000001, 900000002}},
+    {"LOOKUP 0 07", MAX_TEST_IDS, 2, {0, 7}},
+    {"LOOKUP", MAX_TEST_IDS, 0, {0}},
+    {"LOOKUP  , ", MAX_TEST_IDS, 0, {0}},
+    {"LOOKUP 12 abc 13", MAX_TEST_IDS, 1, {12}},
+    {"LOOKUP 1;2", MAX_TEST_IDS, 1, {1}},
+    {"LOOKUP -5 6", MAX_TEST_IDS, 0, {0}},
+    {"LOOKUP 1 2 3 4", 2, 2, {1, 2}},
+    {"LOOKUP 1 2 3 4", 0, 0, {0}}};
+
+void CheckLookupLine(const LookupCase *lookup_case) {
+  long ids[MAX_TEST_IDS + 1];
+  for (size_t i = 0; i <= MAX_TEST_IDS; i++) ids[i] = -7;
+  size_t n_ids =
+      IdsFromLookupLine(lookup_case->line, ids, lookup_case->max_ids);
+  CHECK(n_ids == lookup_case->n_ids);
+  for (size_t i = 0; i < min(n_ids, lookup_case->n_ids); i++) {
+    CHECK(ids[i] == lookup_case->ids[i]);
+  }
+  // nothing written past max_ids
+  for (size_t i = lookup_case->max_ids; i <= MAX_TEST_IDS; i++) {
+    CHECK(ids[i] == -7);
+  }
+}
+
+// The client sizes its ids at half the line, a digit and a comma per id
+void CheckDenseLine(void) {
+  IOBuffer line = {0};
+  AppendText(&line, LOOKUP_KEYWORD);
+  for (int id = 0; id < 500; id++) {
+    char text[16];
+    snprintf(text, sizeof(text), "%s%d", id == 0 ? " " : ",", id % 10);
+    AppendText(&line, text);
+  }
+  IOBufferAppend(&line, "", 1);
+  size_t max_ids = strlen(line.data) / 2 + 1;
+  long *ids = malloc(max_ids * sizeof(long));
+  if (!ids) Die("CheckDenseLine - malloc");
+  CHECK(IdsFromLookupLine(line.data, ids, max_ids) == 500);
+  free(ids);
+  IOBufferFree(&line);
+}
+
+// The ids of the records a LOOKUP answered with, in order
+size_t AnsweredIds(const IOBuffer *output, long *ids, size_t max_ids) {
+  size_t n_ids = 0;
+  const char *end = output->data + output->size;
+  for (const char *line = output->data; line < end && n_ids < max_ids;) {
+    CHECK(sscanf(line, "ID:%ld;", &ids[n_ids]) == 1);
+    n_ids++;
+    const char *next = memchr(line, '\n', end - line);
+    line = next ? next + 1 : end;
+  }
+  return n_ids;
+}
+
+void CheckLookupRequest(TestServer *server) {
+  char request[128];
+  // a cancelled trade and an unknown id are left out
+  snprintf(request, sizeof(request), "LOOKUP %d,%d %d %d,%d\n", FIRST_ID + 4,
+           FIRST_ID + 1, FIRST_ID + 2, 12345, FIRST_ID + 4);
+  IOBuffer output = {0};
+  SwapBook *book = AcquireBook(&server->context);
+  AnswerSearchRequest(request, &server->context, book,
+                      &server->context.worker_pool, &output);
+  ReleaseBook(&server->context, book);
+  long ids[MAX_TEST_IDS];
+  CHECK(AnsweredIds(&output, ids, MAX_TEST_IDS) == 3);
+  CHECK(ids[0] == FIRST_ID + 4 && ids[1] == FIRST_ID + 1 &&
+        ids[2] == FIRST_ID + 4);
+  IOBufferFree(&output);
+}
+
+int main() {
+  InitSearchKernels();
+  InitCSVKernels();
+  for (size_t i = 0; i < sizeof(lookup_cases) / sizeof(LookupCase); i++) {
+    CheckLookupLine(&lookup_cases[i]);
+  }
+  CheckDenseLine();
+
+  uint64_t state = 0x510e527fade682d1ULL;
+  IOBuffer csv = {0};
+  AppendText(&csv, test_csv_header);
+  for (long id = 1; id <= N_TRADES; id++) {
+    AppendTestCSVLine(&csv, FIRST_ID + id, 0, "NEW", &state);
+  }
+  AppendTestCSVLine(&csv, FIRST_ID + N_TRADES + 1, FIRST_ID + 2, "CANCEL",
+                    &state);
+  TestServer server;
+  TestServerStart(&server, "lookup_test", &csv);
+  CheckLookupRequest(&server);
+  TestServerStop(&server);
+  IOBufferFree(&csv);
+  return CheckResult("lookup_test");
+}
@@ -0,0 +1,208 @@
+// ParseNumber and ParseInteger: thousands separators only between groups of
+// 3 digits, the trailing "+" of capped notionals, exponents, and numbers past
+// the fast path handed to strtod. Empty cells leave a swap's value unset.
+// ParseEpochDay and ParseEpochSeconds: leap years, days before 1970, and
+// dates and times out of range or cut short.
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+typedef struct NumberCase {
+  const char *text;
+  int result;  // of the parser, 0 or -1
+  double value;
+} NumberCase;
+
+const NumberCase number_cases[] = {
+    {"1", 0, 1},
+    {"-2.5", 0, -2.5},
+    {"+3", 0, 3},
+    {".5", 0, 0.5},
+    {"5.", 0, 5},
+    {"1,000", 0, 1000},
+    {"250,000,000", 0, 250000000},
+    {"-1,234,567.25", 0, -1234567.25},
+    {"1,2,3", -1, 0},
+    {"1,00", -1, 0},
+    {"1,0000", -1, 0},
+    {"1000,000", -1, 0},
+    {",100", -1, 0},
+    {"1,", -1, 0},
+    {"1,000,", -1, 0},
+    {"1.000,5", -1, 0},
+    {"50,000,000+", 0, 50000000},
+    {"5+", 0, 5},
+    {"+", -1, 0},
+    {"5++", -1, 0},
+    {"5+0", -1, 0},
+    {"", -1, 0},
+    {".", -1, 0},
+    {"0.0.1", -1, 0},
+    {"abc", -1, 0},
+    {"1e3", 0, 1000},
+    {"1.5E-2", 0, 0.015},
+    {"2e+2", 0, 200},
+    {"1e", -1, 0},
+    {"1e+", -1, 0},
+    {"1e400", -1, 0},
+    // past the fast path: more than 19 digits, a mantissa past 2^53 or an
+    // exponent past 22
+    {"12345678901234567890123", 0, 12345678901234567890123.0},
+    {"12,345,678,901,234,567,890,123", 0, 12345678901234567890123.0},
+    {"1,2345678901234567890123", -1, 0},
+    {"123456789012345678901.1,5", -1, 0},
+    {"9007199254740993", 0, 9007199254740993.0},
+    {"1e-30", 0, 1e-30},
+    {"12345678901234567890123+", 0, 12345678901234567890123.0}};
+
+const NumberCase integer_cases[] = {
+    {"0", 0, 0},
+    {"-5", 0, -5},
+    {"1,000", 0, 1000},
+    {"7+", 0, 7},
+    {"1,00", -1, 0},
+    {"1,2,3", -1, 0},
+    {"", -1, 0},
+    {"-", -1, 0},
+    {"1.5", -1, 0},
+    {"1e3", -1, 0},
+    {"123,456,789", 0, 123456789},
+    {"9223372036854775808", -1, 0}};
+
+typedef struct DateCase {
+  const char *text;
+  int result;
+  int64_t value;  // days or seconds since 1970-01-01
+} DateCase;
+
+const DateCase day_cases[] = {
+    {"1970-01-01", 0, 0},
+    {"1969-12-31", 0, -1},
+    {"2022-09-12", 0, 19247},
+    {"2000-02-29", 0, 11016},
+    {"2000-03-01", 0, 11017},
+    {"2024-02-29", 0, 19782},
+    {"1900-02-28", 0, -25509},
+    {"1900-03-01", 0, -25508},
+    {"1600-02-29", 0, -135081},
+    {"0001-01-01", 0, -719162},
+    {"9999-12-31", 0, 2932896},
+    {"1900-02-29", -1, 0},
+    {"2023-02-29", -1, 0},
+    {"2022-04-31", -1, 0},
+    {"2022-13-01", -1, 0},
+    {"2022-00-10", -1, 0},
+    {"2022-01-00", -1, 0},
+    {"2022-01-32", -1, 0},
+    {"2022/01/01", -1, 0},
+    {"2022-1-01", -1, 0},
+    {"2022-01-1", -1, 0},
+    {"2022-01-011", -1, 0},
+    {"-022-01-01", -1, 0},
+    {"", -1, 0}};
+
+const DateCase second_cases[] = {
+    {"1970-01-01T00:00:00", 0, 0},
+    {"1969-12-31T23:59:59", 0, -1},
+    {"2022-09-12T20:15:56", 0, 1663013756},
+    {"2022-09-12T20:15:56Z", 0, 1663013756},
+    {"2024-02-29T23:59:59", 0, 1709251199},
+    {"2023-02-29T00:00:00", -1, 0},
+    {"2022-09-12T24:00:00", -1, 0},
+    {"2022-09-12T20:60:00", -1, 0},
+    {"2022-09-12T20:15:60", -1, 0},
+    {"2022-09-12 20:15:56", -1, 0},
+    {"2022-09-12T20-15-56", -1, 0},
+    {"2022-09-12T20:15:56+", -1, 0},
+    {"2022-09-12T20:15:5", -1, 0},
+    {"2022-09-12T20:15", -1, 0},
+    {"2022-09-12T", -1, 0},
+    {"2022-09-12", -1, 0},
+    {"", -1, 0}};
+
+// value is left alone when the text doesn't parse
+void CheckNumber(const NumberCase *number_case) {
+  double value = -7;
+  int result = ParseNumber(ViewFromString(number_case->text), &value);
+  CHECK(result == number_case->result);
+  CHECK(value == (result == 0 ? number_case->value : -7));
+}
+
+void CheckInteger(const NumberCase *integer_case) {
+  long value = -7;
+  int result = ParseInteger(ViewFromString(integer_case->text), &value);
+  CHECK(result == integer_case->result);
+  CHECK(value == (result == 0 ? (long)integer_case->value : -7));
+}
+
+void CheckDay(const DateCase *day_case) {
+  int32_t value = -7;
+  int result = ParseEpochDay(ViewFromString(day_case->text), &value);
+  CHECK(result == day_case->result);
+  CHECK(value == (result == 0 ? day_case->value : -7));
+}
+
+void CheckSeconds(const DateCase *second_case) {
+  int64_t value = -7;
+  int result = ParseEpochSeconds(ViewFromString(second_case->text), &value);
+  CHECK(result == second_case->result);
+  CHECK(value == (result == 0 ? second_case->value : -7));
+}
+
+// Every day of some 1100 years before and after 1970 is written and read back
+// as itself, and follows the day before it
+void CheckDayRoundTrips(void) {
+  char date[DATE_STR_LEN + 8];
+  int last_year = 0, last_month = 0, last_day = 0;
+  for (int32_t day = -400000; day <= 400000; day++) {
+    DateFromEpochDay(date, day);
+    int32_t parsed = -7;
+    CHECK(ParseEpochDay(ViewFromString(date), &parsed) == 0 && parsed == day);
+    int year, month, day_of_month;
+    CivilFromDays(day, &year, &month, &day_of_month);
+    if (day > -400000) {
+      int is_next = day_of_month == last_day + 1 ||
+                    (day_of_month == 1 &&
+                     last_day == DaysInMonth(last_year, last_month) &&
+                     (month == last_month + 1 ||
+                      (month == 1 && last_month == 12 &&
+                       year == last_year + 1)));
+      CHECK(is_next);
+    }
+    last_year = year;
+    last_month = month;
+    last_day = day_of_month;
+  }
+}
+
+// The notional a swap gets from the cell, and whether the cell counts as bad
+void CheckNotionalCell(const char *text, float notional, int is_bad) {
+  Swap swap = {0};
+  swap.notional = -7;
+  AssignSwapValueView(&swap, NOTIONAL, ViewFromString(text));
+  CHECK(swap.notional == notional);
+  CHECK(bad_cell_counts[BAD_NUMBER] == (unsigned long)is_bad);
+  bad_cell_counts[BAD_NUMBER] = 0;
+}
+
+int main() {
+  for (size_t i = 0; i < sizeof(number_cases) / sizeof(NumberCase); i++) {
+    CheckNumber(&number_cases[i]);
+  }
+  for (size_t i = 0; i < sizeof(integer_cases) / sizeof(NumberCase); i++) {
+    CheckInteger(&integer_cases[i]);
+  }
+  for (size_t i = 0; i < sizeof(day_cases) / sizeof(DateCase); i++) {
+    CheckDay(&day_cases[i]);
+  }
+  for (size_t i = 0; i < sizeof(second_cases) / sizeof(DateCase); i++) {
+    CheckSeconds(&second_cases[i]);
+  }
+  CheckDayRoundTrips();
+  CheckNotionalCell("", -7, 0);
+  CheckNotionalCell("1,000", 1000, 0);
+  CheckNotionalCell("1,00", -7, 1);
+  // rounded to a float
+  CheckNotionalCell("250,000,001", 250000000, 0);
+  return CheckResult("parse_test");
+}
@@ -0,0 +1,75 @@
+// QueryFromInputLine: range bounds are set from values that parse, and a
+// value that doesn't empties the range of its column, which no row matches
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+// The query bounds field on one side only, at bound
+void CheckBound(const char *input_line, int field, int is_min, double bound) {
+  SearchQuery query = QueryFromInputLine(input_line);
+  CHECK(query.range.fields == 1u << field);
+  CHECK(query.range.min[field] == (is_min ? bound : -DBL_MAX));
+  CHECK(query.range.max[field] == (is_min ? DBL_MAX : bound));
+}
+
+void CheckNoBound(const char *input_line) {
+  SearchQuery query = QueryFromInputLine(input_line);
+  CHECK(query.range.fields == 0);
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    CHECK(query.range.min[field] == -DBL_MAX);
+    CHECK(query.range.max[field] == DBL_MAX);
+  }
+}
+
+// The query's range of field is empty and nothing else is bounded
+void CheckEmptyRange(const char *input_line, int field) {
+  SearchQuery query = QueryFromInputLine(input_line);
+  CHECK(query.range.fields == 1u << field);
+  CHECK(query.range.min[field] > query.range.max[field]);
+}
+
+int main() {
+  CheckBound("Notional Amount 1 Min:1,000,000;", RANGE_NOTIONAL, 1, 1e6);
+  CheckBound("Fixed Rate 2 Max:0.25;", RANGE_FIXED_RATE, 0, (float)0.25);
+  CheckBound("Effective Date Min:1970-01-11;", RANGE_START_DAY, 1, 10);
+  CheckBound("Expiration Date Max:1970-01-01;", RANGE_END_DAY, 0, 0);
+  CheckBound("Execution Timestamp Min:1970-01-01T00:01:40;",
+             RANGE_TRADE_TIME, 1, 100);
+  CheckEmptyRange("Notional Amount 1 Min:abc;", RANGE_NOTIONAL);
+  CheckEmptyRange("Notional Amount 1 Max:;", RANGE_NOTIONAL);
+  CheckEmptyRange("Fixed Rate 2 Min:0.0.1;", RANGE_FIXED_RATE);
+  CheckEmptyRange("Effective Date Min:2022-13-01;", RANGE_START_DAY);
+  CheckEmptyRange("Expiration Date Max:tomorrow;", RANGE_END_DAY);
+  CheckEmptyRange("Execution Timestamp Max:2022-09-12;", RANGE_TRADE_TIME);
+  // a good bound on the other side doesn't bring the range back
+  CheckEmptyRange("Notional Amount 1 Max:abc;Notional Amount 1 Min:1;",
+                  RANGE_NOTIONAL);
+  CheckEmptyRange("Notional Amount 1 Min:abc;Notional Amount 1 Max:1e12;",
+                  RANGE_NOTIONAL);
+  // not a column with a range
+  CheckNoBound("Leg 1 - Floating Rate Index Min:USD-SOFR-COMPOUND;");
+  // a bad bound doesn't take the rest of the query with it
+  SearchQuery query =
+      QueryFromInputLine("Notional Amount 1 Min:abc;Notional Amount 1:5;K:3;");
+  CHECK(query.range.fields == 1u << RANGE_NOTIONAL);
+  CHECK(query.swap.notional == 5);
+  CHECK(query.k == 3);
+  // and no row matches it, nor any aggregate bucket
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  SwapStore store;
+  SwapStoreInit(&store, 64);
+  AppendRandomSwaps(&store, 64, 1000, &state);
+  for (size_t row = 0; row < store.size; row++) {
+    CHECK(!RangeFilterMatches(&query.range, &store, row));
+  }
+  Rollups rollups = {0};
+  RollupsBuild(&rollups, &store, store.size);
+  RollupRow *rows;
+  SearchQuery aggregate =
+      QueryFromInputLine("Execution Timestamp Min:yesterday;");
+  CHECK(RollupsQuery(&rollups, &aggregate, &rows) == 0);
+  free(rows);
+  RollupsFree(&rollups);
+  SwapStoreFree(&store);
+  return CheckResult("query_test");
+}
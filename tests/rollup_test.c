@@ -0,0 +1,170 @@
+// RollupsQuery: the same buckets and stats as summing the live rows of its
+// window, after building and after adding and taking out trades in any time
+// order, with a window too wide for MAX_AGGREGATE_BUCKETS cut to its end
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define N_BUILT_ROWS 3000
+#define N_ADDED_ROWS 1000
+#define N_VALUES 1000  // trade times over some 41 days
+#define N_QUERIES 200
+
+typedef struct TestRollups {
+  const SwapStore *store;
+  uint8_t *is_live;
+  int64_t min_time;  // of every trade added, as in Rollups
+  int64_t max_time;
+} TestRollups;
+
+int CompareRollupRows(const void *a, const void *b) {
+  const RollupRow *row_a = a;
+  const RollupRow *row_b = b;
+  if (row_a->bucket_start != row_b->bucket_start)
+    return row_a->bucket_start < row_b->bucket_start ? -1 : 1;
+  if (row_a->ref_rate != row_b->ref_rate)
+    return row_a->ref_rate < row_b->ref_rate ? -1 : 1;
+  return (row_a->tenor > row_b->tenor) - (row_a->tenor < row_b->tenor);
+}
+
+// RollupsQuery the slow way: a row per live trade in the window, sorted and
+// summed by bucket
+size_t ReferenceQuery(const TestRollups *reference, const SearchQuery *query,
+                      RollupRow **rows) {
+  const SwapStore *store = reference->store;
+  RollupLevel level = query->bucket;
+  int64_t begin = reference->min_time, end = reference->max_time;
+  // the unbounded side is at -DBL_MAX or DBL_MAX, out of int64_t range
+  if (query->range.min[RANGE_TRADE_TIME] > begin)
+    begin = (int64_t)query->range.min[RANGE_TRADE_TIME];
+  if (query->range.max[RANGE_TRADE_TIME] < end)
+    end = (int64_t)query->range.max[RANGE_TRADE_TIME];
+  int64_t first_bucket = RollupBucket(begin, level);
+  int64_t last_bucket = RollupBucket(end, level);
+  if (begin > end) last_bucket = first_bucket - 1;
+  if (last_bucket - first_bucket >= MAX_AGGREGATE_BUCKETS)
+    first_bucket = last_bucket - MAX_AGGREGATE_BUCKETS + 1;
+  *rows = malloc((store->size + 1) * sizeof(RollupRow));
+  if (!*rows) Die("ReferenceQuery - malloc");
+  size_t n_rows = 0;
+  for (size_t row = 0; row < store->size; row++) {
+    int64_t bucket = RollupBucket(store->trade_time[row], level);
+    if (!reference->is_live[row] || store->trade_time[row] == 0 ||
+        bucket < first_bucket || bucket > last_bucket ||
+        (query->swap.ref_rate != 0 &&
+         store->ref_rate[row] != query->swap.ref_rate))
+      continue;
+    RollupRow *this_row = &(*rows)[n_rows++];
+    this_row->bucket_start = bucket * rollup_seconds[level];
+    this_row->ref_rate = store->ref_rate[row];
+    this_row->tenor = TenorBucketOf(store->start_day[row], store->end_day[row]);
+    this_row->stats.count = 1;
+    this_row->stats.notional = store->notional[row];
+    this_row->stats.rate_notional =
+        (double)store->notional[row] * store->fixed_rate[row];
+  }
+  qsort(*rows, n_rows, sizeof(RollupRow), CompareRollupRows);
+  size_t n_buckets = 0;
+  for (size_t i = 0; i < n_rows; i++) {
+    RollupRow *last = n_buckets > 0 ? &(*rows)[n_buckets - 1] : NULL;
+    if (last && CompareRollupRows(last, &(*rows)[i]) == 0) {
+      last->stats.count++;
+      last->stats.notional += (*rows)[i].stats.notional;
+      last->stats.rate_notional += (*rows)[i].stats.rate_notional;
+    } else {
+      (*rows)[n_buckets++] = (*rows)[i];
+    }
+  }
+  return n_buckets;
+}
+
+// Up to the rounding of summing in another order
+int SameSum(double a, double b) {
+  double bound = 1e-9 * max(max(a, -a), max(b, -b));
+  return a - b <= bound && b - a <= bound;
+}
+
+void CheckQuery(const Rollups *rollups, const TestRollups *reference,
+                const SearchQuery *query) {
+  RollupRow *rows, *reference_rows;
+  size_t n_rows = RollupsQuery(rollups, query, &rows);
+  size_t n_reference_rows = ReferenceQuery(reference, query, &reference_rows);
+  CHECK(n_rows == n_reference_rows);
+  for (size_t i = 0; i < min(n_rows, n_reference_rows); i++) {
+    CHECK(CompareRollupRows(&rows[i], &reference_rows[i]) == 0);
+    CHECK(rows[i].stats.count == reference_rows[i].stats.count);
+    CHECK(SameSum(rows[i].stats.notional, reference_rows[i].stats.notional));
+    CHECK(SameSum(rows[i].stats.rate_notional,
+                  reference_rows[i].stats.rate_notional));
+  }
+  free(rows);
+  free(reference_rows);
+}
+
+void CheckQueries(const Rollups *rollups, const TestRollups *reference,
+                  uint64_t *state) {
+  int64_t span = reference->max_time - reference->min_time;
+  for (int i = 0; i < N_QUERIES; i++) {
+    SearchQuery query = QueryFromInputLine("");
+    query.bucket = TestRandomBelow(state, N_ROLLUP_LEVELS);
+    query.swap.ref_rate = TestRandomBelow(state, 3);
+    // unbounded, bounded on either side or both, or empty
+    int bounds = TestRandomBelow(state, 4);
+    if (bounds & 1) {
+      query.range.fields |= 1u << RANGE_TRADE_TIME;
+      query.range.min[RANGE_TRADE_TIME] =
+          reference->min_time + (int64_t)TestRandomBelow(state, span + 1);
+    }
+    if (bounds & 2) {
+      query.range.fields |= 1u << RANGE_TRADE_TIME;
+      query.range.max[RANGE_TRADE_TIME] =
+          reference->min_time + (int64_t)TestRandomBelow(state, span + 1);
+    }
+    CheckQuery(rollups, reference, &query);
+  }
+}
+
+void AddRow(Rollups *rollups, TestRollups *reference, size_t row, int sign) {
+  const SwapStore *store = reference->store;
+  RollupsUpdate(rollups, store, row, sign);
+  reference->is_live[row] = sign > 0;
+  if (sign > 0 && store->trade_time[row] != 0) {
+    reference->min_time = min(reference->min_time, store->trade_time[row]);
+    reference->max_time = max(reference->max_time, store->trade_time[row]);
+  }
+}
+
+int main() {
+  uint64_t state = 0x5851f42d4c957f2dULL;
+  SwapStore store;
+  SwapStoreInit(&store, N_BUILT_ROWS + N_ADDED_ROWS);
+  AppendRandomSwaps(&store, N_BUILT_ROWS + N_ADDED_ROWS, N_VALUES, &state);
+  // trades without an execution time stay out
+  for (size_t row = 0; row < store.size; row += 97) store.trade_time[row] = 0;
+  uint8_t *is_live = calloc(store.size, 1);
+  if (!is_live) Die("main - calloc");
+  TestRollups reference = {&store, is_live, INT64_MAX, INT64_MIN};
+  Rollups rollups = {0};
+  RollupsBuild(&rollups, &store, N_BUILT_ROWS);
+  for (size_t row = 0; row < N_BUILT_ROWS; row++) {
+    is_live[row] = 1;
+    if (store.trade_time[row] == 0) continue;
+    reference.min_time = min(reference.min_time, store.trade_time[row]);
+    reference.max_time = max(reference.max_time, store.trade_time[row]);
+  }
+  CHECK(RollupBucket(reference.max_time, ROLLUP_MINUTE) -
+            RollupBucket(reference.min_time, ROLLUP_MINUTE) >=
+        MAX_AGGREGATE_BUCKETS);
+  CheckQueries(&rollups, &reference, &state);
+  // added rows come in any time order, and take out some of the others
+  for (size_t row = N_BUILT_ROWS; row < store.size; row++) {
+    AddRow(&rollups, &reference, row, 1);
+    size_t dropped = TestRandomBelow(&state, row);
+    if (is_live[dropped]) AddRow(&rollups, &reference, dropped, -1);
+  }
+  CheckQueries(&rollups, &reference, &state);
+  RollupsFree(&rollups);
+  SwapStoreFree(&store);
+  free(is_live);
+  return CheckResult("rollup_test");
+}
@@ -0,0 +1,184 @@
+// Snapshots: the one written after loading the csv maps back to the same
+// store and indexes, and a book loaded from it answers as the fresh one does.
+// A snapshot of another file size, modification time or row cap, or with a
+// byte changed, is not used.
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define FIRST_ID 600000000
+#define N_TRADES 3000
+
+const char *test_requests[] = {
+    "Notional Amount 1:250,000,000;Fixed Rate 2:0.03;K:20;\n",
+    "Notional Amount 1:10,000,000;Effective Date:2022-09-12;K:50;Mode:Scan;\n",
+    "Fixed Rate 2:0.05;Notional Amount 1 Min:100,000,000;K:10;\n",
+    "Leg 1 - Floating Rate Index:USD-SOFR-COMPOUND;Expiration Date "
+    "Max:2030-01-01;K:30;\n",
+    "LOOKUP 600000001 600000002 600000003 600000500\n",
+    "AGGREGATE Bucket:Hour;\n"};
+
+// Whether the snapshot maps back for source, undoing the mapping if it does
+int SnapshotMaps(const char *filename, const SnapshotSource *source) {
+  MappedFile file;
+  const char *colnames;
+  size_t colnames_size;
+  SwapStore store;
+  KdTree tree;
+  CategoryIndex index;
+  RangeIndex ranges;
+  if (SnapshotMap(filename, source, &file, &colnames, &colnames_size, &store,
+                  &tree, &index, &ranges) != 0)
+    return 0;
+  SwapStoreFree(&store);
+  UnmapFile(&file);
+  return 1;
+}
+
+// The mapped snapshot holds the book's colnames, store and indexes
+void CheckMapped(TestServer *server, const SnapshotSource *source) {
+  const StartupContext *context = &server->context;
+  const SwapBook *book = context->book;
+  MappedFile file;
+  const char *colnames;
+  size_t colnames_size;
+  SwapStore store;
+  KdTree tree;
+  CategoryIndex index;
+  RangeIndex ranges;
+  int result = SnapshotMap(server->snapshot_filename, source, &file, &colnames,
+                           &colnames_size, &store, &tree, &index, &ranges);
+  CHECK(result == 0);
+  if (result != 0) return;
+  CHECK(colnames_size == (size_t)context->colnames.max_n_colnames *
+                             context->colnames.max_colname_len);
+  CHECK(memcmp(colnames, context->colnames.contents, colnames_size) == 0);
+  CHECK(store.size == book->store.size);
+  SwapColumn columns[SWAP_STORE_N_COLUMNS];
+  SwapColumn book_columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(&store, columns);
+  SwapStoreColumns((SwapStore *)&book->store, book_columns);
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    CHECK(memcmp(*columns[i].data, *book_columns[i].data,
+                 store.size * columns[i].elem_size) == 0);
+  }
+  CHECK(tree.n_nodes == book->kd_tree.n_nodes);
+  CHECK(tree.n_rows == book->kd_tree.n_rows);
+  CHECK(memcmp(tree.nodes, book->kd_tree.nodes,
+               tree.n_nodes * sizeof(KdNode)) == 0);
+  for (int field = 0; field < N_CATEGORY_FIELDS; field++) {
+    for (int value = 0; value < category_n_values[field]; value++) {
+      CHECK(memcmp(index.bitmaps[field][value],
+                   book->category_index.bitmaps[field][value],
+                   BITMAP_WORDS(index.n_rows) * sizeof(uint64_t)) == 0);
+    }
+  }
+  size_t n_zones = RangeZones(ranges.n_rows);
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    CHECK(memcmp(ranges.sorted[field], book->range_index.sorted[field],
+                 ranges.n_rows * sizeof(uint32_t)) == 0);
+    CHECK(memcmp(ranges.zone_min[field], book->range_index.zone_min[field],
+                 n_zones * sizeof(double)) == 0);
+    CHECK(memcmp(ranges.zone_max[field], book->range_index.zone_max[field],
+                 n_zones * sizeof(double)) == 0);
+  }
+  SwapStoreFree(&store);
+  UnmapFile(&file);
+}
+
+void Answer(StartupContext *context, const char *request, IOBuffer *output) {
+  char *text = strdup(request);
+  if (!text) Die("Answer - strdup");
+  SwapBook *book = AcquireBook(context);
+  AnswerSearchRequest(text, context, book, &context->worker_pool, output);
+  ReleaseBook(context, book);
+  free(text);
+}
+
+// A second server started on the same files loads the snapshot, and answers
+// every request as the server that wrote it
+void CheckLoaded(TestServer *server) {
+  StartupContext context;
+  memset(&context, 0, sizeof(StartupContext));
+  ServerConfig config = DefaultServerConfig();
+  config.n_threads = 4;
+  StartWorkers(&context, &config);
+  LoadBook(&context, server->filename, server->snapshot_filename);
+  CHECK(context.book->snapshot.data != NULL);
+  for (size_t i = 0; i < sizeof(test_requests) / sizeof(char *); i++) {
+    IOBuffer fresh = {0}, loaded = {0};
+    Answer(&server->context, test_requests[i], &fresh);
+    Answer(&context, test_requests[i], &loaded);
+    CHECK(fresh.size > 0 && fresh.size == loaded.size &&
+          memcmp(fresh.data, loaded.data, fresh.size) == 0);
+    IOBufferFree(&fresh);
+    IOBufferFree(&loaded);
+  }
+  CHECK(RollupsCount(context.book) == RollupsCount(server->context.book));
+  FreeStartupContext(&context);
+}
+
+// A copy of the snapshot, with the byte at offset flipped
+void CheckCorrupted(TestServer *server, const SnapshotSource *source,
+                    size_t offset) {
+  MappedFile file;
+  if (MapFile(&file, server->snapshot_filename) != 0)
+    Die("CheckCorrupted - MapFile");
+  char filename[80];
+  snprintf(filename, sizeof(filename), "%s.corrupted",
+           server->snapshot_filename);
+  FILE *handler = fopen(filename, "wb");
+  if (!handler) Die("CheckCorrupted - fopen");
+  for (size_t i = 0; i < file.size; i++) {
+    putc(i == offset ? ~file.data[i] : file.data[i], handler);
+  }
+  fclose(handler);
+  CHECK(!SnapshotMaps(filename, source));
+  UnmapFile(&file);
+  unlink(filename);
+}
+
+int main() {
+  InitSearchKernels();
+  InitCSVKernels();
+  uint64_t state = 0x3c6ef372fe94f82bULL;
+  IOBuffer csv = {0};
+  AppendText(&csv, test_csv_header);
+  for (long id = 1; id <= N_TRADES; id++) {
+    AppendTestCSVLine(&csv, FIRST_ID + id, 0, "NEW", &state);
+  }
+  // written after the events are applied and the book compacted
+  AppendTestCSVLine(&csv, FIRST_ID + N_TRADES + 1, FIRST_ID + 1, "CORRECT",
+                    &state);
+  AppendTestCSVLine(&csv, FIRST_ID + N_TRADES + 2, FIRST_ID + 2, "CANCEL",
+                    &state);
+  TestServer server;
+  TestServerStart(&server, "snapshot_test", &csv);
+  SnapshotSource source;
+  CHECK(SnapshotSourceFromFile(&source, server.filename,
+                               SWAP_STORE_MAX_ROWS) == 0);
+  CheckMapped(&server, &source);
+  CheckLoaded(&server);
+
+  // built from another file, or with another row cap
+  SnapshotSource stale = source;
+  stale.size++;
+  CHECK(!SnapshotMaps(server.snapshot_filename, &stale));
+  stale = source;
+  stale.mtime--;
+  CHECK(!SnapshotMaps(server.snapshot_filename, &stale));
+  stale = source;
+  stale.max_rows /= 2;
+  CHECK(!SnapshotMaps(server.snapshot_filename, &stale));
+  CHECK(SnapshotMaps(server.snapshot_filename, &source));
+
+  // a byte of the header, of the column names and of a column
+  CheckCorrupted(&server, &source, 0);
+  CheckCorrupted(&server, &source, SnapshotAlign(sizeof(SnapshotHeader)));
+  CheckCorrupted(&server, &source,
+                 SnapshotAlign(sizeof(SnapshotHeader)) + 2 * SNAPSHOT_ALIGN +
+                     100);
+  TestServerStop(&server);
+  IOBufferFree(&csv);
+  return CheckResult("snapshot_test");
+}
@@ -0,0 +1,97 @@
+// TailIngestLines: appended lines join the book, and a file that is replaced
+// or truncated is loaded again in place of it, never on top of it
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define N_ROWS 300
+#define FIRST_ID 800000000
+
+// The book holds each of ids [FIRST_ID, FIRST_ID + n_ids) exactly once, and
+// nothing else
+void CheckBookHolds(TestServer *server, long n_ids) {
+  SwapBook *book = AcquireBook(&server->context);
+  SwapStore store = PublishedStore(book);
+  size_t n_live = store.size - book->n_dead;
+  CHECK(n_live == (size_t)n_ids);
+  CHECK(RollupsCount(book) == n_ids);
+  for (long id = FIRST_ID; id < FIRST_ID + n_ids; id++) {
+    CHECK(LiveRowsWithId(book, id) == 1);
+    CHECK(SwapBookFind(book, id) != ID_NOT_FOUND);
+  }
+  ReleaseBook(&server->context, book);
+}
+
+void AppendLines(IOBuffer *csv, long first_id, long end_id, uint64_t *state) {
+  for (long id = first_id; id < end_id; id++) {
+    AppendTestCSVLine(csv, id, 0, "NEW", state);
+  }
+}
+
+int main() {
+  InitSearchKernels();
+  InitCSVKernels();
+  uint64_t state = 0x94d049bb133111ebULL;
+  IOBuffer csv = {0};
+  AppendText(&csv, test_csv_header);
+  AppendLines(&csv, FIRST_ID, FIRST_ID + N_ROWS, &state);
+  TestServer server;
+  TestServerStart(&server, "tail_test", &csv);
+  CheckBookHolds(&server, N_ROWS);
+
+  // appended lines
+  IOBuffer lines = {0};
+  AppendLines(&lines, FIRST_ID + N_ROWS, FIRST_ID + N_ROWS + 50, &state);
+  WriteTestFile(server.filename, &lines, 1);
+  CHECK(TailIngestLines(&server.ingest) == 50);
+  CheckBookHolds(&server, N_ROWS + 50);
+  CHECK(TailIngestLines(&server.ingest) == 0);
+  CheckBookHolds(&server, N_ROWS + 50);
+
+  // rewritten in place, shorter: the same ids again, and a few less
+  csv.size = 0;
+  AppendText(&csv, test_csv_header);
+  AppendLines(&csv, FIRST_ID, FIRST_ID + N_ROWS - 20, &state);
+  WriteTestFile(server.filename, &csv, 0);
+  TailIngestLines(&server.ingest);
+  CheckBookHolds(&server, N_ROWS - 20);
+
+  // replaced by another file (a new inode), longer than the one before
+  char new_filename[80];
+  snprintf(new_filename, sizeof(new_filename), "%s.new", server.filename);
+  AppendLines(&csv, FIRST_ID + N_ROWS - 20, FIRST_ID + 2 * N_ROWS, &state);
+  WriteTestFile(new_filename, &csv, 0);
+  if (rename(new_filename, server.filename) != 0) Die("main - rename");
+  TailIngestLines(&server.ingest);
+  CheckBookHolds(&server, 2 * N_ROWS);
+  // and followed from there on
+  lines.size = 0;
+  AppendLines(&lines, FIRST_ID + 2 * N_ROWS, FIRST_ID + 2 * N_ROWS + 5,
+              &state);
+  WriteTestFile(server.filename, &lines, 1);
+  CHECK(TailIngestLines(&server.ingest) == 5);
+  CheckBookHolds(&server, 2 * N_ROWS + 5);
+
+  // truncated down to its header, then to nothing
+  csv.size = 0;
+  AppendText(&csv, test_csv_header);
+  WriteTestFile(server.filename, &csv, 0);
+  TailIngestLines(&server.ingest);
+  CheckBookHolds(&server, 0);
+  lines.size = 0;
+  WriteTestFile(server.filename, &lines, 0);
+  TailIngestLines(&server.ingest);
+  CheckBookHolds(&server, 0);
+  // and written again from scratch
+  csv.size = 0;
+  AppendText(&csv, test_csv_header);
+  AppendLines(&csv, FIRST_ID, FIRST_ID + 10, &state);
+  WriteTestFile(server.filename, &csv, 0);
+  TailIngestLines(&server.ingest);
+  CheckBookHolds(&server, 10);
+
+  TestServerStop(&server);
+  IOBufferFree(&csv);
+  IOBufferFree(&lines);
+  return CheckResult("tail_test");
+}
@@ -0,0 +1,190 @@
+// The block masks and prefix XOR kernels against a byte at a time reference,
+// and IngestCSVBody, across kernels and chunkings, against SwapFromCSVLine on
+// the lines NextLine splits off
+#define SERVER_NO_MAIN
+#define MIN_INGEST_CHUNK_SIZE 64  // small bodies still get many chunks
+#include "../server.c"
+#include "check.c"
+
+#define N_BLOCKS 2000
+#define N_BODIES 40
+#define TEST_MAX_ROWS 4096
+
+const char test_header[] =
+    "\"Dissemination ID\",\"Original Dissemination ID\",\"Action\","
+    "\"Execution Timestamp\",\"Other\",\"Effective Date\",\"Expiration Date\","
+    "\"Notional Amount 1\",\"Leg 1 - Floating Rate Index\",\"Fixed Rate 2\","
+    "\"Payment Frequency Period 1\",\"Payment Frequency Period 2\","
+    "\"Transaction Type\",\"Comment\"\r\n";
+
+void ReferenceMasks(const char *block, CSVBlockMasks *masks) {
+  masks->quotes = masks->commas = masks->newlines = 0;
+  for (int i = 0; i < CSV_BLOCK_SIZE; i++) {
+    masks->quotes |= (uint64_t)(block[i] == '"') << i;
+    masks->commas |= (uint64_t)(block[i] == ',') << i;
+    masks->newlines |= (uint64_t)(block[i] == '\n') << i;
+  }
+}
+
+uint64_t ReferencePrefixXor(uint64_t bits) {
+  uint64_t res = 0;
+  int parity = 0;
+  for (int i = 0; i < 64; i++) {
+    parity ^= (bits >> i) & 1;
+    res |= (uint64_t)parity << i;
+  }
+  return res;
+}
+
+int SameMasks(const CSVBlockMasks *a, const CSVBlockMasks *b) {
+  return a->quotes == b->quotes && a->commas == b->commas &&
+         a->newlines == b->newlines;
+}
+
+void CheckBlockKernels(uint64_t *state) {
+  const char alphabet[] = "\",\n\r a0\xff\x80";
+  char block[CSV_BLOCK_SIZE];
+  for (int i = 0; i < N_BLOCKS; i++) {
+    for (int j = 0; j < CSV_BLOCK_SIZE; j++) {
+      block[j] = alphabet[TestRandomBelow(state, sizeof(alphabet) - 1)];
+    }
+    CSVBlockMasks reference, masks;
+    ReferenceMasks(block, &reference);
+    CSVBlockMasksScalar(block, &masks);
+    CHECK(SameMasks(&reference, &masks));
+    uint64_t bits = TestRandom(state);
+    CHECK(PrefixXorScalar(bits) == ReferencePrefixXor(bits));
+    CHECK(PrefixXorScalar(reference.quotes) ==
+          ReferencePrefixXor(reference.quotes));
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+      CSVBlockMasksAVX2(block, &masks);
+      CHECK(SameMasks(&reference, &masks));
+    }
+    if (__builtin_cpu_supports("pclmul")) {
+      CHECK(PrefixXorCLMUL(bits) == ReferencePrefixXor(bits));
+      CHECK(PrefixXorCLMUL(reference.quotes) ==
+            ReferencePrefixXor(reference.quotes));
+    }
+#endif
+  }
+}
+
+
+// Appends a quoted cell of random text, with commas, escaped quotes and line
+// breaks in it, and a random length so that they land across block and chunk
+// boundaries
+void AppendJunkCell(IOBuffer *body, uint64_t *state) {
+  const char *pieces[] = {"a", "bc", ",", "\"\"", "\n", "\r\n", " ", ",\"\""};
+  AppendText(body, "\"");
+  size_t n_pieces = TestRandomBelow(state, 40);
+  for (size_t i = 0; i < n_pieces; i++) {
+    AppendText(body, pieces[TestRandomBelow(state, 8)]);
+  }
+  AppendText(body, "\"");
+}
+
+// A csv body of n_rows rows, without its header
+void RandomCSVBody(IOBuffer *body, size_t n_rows, uint64_t *state) {
+  const char *ref_rates[] = {"USD-SOFR-COMPOUND", "USD-LIBOR-BBA", "USA-CPI-U"};
+  const char *periods[] = {"1M", "3M", "6M", "1Y"};
+  const char *actions[] = {"NEW", "CANCEL", "CORRECT"};
+  char cells[512];
+  for (size_t row = 0; row < n_rows; row++) {
+    snprintf(cells, sizeof(cells),
+             "\"%zu\",\"\",\"%s\",\"2022-09-%02zuT%02zu:%02zu:38\",",
+             800000000 + row, actions[TestRandomBelow(state, 3)],
+             1 + TestRandomBelow(state, 28), TestRandomBelow(state, 24),
+             TestRandomBelow(state, 60));
+    AppendText(body, cells);
+    AppendJunkCell(body, state);
+    snprintf(cells, sizeof(cells),
+             ",\"2022-09-12\",\"20%02zu-09-07\",\"%zu,000,000\",\"%s\","
+             "\"0.0%03zu\",\"%s\",\"%s\",\"%s\",",
+             23 + TestRandomBelow(state, 30), 1 + TestRandomBelow(state, 500),
+             ref_rates[TestRandomBelow(state, 3)], TestRandomBelow(state, 999),
+             periods[TestRandomBelow(state, 4)],
+             periods[TestRandomBelow(state, 4)],
+             TestRandomBelow(state, 2) ? "Trade" : "Amendment");
+    AppendText(body, cells);
+    AppendJunkCell(body, state);
+    AppendText(body, TestRandomBelow(state, 2) ? "\r\n" : "\n");
+  }
+}
+
+// The rows the line at a time parser makes of body
+void ReferenceIngest(StringView body, const ColumnPlan *plan,
+                     SwapStore *store) {
+  while (body.size > 0) {
+    StringView line = NextLine(&body);
+    if (line.size == 0) continue;
+    Swap swap = SwapFromCSVLine(line.data, line.size, plan);
+    SwapStoreAppend(store, &swap);
+  }
+}
+
+int SameRows(SwapStore *a, SwapStore *b) {
+  if (a->size != b->size) return 0;
+  SwapColumn a_columns[SWAP_STORE_N_COLUMNS], b_columns[SWAP_STORE_N_COLUMNS];
+  SwapStoreColumns(a, a_columns);
+  SwapStoreColumns(b, b_columns);
+  for (int i = 0; i < SWAP_STORE_N_COLUMNS; i++) {
+    if (memcmp(*a_columns[i].data, *b_columns[i].data,
+               a->size * a_columns[i].elem_size) != 0)
+      return 0;
+  }
+  return 1;
+}
+
+void CheckIngest(StringView body, const ColumnPlan *plan, WorkerPool *pool,
+                 const SwapStore *reference) {
+  SwapStore store;
+  SwapStoreInit(&store, TEST_MAX_ROWS);
+  CHECK(IngestCSVBody(pool, body, plan, &store) == reference->size);
+  CHECK(SameRows(&store, (SwapStore *)reference));
+  SwapStoreFree(&store);
+}
+
+int main() {
+  uint64_t state = 0x853c49e6748fea9bULL;
+  InitCSVKernels();
+  CheckBlockKernels(&state);
+
+  char *colnames = calloc(MAX_CSV_CELLS, 64);
+  if (!colnames) Die("main - calloc");
+  size_t n_colnames = ParseLine(colnames, test_header,
+                                strlen(test_header) - 2, 64);
+  ColumnPlan plan = ColumnPlanBuild(colnames, n_colnames, 64);
+  CHECK(plan.n_columns == 13);
+  WorkerPool single_pool, pool;
+  WorkerPoolInit(&single_pool, 1);
+  WorkerPoolInit(&pool, 8);
+  for (int i = 0; i < N_BODIES; i++) {
+    IOBuffer body_buffer = {0};
+    RandomCSVBody(&body_buffer, 1 + TestRandomBelow(&state, 200), &state);
+    StringView body = {body_buffer.data, body_buffer.size};
+    SwapStore reference;
+    SwapStoreInit(&reference, TEST_MAX_ROWS);
+    ReferenceIngest(body, &plan, &reference);
+    // the plan picked the columns up
+    CHECK(reference.id[0] != 0 && reference.notional[0] != 0 &&
+          reference.ref_rate[0] != 0 && reference.end_day[0] != 0);
+    CHECK(CSVQuoteParity(body.data, body.size) ==
+          QuoteParity(body.data, body.size));
+    // every kernel, over one chunk and over many
+    csv_block_kernel = CSVBlockMasksScalar;
+    prefix_xor_kernel = PrefixXorScalar;
+    CheckIngest(body, &plan, &single_pool, &reference);
+    CheckIngest(body, &plan, &pool, &reference);
+    InitCSVKernels();
+    CheckIngest(body, &plan, &single_pool, &reference);
+    CheckIngest(body, &plan, &pool, &reference);
+    SwapStoreFree(&reference);
+    IOBufferFree(&body_buffer);
+  }
+  WorkerPoolFree(&single_pool);
+  WorkerPoolFree(&pool);
+  ColumnPlanFree(&plan);
+  free(colnames);
+  return CheckResult("tokenize_test");
+}
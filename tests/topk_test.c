@@ -0,0 +1,123 @@
+// TopK: the k best of any number of matches pushed in any order, best first
+// after TopKSort, ties going to the lower row. TopKScan, over the whole store
+// or over partitions merged together, keeps the same matches.
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define N_MATCHES 2000
+#define N_ROWS 5000
+#define N_TARGETS 20
+
+const size_t test_ks[] = {0, 1, 2, 7, 64, 500, N_MATCHES + 1};
+
+int CompareMatches(const void *a, const void *b) {
+  const SwapMatch *match_a = a, *match_b = b;
+  if (MatchIsBetter(*match_a, *match_b)) return -1;
+  return MatchIsBetter(*match_b, *match_a) ? 1 : 0;
+}
+
+// top_k, sorted, holds the first of the sorted matches
+void CheckSame(const TopK *top_k, const SwapMatch *sorted, size_t n_matches) {
+  size_t n_kept = min(top_k->k, n_matches);
+  CHECK(top_k->size == n_kept);
+  for (size_t i = 0; i < min(top_k->size, n_kept); i++) {
+    CHECK(top_k->matches[i].row == sorted[i].row);
+    CHECK(top_k->matches[i].distance == sorted[i].distance);
+  }
+}
+
+// Matches over a few distances, so that many tie, pushed in random row order
+void CheckPushes(uint64_t *state, size_t n_distances) {
+  SwapMatch *matches = malloc(N_MATCHES * sizeof(SwapMatch));
+  if (!matches) Die("CheckPushes - malloc");
+  for (size_t i = 0; i < N_MATCHES; i++) {
+    matches[i].row = i;
+    matches[i].distance = 0.5 * TestRandomBelow(state, n_distances);
+  }
+  for (size_t i = N_MATCHES - 1; i > 0; i--) {
+    size_t j = TestRandomBelow(state, i + 1);
+    SwapMatch tmp = matches[i];
+    matches[i] = matches[j];
+    matches[j] = tmp;
+  }
+  SwapMatch *sorted = malloc(N_MATCHES * sizeof(SwapMatch));
+  if (!sorted) Die("CheckPushes - malloc");
+  memcpy(sorted, matches, N_MATCHES * sizeof(SwapMatch));
+  qsort(sorted, N_MATCHES, sizeof(SwapMatch), CompareMatches);
+  for (size_t i = 0; i < sizeof(test_ks) / sizeof(size_t); i++) {
+    size_t k = test_ks[i];
+    TopK top_k;
+    TopKInit(&top_k, k);
+    for (size_t j = 0; j < N_MATCHES; j++) {
+      TopKPush(&top_k, matches[j].row, matches[j].distance);
+    }
+    if (k > N_MATCHES) {
+      CHECK(TopKBound(&top_k) == DBL_MAX);
+    } else if (k > 0) {
+      CHECK(TopKBound(&top_k) == sorted[k - 1].distance);
+    }
+    TopKSort(&top_k);
+    CheckSame(&top_k, sorted, N_MATCHES);
+    TopKFree(&top_k);
+  }
+  free(matches);
+  free(sorted);
+}
+
+// TopKScan of the whole store, and of parts of it merged as the search
+// workers do, against every row's distance sorted
+void CheckScans(const SwapStore *store, uint64_t *state) {
+  SwapMatch *sorted = malloc(store->size * sizeof(SwapMatch));
+  if (!sorted) Die("CheckScans - malloc");
+  for (int i = 0; i < N_TARGETS; i++) {
+    SwapTarget target = RandomTarget(state, 4);
+    for (size_t row = 0; row < store->size; row++) {
+      sorted[row].row = row;
+      sorted[row].distance = SwapRowDistance(&target, store, row);
+    }
+    qsort(sorted, store->size, sizeof(SwapMatch), CompareMatches);
+    for (size_t j = 1; j < sizeof(test_ks) / sizeof(size_t); j++) {
+      size_t k = test_ks[j];
+      TopK top_k;
+      TopKInit(&top_k, k);
+      TopKScan(&target, store, 0, store->size, &top_k);
+      TopKSort(&top_k);
+      CheckSame(&top_k, sorted, store->size);
+      TopKFree(&top_k);
+      // parts of uneven sizes, off the block boundaries
+      TopK merged;
+      TopKInit(&merged, k);
+      for (size_t begin = 0; begin < store->size;) {
+        size_t end = min(begin + 1 + TestRandomBelow(state, 1500), store->size);
+        TopK part;
+        TopKInit(&part, k);
+        TopKScan(&target, store, begin, end, &part);
+        for (size_t m = 0; m < part.size; m++) {
+          TopKPush(&merged, part.matches[m].row, part.matches[m].distance);
+        }
+        TopKFree(&part);
+        begin = end;
+      }
+      TopKSort(&merged);
+      CheckSame(&merged, sorted, store->size);
+      TopKFree(&merged);
+    }
+  }
+  free(sorted);
+}
+
+int main() {
+  InitSearchKernels();
+  uint64_t state = 0xa54ff53a5f1d36f1ULL;
+  CheckPushes(&state, 3);
+  CheckPushes(&state, 50);
+  CheckPushes(&state, N_MATCHES * 100);
+  SwapStore store;
+  SwapStoreInit(&store, N_ROWS);
+  // few values per coordinate, so that distances tie
+  AppendRandomSwaps(&store, N_ROWS, 4, &state);
+  CheckScans(&store, &state);
+  SwapStoreFree(&store);
+  return CheckResult("topk_test");
+}
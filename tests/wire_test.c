@@ -0,0 +1,201 @@
+// The binary protocol: packed queries, matches and aggregates decode to what
+// was encoded, byte for byte at the documented offsets, and lookup and
+// AGGREGATE requests are told apart from queries by their count's flags
+#define SERVER_NO_MAIN
+#include "../server.c"
+#include "check.c"
+
+#define FIRST_ID 800000000
+#define N_TRADES 20
+#define N_QUERIES 200
+
+int SameQuery(const SearchQuery *a, const SearchQuery *b) {
+  const Swap *swap_a = &a->swap, *swap_b = &b->swap;
+  int same = a->k == b->k && a->mode == b->mode && a->bucket == b->bucket &&
+             swap_a->start_day == swap_b->start_day &&
+             swap_a->end_day == swap_b->end_day &&
+             swap_a->trade_time == swap_b->trade_time &&
+             swap_a->fixed_rate == swap_b->fixed_rate &&
+             swap_a->notional == swap_b->notional &&
+             swap_a->ref_rate == swap_b->ref_rate &&
+             swap_a->fixed_pay_freq == swap_b->fixed_pay_freq &&
+             swap_a->float_pay_freq == swap_b->float_pay_freq &&
+             swap_a->currency == swap_b->currency &&
+             swap_a->venue == swap_b->venue &&
+             swap_a->is_block_trade == swap_b->is_block_trade &&
+             swap_a->action_type == swap_b->action_type &&
+             a->range.fields == b->range.fields;
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    same = same && a->range.min[field] == b->range.min[field] &&
+           a->range.max[field] == b->range.max[field];
+  }
+  return same;
+}
+
+// A query with any of its fields and bounds set, the others unset
+SearchQuery RandomQuery(uint64_t *state) {
+  SearchQuery query = QueryFromInputLine("");
+  Swap swap = RandomSwap(state, 1000);
+  swap.transaction_type = 0;  // not part of a query
+  int32_t *days[] = {&swap.start_day, &swap.end_day};
+  for (int i = 0; i < 2; i++) {
+    if (TestRandomBelow(state, 2)) *days[i] = 0;
+  }
+  if (TestRandomBelow(state, 2)) swap.trade_time = 0;
+  if (TestRandomBelow(state, 2)) swap.fixed_rate = 0;
+  if (TestRandomBelow(state, 2)) swap.notional = 0;
+  if (TestRandomBelow(state, 2)) swap.ref_rate = 0;
+  if (TestRandomBelow(state, 2)) swap.venue = 0;
+  query.swap = swap;
+  query.k = 1 + TestRandomBelow(state, MAX_TOP_K);
+  query.mode = TestRandomBelow(state, SEARCH_VERIFY + 1);
+  query.bucket = TestRandomBelow(state, N_ROLLUP_LEVELS);
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    if (TestRandomBelow(state, 2)) continue;
+    query.range.fields |= 1u << field;
+    query.range.min[field] = TestRandomBelow(state, 1000) * 0.25;
+    query.range.max[field] = TestRandomBelow(state, 1000) * 0.25;
+  }
+  return query;
+}
+
+void CheckQueries(uint64_t *state) {
+  char packed[BINARY_QUERY_SIZE];
+  for (int i = 0; i < N_QUERIES; i++) {
+    SearchQuery query = RandomQuery(state);
+    EncodeBinaryQuery(&query, packed);
+    SearchQuery decoded = DecodeBinaryQuery(packed);
+    CHECK(SameQuery(&query, &decoded));
+  }
+  // as parsed from text, with an empty range (see SetRangeBound)
+  SearchQuery query = QueryFromInputLine(
+      "Notional Amount 1:250,000,000;Fixed Rate 2:0.03;K:7;Mode:Scan;"
+      "Bucket:Minute;Effective Date Min:2022-09-12;Notional Amount 1 Max:x;");
+  EncodeBinaryQuery(&query, packed);
+  SearchQuery decoded = DecodeBinaryQuery(packed);
+  CHECK(SameQuery(&query, &decoded));
+  // values out of range fall back to the defaults
+  packed[4] = packed[5] = 0;
+  packed[6] = 100;
+  packed[47] = 100;
+  decoded = DecodeBinaryQuery(packed);
+  CHECK(decoded.k == 1);
+  CHECK(decoded.mode == SEARCH_INDEX);
+  CHECK(decoded.bucket == ROLLUP_HOUR);
+}
+
+void CheckSwapRecord(void) {
+  SwapRecord record = {FIRST_ID, 19000, 21000, 1662940800, 0.125, 0.03f,
+                       2.5e8f,   1,     2,     3,          4,     5,
+                       6,        7,     8};
+  char packed[SWAP_RECORD_SIZE];
+  memset(packed, 0xff, sizeof(packed));
+  EncodeSwapRecord(&record, packed);
+  CHECK(WireReadInt64(packed) == FIRST_ID);
+  // the one-byte fields in order, from offset 40
+  for (int i = 0; i < 8; i++) CHECK(packed[40 + i] == i + 1);
+  SwapRecord decoded = DecodeSwapRecord(packed);
+  CHECK(decoded.id == record.id && decoded.start_day == record.start_day &&
+        decoded.end_day == record.end_day &&
+        decoded.trade_time == record.trade_time &&
+        decoded.distance == record.distance &&
+        decoded.fixed_rate == record.fixed_rate &&
+        decoded.notional == record.notional);
+  CHECK(decoded.ref_rate == 1 && decoded.fixed_pay_freq == 2 &&
+        decoded.float_pay_freq == 3 && decoded.currency == 4 &&
+        decoded.action_type == 5 && decoded.transaction_type == 6 &&
+        decoded.is_block_trade == 7 && decoded.venue == 8);
+}
+
+void CheckAggregateRecord(void) {
+  AggregateRecord record = {1662940800, 12, 3.5e9, 0.0325, 2, 11};
+  char packed[AGGREGATE_RECORD_SIZE];
+  memset(packed, 0xff, sizeof(packed));
+  EncodeAggregateRecord(&record, packed);
+  CHECK(packed[32] == 2 && packed[33] == 11);
+  for (int i = 34; i < AGGREGATE_RECORD_SIZE; i++) CHECK(packed[i] == 0);
+  AggregateRecord decoded = DecodeAggregateRecord(packed);
+  CHECK(decoded.bucket_start == record.bucket_start &&
+        decoded.count == record.count && decoded.notional == record.notional &&
+        decoded.fixed_rate == record.fixed_rate &&
+        decoded.ref_rate == record.ref_rate && decoded.tenor == record.tenor);
+}
+
+IOBuffer Answer(TestServer *server, const char *request, size_t request_size) {
+  IOBuffer output = {0};
+  SwapBook *book = AcquireBook(&server->context);
+  AnswerBinaryRequest(request, request_size, &server->context, book,
+                      &server->context.worker_pool, &output);
+  ReleaseBook(&server->context, book);
+  return output;
+}
+
+// A lookup of a trade and of a missing id, answered with the trade and with
+// no match
+void CheckLookup(TestServer *server) {
+  char request[sizeof(uint32_t) + 2 * LOOKUP_ID_SIZE];
+  WireWriteUint32(request, 2 | BINARY_LOOKUP_FLAG);
+  WireWriteInt64(request + sizeof(uint32_t), FIRST_ID + 3);
+  WireWriteInt64(request + sizeof(uint32_t) + LOOKUP_ID_SIZE, 12345);
+  CHECK(IsBinaryLookupRequest(request, sizeof(request)));
+  CHECK(!IsBinaryAggregateRequest(request, sizeof(request)));
+  IOBuffer output = Answer(server, request, sizeof(request));
+  CHECK(output.size == 3 * sizeof(uint32_t) + SWAP_RECORD_SIZE);
+  if (output.size == 3 * sizeof(uint32_t) + SWAP_RECORD_SIZE) {
+    CHECK(WireReadUint32(output.data) == 2);
+    CHECK(WireReadUint32(output.data + 4) == 1);
+    SwapRecord record = DecodeSwapRecord(output.data + 8);
+    CHECK(record.id == FIRST_ID + 3);
+    CHECK(WireReadUint32(output.data + 8 + SWAP_RECORD_SIZE) == 0);
+  }
+  IOBufferFree(&output);
+}
+
+// An AGGREGATE of every trade, answered with buckets that count them all
+void CheckAggregate(TestServer *server) {
+  char request[sizeof(uint32_t) + BINARY_QUERY_SIZE];
+  WireWriteUint32(request, 1 | BINARY_AGGREGATE_FLAG);
+  SearchQuery query = QueryFromInputLine("Bucket:Hour;");
+  EncodeBinaryQuery(&query, request + sizeof(uint32_t));
+  CHECK(IsBinaryAggregateRequest(request, sizeof(request)));
+  CHECK(!IsBinaryLookupRequest(request, sizeof(request)));
+  IOBuffer output = Answer(server, request, sizeof(request));
+  CHECK(output.size >= sizeof(uint32_t));
+  size_t n_buckets = WireReadUint32(output.data);
+  CHECK(output.size == sizeof(uint32_t) + n_buckets * AGGREGATE_RECORD_SIZE);
+  int64_t count = 0;
+  for (size_t i = 0; i < n_buckets; i++) {
+    const char *packed =
+        output.data + sizeof(uint32_t) + i * AGGREGATE_RECORD_SIZE;
+    count += DecodeAggregateRecord(packed).count;
+  }
+  CHECK(count == N_TRADES);
+  IOBufferFree(&output);
+}
+
+int main() {
+  InitSearchKernels();
+  InitCSVKernels();
+  uint64_t state = 0xbb67ae8584caa73bULL;
+  CheckQueries(&state);
+  CheckSwapRecord();
+  CheckAggregateRecord();
+
+  IOBuffer csv = {0};
+  AppendText(&csv, test_csv_header);
+  for (long id = 1; id <= N_TRADES; id++) {
+    AppendTestCSVLine(&csv, FIRST_ID + id, 0, "NEW", &state);
+  }
+  TestServer server;
+  TestServerStart(&server, "wire_test", &csv);
+  CheckLookup(&server);
+  CheckAggregate(&server);
+  // a plain query count is neither
+  char request[sizeof(uint32_t)];
+  WireWriteUint32(request, 1);
+  CHECK(!IsBinaryLookupRequest(request, sizeof(request)));
+  CHECK(!IsBinaryAggregateRequest(request, sizeof(request)));
+  TestServerStop(&server);
+  IOBufferFree(&csv);
+  return CheckResult("wire_test");
+}
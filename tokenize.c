@@ -0,0 +1,227 @@
+/*** SIMD CSV tokenizer ***/
+// Finds cell and line boundaries 64 bytes at a time, in the style of
+// simdjson: each block becomes one bitmask per character class (quotes,
+// commas, line breaks), the quoted regions are the prefix XOR of the quote
+// bits (a carry-less multiply by all ones), and the commas and line breaks
+// inside them are masked out. The scanner then walks the remaining bits to
+// hand out each line with the offsets of its cell boundaries.
+#define CSV_BLOCK_SIZE 64
+#define MAX_CSV_CELLS 256
+
+typedef struct CSVBlockMasks {
+  uint64_t quotes;
+  uint64_t commas;
+  uint64_t newlines;
+} CSVBlockMasks;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Bit i set when byte i of word is c, 8 bytes at a time with plain integer
+// ops (SWAR): a byte of word ^ c is zero exactly when adding 0x7f to its low
+// 7 bits doesn't carry into a high bit that's also clear
+static inline uint64_t ByteMatches8(uint64_t word, char c) {
+  uint64_t x = word ^ (0x0101010101010101ULL * (uint8_t)c);
+  uint64_t t = ((x & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | x;
+  uint64_t high_bits = ~t & 0x8080808080808080ULL;
+  // gather the 8 high bits into the low byte
+  return ((high_bits >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+void CSVBlockMasksScalar(const char *block, CSVBlockMasks *masks) {
+  masks->quotes = masks->commas = masks->newlines = 0;
+  for (int i = 0; i < CSV_BLOCK_SIZE / 8; i++) {
+    uint64_t word;
+    memcpy(&word, block + 8 * i, 8);
+    masks->quotes |= ByteMatches8(word, '"') << (8 * i);
+    masks->commas |= ByteMatches8(word, ',') << (8 * i);
+    masks->newlines |= ByteMatches8(word, '\n') << (8 * i);
+  }
+}
+#else
+void CSVBlockMasksScalar(const char *block, CSVBlockMasks *masks) {
+  masks->quotes = masks->commas = masks->newlines = 0;
+  for (int i = 0; i < CSV_BLOCK_SIZE; i++) {
+    masks->quotes |= (uint64_t)(block[i] == '"') << i;
+    masks->commas |= (uint64_t)(block[i] == ',') << i;
+    masks->newlines |= (uint64_t)(block[i] == '\n') << i;
+  }
+}
+#endif
+
+// Bit i of the result is the XOR of bits 0..i
+uint64_t PrefixXorScalar(uint64_t bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2"))) static inline uint64_t CSVMatchAVX2(
+    __m256i low, __m256i high, char c) {
+  __m256i pattern = _mm256_set1_epi8(c);
+  uint32_t low_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, pattern));
+  uint32_t high_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, pattern));
+  return (uint64_t)low_bits | ((uint64_t)high_bits << 32);
+}
+
+__attribute__((target("avx2"))) void CSVBlockMasksAVX2(const char *block,
+                                                       CSVBlockMasks *masks) {
+  __m256i low = _mm256_loadu_si256((const __m256i *)block);
+  __m256i high = _mm256_loadu_si256((const __m256i *)(block + 32));
+  masks->quotes = CSVMatchAVX2(low, high, '"');
+  masks->commas = CSVMatchAVX2(low, high, ',');
+  masks->newlines = CSVMatchAVX2(low, high, '\n');
+}
+
+__attribute__((target("pclmul,sse2"))) uint64_t PrefixXorCLMUL(
+    uint64_t bits) {
+  __m128i product = _mm_clmulepi64_si128(
+      _mm_set_epi64x(0, (long long)bits), _mm_set1_epi8((char)0xFF), 0);
+  uint64_t res;
+  _mm_storel_epi64((__m128i *)&res, product);
+  return res;
+}
+#endif
+
+typedef void (*CSVBlockKernel)(const char *block, CSVBlockMasks *masks);
+typedef uint64_t (*PrefixXorKernel)(uint64_t bits);
+
+CSVBlockKernel csv_block_kernel = CSVBlockMasksScalar;
+PrefixXorKernel prefix_xor_kernel = PrefixXorScalar;
+
+// Pick the widest tokenizer kernels the CPU we're running on supports
+void InitCSVKernels() {
+  csv_block_kernel = CSVBlockMasksScalar;
+  prefix_xor_kernel = PrefixXorScalar;
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) csv_block_kernel = CSVBlockMasksAVX2;
+  if (__builtin_cpu_supports("pclmul")) prefix_xor_kernel = PrefixXorCLMUL;
+#endif
+}
+
+// QuoteParity a block at a time
+int CSVQuoteParity(const char *data, size_t size) {
+  CSVBlockMasks masks;
+  int parity = 0;
+  size_t offset = 0;
+  for (; offset + CSV_BLOCK_SIZE <= size; offset += CSV_BLOCK_SIZE) {
+    csv_block_kernel(data + offset, &masks);
+    parity ^= __builtin_popcountll(masks.quotes) & 1;
+  }
+  return parity ^ QuoteParity(data + offset, size - offset);
+}
+
+// One line of the scanned range. Cell i spans from the separator ending cell
+// i - 1 (or the start of the line) to cell_ends[i], quotes included.
+typedef struct CSVLine {
+  const char *data;
+  size_t size;
+  size_t n_cells;  // at most the max_cells asked for
+  uint32_t cell_ends[MAX_CSV_CELLS];
+} CSVLine;
+
+typedef struct CSVScanner {
+  const char *line_start;
+  const char *next_block;
+  const char *end;
+  const char *block;    // the block the masks below belong to
+  uint64_t separators;  // unquoted commas and line breaks not handed out yet
+  uint64_t newlines;    // unquoted line breaks
+  uint64_t in_quotes;   // all ones when the last block ended inside quotes
+  char tail[CSV_BLOCK_SIZE];  // zero-padded copy of a last partial block
+} CSVScanner;
+
+// [begin, end) has to start outside quotes, e.g. at the start of a line
+void CSVScannerInit(CSVScanner *scanner, const char *begin, const char *end) {
+  memset(scanner, 0, sizeof(CSVScanner));
+  scanner->line_start = scanner->next_block = scanner->block = begin;
+  scanner->end = end;
+}
+
+// Computes the masks of the next block, returns 0 at the end of the range
+int CSVScannerLoad(CSVScanner *scanner) {
+  if (scanner->next_block >= scanner->end) return 0;
+  const char *data = scanner->next_block;
+  size_t remaining = scanner->end - scanner->next_block;
+  if (remaining < CSV_BLOCK_SIZE) {
+    // the padding holds no structural characters
+    memset(scanner->tail, 0, CSV_BLOCK_SIZE);
+    memcpy(scanner->tail, data, remaining);
+    data = scanner->tail;
+  }
+  CSVBlockMasks masks;
+  csv_block_kernel(data, &masks);
+  uint64_t quoted = prefix_xor_kernel(masks.quotes) ^ scanner->in_quotes;
+  scanner->in_quotes = (uint64_t)((int64_t)quoted >> 63);
+  scanner->newlines = masks.newlines & ~quoted;
+  scanner->separators = (masks.commas & ~quoted) | scanner->newlines;
+  scanner->block = scanner->next_block;
+  scanner->next_block += CSV_BLOCK_SIZE;
+  return 1;
+}
+
+// Hands out the next non-empty line, without its line break ("\n" or
+// "\r\n"), along with the ends of its first max_cells cells. Returns 0 once
+// the range is exhausted.
+int CSVScannerNextLine(CSVScanner *scanner, CSVLine *line, size_t max_cells) {
+  max_cells = min(max_cells, MAX_CSV_CELLS);
+  while (1) {
+    const char *line_start = scanner->line_start;
+    const char *line_end = NULL;
+    line->n_cells = 0;
+    while (!line_end) {
+      // past max_cells only the line break matters
+      uint64_t wanted = line->n_cells < max_cells
+                            ? scanner->separators
+                            : scanner->separators & scanner->newlines;
+      if (wanted == 0) {
+        if (CSVScannerLoad(scanner)) continue;
+        if (line_start >= scanner->end) return 0;
+        line_end = scanner->end;
+        break;
+      }
+      int bit = __builtin_ctzll(wanted);
+      // drop this separator and any skipped before it
+      scanner->separators &= ~(((uint64_t)2 << bit) - 1);
+      const char *separator = scanner->block + bit;
+      if ((scanner->newlines >> bit) & 1) {
+        line_end = separator;
+      } else {
+        line->cell_ends[line->n_cells++] = separator - line_start;
+      }
+    }
+    scanner->line_start = line_end < scanner->end ? line_end + 1 : line_end;
+    line->data = line_start;
+    line->size = line_end - line_start;
+    if (line->size > 0 && line_start[line->size - 1] == '\r') line->size--;
+    if (line->size == 0) continue;
+    if (line->n_cells < max_cells)
+      line->cell_ends[line->n_cells++] = line->size;
+    return 1;
+  }
+}
+
+// Cell cell_idx of a scanned line, enclosing quotes dropped
+StringView CSVLineCell(const CSVLine *line, size_t cell_idx) {
+  size_t begin = cell_idx == 0 ? 0 : line->cell_ends[cell_idx - 1] + 1;
+  size_t end = min(line->cell_ends[cell_idx], line->size);
+  StringView cell = {line->data + begin, end > begin ? end - begin : 0};
+  return StripQuotes(cell);
+}
+
+// SwapFromCSVLine on a scanned line: the plan's skipped columns cost nothing
+Swap SwapFromCSVCells(const CSVLine *line, const ColumnPlan *plan) {
+  SwapCells cells;
+  SwapCellsInit(&cells);
+  size_t n_cells = min(line->n_cells, plan->n_columns);
+  for (size_t col = 0; col < n_cells; col++) {
+    enum AttrToParse attr_name = plan->attrs[col];
+    if (attr_name != PARSE_ERROR)
+      SwapCellsAssign(&cells, attr_name, CSVLineCell(line, col));
+  }
+  return SwapCellsFinish(&cells);
+}
@@ -0,0 +1,112 @@
+/*** Top-K nearest swaps ***/
+#define TOPK_BLOCK_SIZE 256
+
+typedef struct SwapMatch {
+  size_t row;
+  double distance;
+} SwapMatch;
+
+// Bounded max-heap on (distance, row): the root is the worst match we are
+// still holding, so a candidate only has to beat it to get in.
+typedef struct TopK {
+  size_t k;
+  size_t size;
+  SwapMatch *matches;
+} TopK;
+
+void TopKInit(TopK *top_k, size_t k) {
+  top_k->k = k;
+  top_k->size = 0;
+  top_k->matches = malloc(k * sizeof(SwapMatch));
+  if (k > 0 && !top_k->matches) Die("TopKInit - malloc");
+}
+
+void TopKFree(TopK *top_k) {
+  free(top_k->matches);
+  top_k->matches = NULL;
+  top_k->size = 0;
+}
+
+// Smaller distance wins, ties go to the lower row like GetNearestSwapL2
+static inline int MatchIsBetter(SwapMatch a, SwapMatch b) {
+  return a.distance < b.distance || (a.distance == b.distance && a.row < b.row);
+}
+
+void TopKSiftDown(TopK *top_k, size_t idx) {
+  SwapMatch *heap = top_k->matches;
+  while (1) {
+    size_t worst = idx;
+    size_t left = 2 * idx + 1;
+    size_t right = left + 1;
+    if (left < top_k->size && MatchIsBetter(heap[worst], heap[left]))
+      worst = left;
+    if (right < top_k->size && MatchIsBetter(heap[worst], heap[right]))
+      worst = right;
+    if (worst == idx) return;
+    SwapMatch tmp = heap[idx];
+    heap[idx] = heap[worst];
+    heap[worst] = tmp;
+    idx = worst;
+  }
+}
+
+void TopKPush(TopK *top_k, size_t row, double distance) {
+  SwapMatch match = {row, distance};
+  SwapMatch *heap = top_k->matches;
+  if (top_k->size < top_k->k) {
+    size_t idx = top_k->size++;
+    while (idx > 0) {
+      size_t parent = (idx - 1) / 2;
+      if (!MatchIsBetter(heap[parent], match)) break;
+      heap[idx] = heap[parent];
+      idx = parent;
+    }
+    heap[idx] = match;
+  } else if (top_k->k > 0 && MatchIsBetter(match, heap[0])) {
+    heap[0] = match;
+    TopKSiftDown(top_k, 0);
+  }
+}
+
+// Distance a candidate has to beat to make it in, DBL_MAX until we're full
+static inline double TopKBound(const TopK *top_k) {
+  return top_k->size < top_k->k ? DBL_MAX : top_k->matches[0].distance;
+}
+
+// Heap-sorts the matches in place, best first. The heap is empty afterwards
+// as far as TopKPush is concerned, so only call this once we're done.
+void TopKSort(TopK *top_k) {
+  size_t n = top_k->size;
+  while (top_k->size > 1) {
+    SwapMatch tmp = top_k->matches[0];
+    top_k->matches[0] = top_k->matches[--top_k->size];
+    top_k->matches[top_k->size] = tmp;
+    TopKSiftDown(top_k, 0);
+  }
+  top_k->size = n;
+}
+
+// Scan [begin, end) in blocks: the distance kernel scores a whole block, then
+// only rows that beat the current bound touch the heap.
+void TopKScan(const SwapTarget *target, const SwapStore *store, size_t begin,
+              size_t end, TopK *top_k) {
+  if (top_k->k == 1) {
+    double nearest_distance;
+    size_t row = nearest_row_kernel(target, store, begin, end,
+                                    &nearest_distance);
+    if (row != end) TopKPush(top_k, row, nearest_distance);
+    return;
+  }
+  double distances[TOPK_BLOCK_SIZE];
+  for (size_t block = begin; block < end; block += TOPK_BLOCK_SIZE) {
+    size_t block_end = min(block + TOPK_BLOCK_SIZE, end);
+    distances_kernel(target, store, block, block_end, distances);
+    double bound = TopKBound(top_k);
+    for (size_t row = block; row < block_end; row++) {
+      if (distances[row - block] <= bound) {
+        TopKPush(top_k, row, distances[row - block]);
+        bound = TopKBound(top_k);
+      }
+    }
+  }
+}
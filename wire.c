@@ -0,0 +1,298 @@
+/*** Binary wire protocol ***/
+// Fixed-layout encoding of queries and matches, for framed connections that
+// ask for it with a "Protocol:Binary;" frame (see HandleSearchRequest). A
+// request payload is a uint32 query count followed by that many packed
+// queries; the response is a uint32 count of answered queries, each followed
+// by a uint32 match count and that many packed records, best first. A count
+// with BINARY_LOOKUP_FLAG set is a lookup of that many int64 Dissemination
+// IDs instead, each answered with its trade, or no match. One with
+// BINARY_AGGREGATE_FLAG set is an AGGREGATE of the one packed query, answered
+// with a uint32 bucket count and that many packed aggregates. Values are
+// little-endian, the byte order of every host we run on, so encoding and
+// decoding are plain copies there.
+#define BINARY_PROTOCOL_REQUEST "Protocol:Binary;"
+#define TEXT_PROTOCOL_REQUEST "Protocol:Text;"
+#define BINARY_QUERY_SIZE 128
+#define RANGE_BOUNDS_OFFSET 48  // min and max doubles per RangeField
+#define SWAP_RECORD_SIZE 48
+#define BINARY_LOOKUP_FLAG 0x80000000u
+#define LOOKUP_ID_SIZE 8
+#define BINARY_AGGREGATE_FLAG 0x40000000u
+#define AGGREGATE_RECORD_SIZE 40
+
+// Fields set in a packed query, unset ones aren't part of the search
+enum QueryField {
+  QUERY_START_DAY = 1 << 0,
+  QUERY_END_DAY = 1 << 1,
+  QUERY_TRADE_TIME = 1 << 2,
+  QUERY_FIXED_RATE = 1 << 3,
+  QUERY_NOTIONAL = 1 << 4,
+  QUERY_REF_RATE = 1 << 5,
+  QUERY_FIXED_PAY_FREQ = 1 << 6,
+  QUERY_FLOAT_PAY_FREQ = 1 << 7,
+  QUERY_CURRENCY = 1 << 8,
+  QUERY_VENUE = 1 << 9,
+  QUERY_IS_BLOCK_TRADE = 1 << 10,
+  QUERY_ACTION_TYPE = 1 << 11
+};
+
+// A match as it goes over the wire
+typedef struct SwapRecord {
+  int64_t id;
+  int32_t start_day;
+  int32_t end_day;
+  int64_t trade_time;
+  double distance;
+  float fixed_rate;
+  float notional;
+  uint8_t ref_rate;
+  uint8_t fixed_pay_freq;
+  uint8_t float_pay_freq;
+  uint8_t currency;
+  uint8_t action_type;
+  uint8_t transaction_type;
+  uint8_t is_block_trade;
+  uint8_t venue;
+} SwapRecord;
+
+// A bucket of an AGGREGATE answer as it goes over the wire
+typedef struct AggregateRecord {
+  int64_t bucket_start;  // seconds since 1970-01-01T00:00:00
+  int64_t count;
+  double notional;
+  double fixed_rate;  // notional-weighted
+  uint8_t ref_rate;
+  uint8_t tenor;  // see tenor_buckets
+} AggregateRecord;
+
+static inline void WireWrite(char *out, const void *value, size_t size) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(out, value, size);
+#else
+  const char *bytes = value;
+  for (size_t i = 0; i < size; i++) out[i] = bytes[size - 1 - i];
+#endif
+}
+
+static inline void WireRead(void *value, const char *in, size_t size) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(value, in, size);
+#else
+  for (size_t i = 0; i < size; i++) ((char *)value)[i] = in[size - 1 - i];
+#endif
+}
+
+void WireWriteUint32(char *out, uint32_t value) {
+  WireWrite(out, &value, sizeof(value));
+}
+
+uint32_t WireReadUint32(const char *in) {
+  uint32_t value;
+  WireRead(&value, in, sizeof(value));
+  return value;
+}
+
+void WireWriteInt64(char *out, int64_t value) {
+  WireWrite(out, &value, sizeof(value));
+}
+
+int64_t WireReadInt64(const char *in) {
+  int64_t value;
+  WireRead(&value, in, sizeof(value));
+  return value;
+}
+
+void EncodeBinaryQuery(const SearchQuery *query, char *out) {
+  const Swap *swap_p = &query->swap;
+  memset(out, 0, BINARY_QUERY_SIZE);
+  uint32_t fields = (swap_p->start_day != 0 ? QUERY_START_DAY : 0) |
+                    (swap_p->end_day != 0 ? QUERY_END_DAY : 0) |
+                    (swap_p->trade_time != 0 ? QUERY_TRADE_TIME : 0) |
+                    (swap_p->fixed_rate != 0 ? QUERY_FIXED_RATE : 0) |
+                    (swap_p->notional != 0 ? QUERY_NOTIONAL : 0) |
+                    (swap_p->ref_rate != 0 ? QUERY_REF_RATE : 0) |
+                    (swap_p->fixed_pay_freq != 0 ? QUERY_FIXED_PAY_FREQ : 0) |
+                    (swap_p->float_pay_freq != 0 ? QUERY_FLOAT_PAY_FREQ : 0) |
+                    (swap_p->currency != 0 ? QUERY_CURRENCY : 0) |
+                    (swap_p->venue != 0 ? QUERY_VENUE : 0) |
+                    (swap_p->is_block_trade != 0 ? QUERY_IS_BLOCK_TRADE : 0) |
+                    (swap_p->action_type != 0 ? QUERY_ACTION_TYPE : 0);
+  uint16_t k = query->k;
+  double fixed_rate = swap_p->fixed_rate;
+  double notional = swap_p->notional;
+  WireWriteUint32(out, fields);
+  WireWrite(out + 4, &k, sizeof(k));
+  out[6] = (char)query->mode;
+  out[7] = (char)query->range.fields;
+  WireWrite(out + 8, &swap_p->start_day, sizeof(int32_t));
+  WireWrite(out + 12, &swap_p->end_day, sizeof(int32_t));
+  WireWrite(out + 16, &swap_p->trade_time, sizeof(int64_t));
+  WireWrite(out + 24, &fixed_rate, sizeof(double));
+  WireWrite(out + 32, &notional, sizeof(double));
+  out[40] = (char)swap_p->ref_rate;
+  out[41] = (char)swap_p->fixed_pay_freq;
+  out[42] = (char)swap_p->float_pay_freq;
+  out[43] = (char)swap_p->currency;
+  out[44] = (char)swap_p->venue;
+  out[45] = (char)swap_p->is_block_trade;
+  out[46] = (char)swap_p->action_type;
+  out[47] = (char)query->bucket;
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    char *bounds = out + RANGE_BOUNDS_OFFSET + 2 * sizeof(double) * field;
+    WireWrite(bounds, &query->range.min[field], sizeof(double));
+    WireWrite(bounds + sizeof(double), &query->range.max[field],
+              sizeof(double));
+  }
+}
+
+SearchQuery DecodeBinaryQuery(const char *in) {
+  SearchQuery query = {0};
+  Swap *swap_p = &query.swap;
+  const unsigned char *bytes = (const unsigned char *)in;
+  uint32_t fields = WireReadUint32(in);
+  uint16_t k;
+  WireRead(&k, in + 4, sizeof(k));
+  query.k = min(max(k, 1), MAX_TOP_K);
+  query.mode = bytes[6] <= SEARCH_VERIFY ? (SearchMode)bytes[6] : SEARCH_INDEX;
+  query.bucket = bytes[47] < N_ROLLUP_LEVELS ? (RollupLevel)bytes[47]
+                                             : ROLLUP_HOUR;
+  if (fields & QUERY_START_DAY)
+    WireRead(&swap_p->start_day, in + 8, sizeof(int32_t));
+  if (fields & QUERY_END_DAY)
+    WireRead(&swap_p->end_day, in + 12, sizeof(int32_t));
+  if (fields & QUERY_TRADE_TIME)
+    WireRead(&swap_p->trade_time, in + 16, sizeof(int64_t));
+  double value;
+  if (fields & QUERY_FIXED_RATE) {
+    WireRead(&value, in + 24, sizeof(double));
+    swap_p->fixed_rate = (float)value;
+  }
+  if (fields & QUERY_NOTIONAL) {
+    WireRead(&value, in + 32, sizeof(double));
+    swap_p->notional = (float)value;
+  }
+  // out of range values pin nothing, as in CategoryIndexSelect
+  if (fields & QUERY_REF_RATE) swap_p->ref_rate = bytes[40];
+  if (fields & QUERY_FIXED_PAY_FREQ) swap_p->fixed_pay_freq = bytes[41];
+  if (fields & QUERY_FLOAT_PAY_FREQ) swap_p->float_pay_freq = bytes[42];
+  if (fields & QUERY_CURRENCY) swap_p->currency = bytes[43];
+  if (fields & QUERY_VENUE) swap_p->venue = bytes[44];
+  if (fields & QUERY_IS_BLOCK_TRADE) swap_p->is_block_trade = bytes[45];
+  if (fields & QUERY_ACTION_TYPE) swap_p->action_type = bytes[46];
+  RangeFilterInit(&query.range);
+  query.range.fields = bytes[7] & ((1u << N_RANGE_FIELDS) - 1);
+  for (int field = 0; field < N_RANGE_FIELDS; field++) {
+    if (!(query.range.fields & (1u << field))) continue;
+    const char *bounds = in + RANGE_BOUNDS_OFFSET + 2 * sizeof(double) * field;
+    WireRead(&query.range.min[field], bounds, sizeof(double));
+    WireRead(&query.range.max[field], bounds + sizeof(double), sizeof(double));
+  }
+  return query;
+}
+
+void EncodeSwapRecord(const SwapRecord *record, char *out) {
+  WireWrite(out, &record->id, sizeof(int64_t));
+  WireWrite(out + 8, &record->start_day, sizeof(int32_t));
+  WireWrite(out + 12, &record->end_day, sizeof(int32_t));
+  WireWrite(out + 16, &record->trade_time, sizeof(int64_t));
+  WireWrite(out + 24, &record->distance, sizeof(double));
+  WireWrite(out + 32, &record->fixed_rate, sizeof(float));
+  WireWrite(out + 36, &record->notional, sizeof(float));
+  out[40] = (char)record->ref_rate;
+  out[41] = (char)record->fixed_pay_freq;
+  out[42] = (char)record->float_pay_freq;
+  out[43] = (char)record->currency;
+  out[44] = (char)record->action_type;
+  out[45] = (char)record->transaction_type;
+  out[46] = (char)record->is_block_trade;
+  out[47] = (char)record->venue;
+}
+
+SwapRecord DecodeSwapRecord(const char *in) {
+  SwapRecord record;
+  WireRead(&record.id, in, sizeof(int64_t));
+  WireRead(&record.start_day, in + 8, sizeof(int32_t));
+  WireRead(&record.end_day, in + 12, sizeof(int32_t));
+  WireRead(&record.trade_time, in + 16, sizeof(int64_t));
+  WireRead(&record.distance, in + 24, sizeof(double));
+  WireRead(&record.fixed_rate, in + 32, sizeof(float));
+  WireRead(&record.notional, in + 36, sizeof(float));
+  record.ref_rate = (uint8_t)in[40];
+  record.fixed_pay_freq = (uint8_t)in[41];
+  record.float_pay_freq = (uint8_t)in[42];
+  record.currency = (uint8_t)in[43];
+  record.action_type = (uint8_t)in[44];
+  record.transaction_type = (uint8_t)in[45];
+  record.is_block_trade = (uint8_t)in[46];
+  record.venue = (uint8_t)in[47];
+  return record;
+}
+
+const char *RefRateName(uint8_t ref_rate) {
+  switch (ref_rate) {
+    case USSOFR:
+      return "USSOFR";
+    case USLIBOR:
+      return "USLIBOR";
+    case USCPI:
+      return "USCPI";
+    case USSTERM:
+      return "USTERM";
+    default:
+      return "ERROR";
+  }
+}
+
+#define MAX_RECORD_TEXT_SIZE 512
+
+// The text protocol's line for a match, returns its length
+int FormatSwapRecord(const SwapRecord *record, char *out, size_t out_size) {
+  char start_date[DATE_STR_LEN + 8], end_date[DATE_STR_LEN + 8];
+  DateFromEpochDay(start_date, record->start_day);
+  DateFromEpochDay(end_date, record->end_day);
+  return snprintf(out, out_size,
+                  "ID:%lld;StartDate:%s;EndDate:%s;FixedRate:%lf;"
+                  "Notional:%lf;RefRate:%s;FixedFreq:%d;FloatFreq:%d;"
+                  "Distance:%lf;\n",
+                  (long long)record->id, start_date, end_date,
+                  record->fixed_rate, record->notional,
+                  RefRateName(record->ref_rate), record->fixed_pay_freq,
+                  record->float_pay_freq, record->distance);
+}
+
+void EncodeAggregateRecord(const AggregateRecord *record, char *out) {
+  memset(out, 0, AGGREGATE_RECORD_SIZE);
+  WireWriteInt64(out, record->bucket_start);
+  WireWriteInt64(out + 8, record->count);
+  WireWrite(out + 16, &record->notional, sizeof(double));
+  WireWrite(out + 24, &record->fixed_rate, sizeof(double));
+  out[32] = (char)record->ref_rate;
+  out[33] = (char)record->tenor;
+}
+
+AggregateRecord DecodeAggregateRecord(const char *in) {
+  AggregateRecord record;
+  record.bucket_start = WireReadInt64(in);
+  record.count = WireReadInt64(in + 8);
+  WireRead(&record.notional, in + 16, sizeof(double));
+  WireRead(&record.fixed_rate, in + 24, sizeof(double));
+  record.ref_rate = (uint8_t)in[32];
+  record.tenor = (uint8_t)in[33];
+  return record;
+}
+
+// The text protocol's line for an aggregate, returns its length
+int FormatAggregateRecord(const AggregateRecord *record, char *out,
+                          size_t out_size) {
+  char bucket[DATE_STR_LEN + 16];
+  DatetimeFromEpochSeconds(bucket, record->bucket_start);
+  const char *tenor = record->tenor < N_TENOR_BUCKETS
+                          ? tenor_buckets[record->tenor].name
+                          : "ERROR";
+  return snprintf(out, out_size,
+                  "Bucket:%s;RefRate:%s;Tenor:%s;Count:%lld;Notional:%lf;"
+                  "FixedRate:%lf;\n",
+                  bucket, RefRateName(record->ref_rate), tenor,
+                  (long long)record->count, record->notional,
+                  record->fixed_rate);
+}